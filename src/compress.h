@@ -0,0 +1,407 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+/*
+ * Description: Selection of a subset of Monte-Carlo replicas that preserves
+ *              the statistics of the full ensemble, used by "mcgen.x compress".
+ *
+ *              The replicas are given by their values at nv points (Q, x,
+ *              flavor). Every point is standardized with the mean and the
+ *              standard deviation of the full ensemble, z = (f - mean)/sigma;
+ *              points that do not vary are left out. The error function of a
+ *              subset sums six terms over the points, each divided by its
+ *              average over random subsets of the same size:
+ *                mean       mean(z)^2
+ *                std        (std(z) - 1)^2
+ *                skewness   (skew(z) - skew_prior)^2
+ *                kurtosis   (kurt(z) - kurt_prior)^2
+ *                KS         sum over the bins (-inf,-2,-1,0,1,2,inf) of z of
+ *                           (fraction in subset - fraction in prior)^2
+ *                corr       (rho_ab - rho_ab_prior)^2 for the pairs (a, b) of
+ *                           the anchor points
+ *              A random subset therefore has an error of about 6.
+ *
+ *              The subset keeps the power sums of z, the bin counts and the
+ *              cross sums of the anchor pairs, so exchanging one replica
+ *              updates the error function in O(nv) operations. The search is
+ *              simulated annealing over such exchanges, with a geometric
+ *              cooling schedule. compressChains independent chains run on the
+ *              thread pool, each with its own random sequence (seed + chain),
+ *              and the best subset is kept, so the result does not depend on
+ *              the number of threads.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "threadpool.h"
+
+// number of annealing chains
+const std::size_t compressChains = 8;
+// number of random subsets for the normalization of the error terms
+const std::size_t compressRandomSubsets = 64;
+// number of terms of the error function
+const int compressTerms = 6;
+// bins of the standardized values for the KS term
+const int compressBins = 6;
+
+class ReplicaCompressor
+{
+private:
+  std::size_t nrep, nv;                          // replicas, varying points
+  std::vector<double> z;                         // [r*nv + v], standardized values
+  std::vector<unsigned char> bin;                // [r*nv + v], KS bin of z
+  std::vector<double> skewPrior, kurtPrior;      // [v]
+  std::vector<double> binPrior;                  // [v*compressBins + b], fractions
+  std::vector<std::pair<std::size_t, std::size_t>> pairs; // anchor pairs (a, b)
+  std::vector<double> corrPrior;                 // [pair]
+  double norm[compressTerms];
+
+  // state of a subset: power sums of z, bin counts, cross sums of the pairs
+  struct Subset
+  {
+    std::vector<std::size_t> members;
+    std::vector<double> s1, s2, s3, s4, cross;
+    std::vector<int> counts; // [v*compressBins + b]
+  };
+
+  static unsigned char Bin(double zv)
+  {
+    return (zv >= -2.) + (zv >= -1.) + (zv >= 0.) + (zv >= 1.) + (zv >= 2.);
+  }
+
+  Subset MakeSubset(const std::vector<std::size_t> &members) const
+  {
+    Subset s;
+    s.members = members;
+    s.s1.assign(nv, 0.);
+    s.s2.assign(nv, 0.);
+    s.s3.assign(nv, 0.);
+    s.s4.assign(nv, 0.);
+    s.counts.assign(nv * compressBins, 0);
+    s.cross.assign(pairs.size(), 0.);
+    for (std::size_t k = 0; k < members.size(); k++)
+      Exchange(s, nrep, members[k]);
+    return s;
+  } // MakeSubset()
+
+  // Removes replica rout and adds replica rin (nrep means none)
+  void Exchange(Subset &s, std::size_t rout, std::size_t rin) const
+  {
+    for (std::size_t v = 0; v < nv; v++)
+    {
+      double d1 = 0., d2 = 0., d3 = 0., d4 = 0.;
+      if (rout < nrep)
+      {
+        const double zo = z[rout * nv + v], zo2 = zo * zo;
+        d1 -= zo;
+        d2 -= zo2;
+        d3 -= zo2 * zo;
+        d4 -= zo2 * zo2;
+        s.counts[v * compressBins + bin[rout * nv + v]]--;
+      }
+      if (rin < nrep)
+      {
+        const double zi = z[rin * nv + v], zi2 = zi * zi;
+        d1 += zi;
+        d2 += zi2;
+        d3 += zi2 * zi;
+        d4 += zi2 * zi2;
+        s.counts[v * compressBins + bin[rin * nv + v]]++;
+      }
+      s.s1[v] += d1;
+      s.s2[v] += d2;
+      s.s3[v] += d3;
+      s.s4[v] += d4;
+    } // for (std::size_t v = 0...
+    for (std::size_t p = 0; p < pairs.size(); p++)
+    {
+      if (rout < nrep)
+        s.cross[p] -= z[rout * nv + pairs[p].first] * z[rout * nv + pairs[p].second];
+      if (rin < nrep)
+        s.cross[p] += z[rin * nv + pairs[p].first] * z[rin * nv + pairs[p].second];
+    }
+    if (rout < nrep && rin < nrep)
+      *std::find(s.members.begin(), s.members.end(), rout) = rin;
+  } // Exchange()
+
+  // moments of a point from its power sums, n values
+  static void Moments(double n, double s1, double s2, double s3, double s4, double &mean, double &sd, double &skew,
+                      double &kurt)
+  {
+    mean = s1 / n;
+    const double m2 = std::max(s2 / n - mean * mean, 1e-300);
+    const double m3 = s3 / n - 3. * mean * s2 / n + 2. * mean * mean * mean;
+    const double m4 = s4 / n - 4. * mean * s3 / n + 6. * mean * mean * s2 / n - 3. * mean * mean * mean * mean;
+    sd = sqrt(m2);
+    skew = m3 / (m2 * sd);
+    kurt = m4 / (m2 * m2);
+  } // Moments()
+
+  // Terms of the error function of subset s after exchanging rout for rin,
+  // without the normalization
+  void Terms(const Subset &s, std::size_t rout, std::size_t rin, double *terms) const
+  {
+    const double n = (double)s.members.size();
+    const double *zo = rout < nrep ? &z[rout * nv] : NULL, *zi = rin < nrep ? &z[rin * nv] : NULL;
+    std::fill(terms, terms + compressTerms, 0.);
+    std::vector<double> mean(pairs.empty() ? 0 : nv), sd(pairs.empty() ? 0 : nv);
+    for (std::size_t v = 0; v < nv; v++)
+    {
+      double s1 = s.s1[v], s2 = s.s2[v], s3 = s.s3[v], s4 = s.s4[v];
+      int counts[compressBins];
+      std::copy(&s.counts[v * compressBins], &s.counts[v * compressBins] + compressBins, counts);
+      if (zo)
+      {
+        const double a = zo[v], a2 = a * a;
+        s1 -= a;
+        s2 -= a2;
+        s3 -= a2 * a;
+        s4 -= a2 * a2;
+        counts[bin[rout * nv + v]]--;
+      }
+      if (zi)
+      {
+        const double a = zi[v], a2 = a * a;
+        s1 += a;
+        s2 += a2;
+        s3 += a2 * a;
+        s4 += a2 * a2;
+        counts[bin[rin * nv + v]]++;
+      }
+      double m, sdv, skew, kurt;
+      Moments(n, s1, s2, s3, s4, m, sdv, skew, kurt);
+      terms[0] += m * m;
+      terms[1] += (sdv - 1.) * (sdv - 1.);
+      terms[2] += (skew - skewPrior[v]) * (skew - skewPrior[v]);
+      terms[3] += (kurt - kurtPrior[v]) * (kurt - kurtPrior[v]);
+      for (int b = 0; b < compressBins; b++)
+      {
+        const double d = counts[b] / n - binPrior[v * compressBins + b];
+        terms[4] += d * d;
+      }
+      if (!pairs.empty())
+      {
+        mean[v] = m;
+        sd[v] = sdv;
+      }
+    } // for (std::size_t v = 0...
+    for (std::size_t p = 0; p < pairs.size(); p++)
+    {
+      const std::size_t a = pairs[p].first, b = pairs[p].second;
+      double cross = s.cross[p];
+      if (zo)
+        cross -= zo[a] * zo[b];
+      if (zi)
+        cross += zi[a] * zi[b];
+      const double rho = (cross / n - mean[a] * mean[b]) / (sd[a] * sd[b]);
+      terms[5] += (rho - corrPrior[p]) * (rho - corrPrior[p]);
+    }
+  } // Terms()
+
+  double Total(const double *terms) const
+  {
+    double total = 0.;
+    for (int t = 0; t < compressTerms; t++)
+      total += terms[t] / norm[t];
+    return total;
+  }
+
+  // nout distinct random replicas
+  std::vector<std::size_t> RandomSubset(std::size_t nout, std::mt19937_64 &rng) const
+  {
+    std::vector<std::size_t> all(nrep);
+    for (std::size_t r = 0; r < nrep; r++)
+      all[r] = r;
+    for (std::size_t k = 0; k < nout; k++)
+      std::swap(all[k], all[k + rng() % (nrep - k)]);
+    return std::vector<std::size_t>(all.begin(), all.begin() + nout);
+  } // RandomSubset()
+
+  static double Uniform(std::mt19937_64 &rng)
+  {
+    return (rng() >> 11) * (1. / 9007199254740992.);
+  }
+
+public:
+  // values[r*nvalues + i] of the replicas r = 0..nreplicas-1 at nvalues points;
+  // the correlations are compared for all pairs of the points in anchors
+  ReplicaCompressor(const std::vector<double> &values, std::size_t nreplicas, std::size_t nvalues,
+                    const std::vector<std::size_t> &anchors)
+      : nrep(nreplicas), nv(0)
+  {
+    // standardize the points that vary
+    std::vector<std::size_t> index(nvalues, nvalues), used;
+    std::vector<double> mean, sigma;
+    for (std::size_t i = 0; i < nvalues; i++)
+    {
+      double m = 0., v = 0.;
+      for (std::size_t r = 0; r < nrep; r++)
+        m += values[r * nvalues + i];
+      m /= nrep;
+      for (std::size_t r = 0; r < nrep; r++)
+        v += (values[r * nvalues + i] - m) * (values[r * nvalues + i] - m);
+      v /= nrep;
+      if (v > 1e-24 * m * m && v > 0.)
+      {
+        index[i] = used.size();
+        used.push_back(i);
+        mean.push_back(m);
+        sigma.push_back(sqrt(v));
+      }
+    } // for (std::size_t i = 0...
+    nv = used.size();
+    z.resize(nrep * nv);
+    bin.resize(nrep * nv);
+    for (std::size_t r = 0; r < nrep; r++)
+      for (std::size_t v = 0; v < nv; v++)
+      {
+        z[r * nv + v] = (values[r * nvalues + used[v]] - mean[v]) / sigma[v];
+        bin[r * nv + v] = Bin(z[r * nv + v]);
+      }
+    for (std::size_t a = 0; a < anchors.size(); a++)
+      for (std::size_t b = a + 1; b < anchors.size(); b++)
+        if (index[anchors[a]] < nvalues && index[anchors[b]] < nvalues)
+          pairs.push_back(std::make_pair(index[anchors[a]], index[anchors[b]]));
+
+    // statistics of the full ensemble
+    std::vector<std::size_t> all(nrep);
+    for (std::size_t r = 0; r < nrep; r++)
+      all[r] = r;
+    const Subset prior = MakeSubset(all);
+    skewPrior.resize(nv);
+    kurtPrior.resize(nv);
+    binPrior.resize(nv * compressBins);
+    for (std::size_t v = 0; v < nv; v++)
+    {
+      double m, sd;
+      Moments(nrep, prior.s1[v], prior.s2[v], prior.s3[v], prior.s4[v], m, sd, skewPrior[v], kurtPrior[v]);
+      for (int b = 0; b < compressBins; b++)
+        binPrior[v * compressBins + b] = prior.counts[v * compressBins + b] / (double)nrep;
+    }
+    corrPrior.resize(pairs.size());
+    for (std::size_t p = 0; p < pairs.size(); p++)
+      corrPrior[p] = prior.cross[p] / nrep; // z has mean 0 and sigma 1
+    std::fill(norm, norm + compressTerms, 1.);
+  } // ReplicaCompressor()
+
+  // number of points that vary and of the anchor pairs
+  std::size_t NumPoints() const
+  {
+    return nv;
+  }
+
+  std::size_t NumPairs() const
+  {
+    return pairs.size();
+  }
+
+  // Sets the normalization of the error terms to their average over random
+  // subsets of nout replicas, returned in terms
+  void Normalize(std::size_t nout, uint64_t seed, double *terms)
+  {
+    std::vector<double> sums(compressRandomSubsets * compressTerms);
+    mcgenPool().parallelFor(compressRandomSubsets, [&](std::size_t k) {
+      std::mt19937_64 rng(seed + 1000003 * (k + 1));
+      Terms(MakeSubset(RandomSubset(nout, rng)), nrep, nrep, &sums[k * compressTerms]);
+    });
+    for (int t = 0; t < compressTerms; t++)
+    {
+      norm[t] = 0.;
+      for (std::size_t k = 0; k < compressRandomSubsets; k++)
+        norm[t] += sums[k * compressTerms + t] / compressRandomSubsets;
+      terms[t] = norm[t];
+      if (!(norm[t] > 0.))
+        norm[t] = 1.;
+    }
+  } // Normalize()
+
+  // Error function of the replicas in members and its terms (normalized)
+  double Error(const std::vector<std::size_t> &members, double *terms) const
+  {
+    Terms(MakeSubset(members), nrep, nrep, terms);
+    const double total = Total(terms);
+    for (int t = 0; t < compressTerms; t++)
+      terms[t] /= norm[t];
+    return total;
+  }
+
+  // Subset of nout replicas with the smallest error function found by
+  // annealing with iterations exchanges per chain
+  std::vector<std::size_t> Compress(std::size_t nout, std::size_t iterations, uint64_t seed) const
+  {
+    std::vector<std::vector<std::size_t>> best(compressChains);
+    std::vector<double> besterr(compressChains);
+    mcgenPool().parallelFor(compressChains, [&](std::size_t chain) {
+      std::mt19937_64 rng(seed + chain);
+      Subset s = MakeSubset(RandomSubset(nout, rng));
+      std::vector<char> in(nrep, 0);
+      for (std::size_t k = 0; k < nout; k++)
+        in[s.members[k]] = 1;
+      double terms[compressTerms];
+      Terms(s, nrep, nrep, terms);
+      double err = Total(terms);
+      best[chain] = s.members;
+      besterr[chain] = err;
+      if (nout == nrep)
+        return;
+
+      // random exchange: a member of the subset for a replica outside
+      auto propose = [&](std::size_t &rout, std::size_t &rin) {
+        rout = s.members[rng() % nout];
+        do
+          rin = rng() % nrep;
+        while (in[rin]);
+      };
+      // initial temperature: the average change of the error by an exchange
+      double t0 = 0.;
+      const int nprobe = 20;
+      for (int k = 0; k < nprobe; k++)
+      {
+        std::size_t rout, rin;
+        propose(rout, rin);
+        Terms(s, rout, rin, terms);
+        t0 += fabs(Total(terms) - err) / nprobe;
+      }
+      const double tend = 1e-3 * t0;
+      for (std::size_t it = 0; it < iterations; it++)
+      {
+        const double temp = t0 * pow(tend / t0, (double)it / iterations);
+        std::size_t rout, rin;
+        propose(rout, rin);
+        Terms(s, rout, rin, terms);
+        const double newerr = Total(terms);
+        if (newerr < err || Uniform(rng) < exp(-(newerr - err) / temp))
+        {
+          Exchange(s, rout, rin);
+          in[rout] = 0;
+          in[rin] = 1;
+          err = newerr;
+          if (err < besterr[chain])
+          {
+            besterr[chain] = err;
+            best[chain] = s.members;
+          }
+        }
+      } // for (std::size_t it = 0...
+    });
+
+    std::size_t ibest = 0;
+    for (std::size_t chain = 1; chain < compressChains; chain++)
+      if (besterr[chain] < besterr[ibest])
+        ibest = chain;
+    std::sort(best[ibest].begin(), best[ibest].end());
+    return best[ibest];
+  } // Compress()
+}; // class ReplicaCompressor
+
+#endif // COMPRESS_H
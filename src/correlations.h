@@ -0,0 +1,153 @@
+#ifndef CORRELATIONS_H
+#define CORRELATIONS_H
+
+/*
+ * Description: Covariance and correlation matrices of PDF values across the
+ *              members of an ensemble, used by "mcgen.x correlations".
+ *
+ *              The members are turned into a matrix D with one row per
+ *              replica (or Hessian eigenvector pair) and one column per
+ *              variable (Q, x, flavor), centered and scaled so that the
+ *              covariance matrix is C = D^T D. symmetricRankK() computes the
+ *              upper triangle of C in tiles of corrTile x corrTile entries
+ *              that run on the thread pool. For every tile, panels of
+ *              corrDepth rows of the two column blocks of D are copied into
+ *              contiguous buffers, so the inner loops run over cached data.
+ *              Every entry is summed over the rows in their order, so C does
+ *              not depend on the number of threads.
+ *
+ *              Binary output (.corr file, integers are little-endian uint64
+ *              unless noted, all values double):
+ *                magic "MCGCORR1", number of variables n, number of rows of D
+ *                Q, x of every variable, flavor index of every variable
+ *                (int64, into the flavor list of the text summary)
+ *                central values, standard deviations
+ *                covariance, upper triangle by rows (C00 C01 .. C0n-1 C11 ..),
+ *                n(n+1)/2 values
+ *                correlation, upper triangle by rows, n(n+1)/2 values
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "threadpool.h"
+
+const char CorrMagic[9] = "MCGCORR1";
+// columns per tile of the covariance matrix
+const std::size_t corrTile = 64;
+// rows of D per panel
+const std::size_t corrDepth = 128;
+
+// C[i*n + j] = sum_k D[k*n + i]*D[k*n + j] for the nrows x n matrix D;
+// both triangles of C are filled
+inline void symmetricRankK(const std::vector<double> &D, std::size_t nrows, std::size_t n, std::vector<double> &C)
+{
+  C.assign(n * n, 0.);
+  const std::size_t ntiles = (n + corrTile - 1) / corrTile;
+  std::vector<std::pair<std::size_t, std::size_t>> tiles; // (I, J), J >= I
+  for (std::size_t I = 0; I < ntiles; I++)
+    for (std::size_t J = I; J < ntiles; J++)
+      tiles.push_back(std::make_pair(I, J));
+
+  mcgenPool().parallelFor(tiles.size(), [&](std::size_t it) {
+    const std::size_t i0 = tiles[it].first * corrTile, j0 = tiles[it].second * corrTile;
+    const std::size_t ni = std::min(corrTile, n - i0), nj = std::min(corrTile, n - j0);
+    std::vector<double> A(corrDepth * corrTile), B(corrDepth * corrTile), acc(corrTile * corrTile, 0.);
+
+    for (std::size_t k0 = 0; k0 < nrows; k0 += corrDepth)
+    {
+      const std::size_t nk = std::min(corrDepth, nrows - k0);
+      for (std::size_t k = 0; k < nk; k++)
+      {
+        const double *row = &D[(k0 + k) * n];
+        std::copy(row + i0, row + i0 + ni, &A[k * corrTile]);
+        std::copy(row + j0, row + j0 + nj, &B[k * corrTile]);
+      }
+      for (std::size_t i = 0; i < ni; i++)
+      {
+        double *c = &acc[i * corrTile];
+        for (std::size_t k = 0; k < nk; k++)
+        {
+          const double a = A[k * corrTile + i];
+          const double *b = &B[k * corrTile];
+          for (std::size_t j = 0; j < nj; j++)
+            c[j] += a * b[j];
+        }
+      }
+    } // for (std::size_t k0 = 0...
+
+    for (std::size_t i = 0; i < ni; i++)
+      for (std::size_t j = 0; j < nj; j++)
+      {
+        C[(i0 + i) * n + j0 + j] = acc[i * corrTile + j];
+        C[(j0 + j) * n + i0 + i] = acc[i * corrTile + j];
+      }
+  });
+} // symmetricRankK()
+
+// correlation of the variables i and j from the n x n covariance matrix cov
+// and the standard deviations sigma, 0 if one of them does not vary
+inline double correlation(const std::vector<double> &cov, const std::vector<double> &sigma, std::size_t i,
+                          std::size_t j)
+{
+  const std::size_t n = sigma.size();
+  return (sigma[i] > 0. && sigma[j] > 0.) ? cov[i * n + j] / (sigma[i] * sigma[j]) : 0.;
+} // correlation()
+
+inline void WriteCorrelations(const std::string &filename, std::size_t nrows, const std::vector<double> &q,
+                              const std::vector<double> &x, const std::vector<int> &flavor,
+                              const std::vector<double> &central, const std::vector<double> &sigma,
+                              const std::vector<double> &cov)
+// Writes the binary .corr file described above. The correlation matrix is
+// computed row by row from cov and sigma while it is written.
+{
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == NULL)
+  {
+    std::cout << "Unable to open file: " << filename << std::endl;
+    exit(1);
+  }
+  bool ok = true;
+  auto put = [&](const void *data, std::size_t size) {
+    ok = ok && (size == 0 || fwrite(data, 1, size, file) == size);
+  };
+  const std::size_t n = q.size();
+  const uint64_t header[2] = {n, nrows};
+  put(CorrMagic, 8);
+  put(header, sizeof(header));
+  put(q.data(), 8 * n);
+  put(x.data(), 8 * n);
+  for (std::size_t i = 0; i < n; i++)
+  {
+    const int64_t ifl = flavor[i];
+    put(&ifl, 8);
+  }
+  put(central.data(), 8 * n);
+  put(sigma.data(), 8 * n);
+  for (std::size_t i = 0; i < n; i++)
+    put(&cov[i * n + i], 8 * (n - i));
+  std::vector<double> row(n);
+  for (std::size_t i = 0; i < n; i++)
+  {
+    for (std::size_t j = i; j < n; j++)
+      row[j] = correlation(cov, sigma, i, j);
+    put(&row[i], 8 * (n - i));
+  }
+  if (fclose(file) != 0 || !ok)
+  {
+    std::cout << "Error: could not write " << filename << std::endl;
+    exit(1);
+  }
+} // WriteCorrelations()
+
+#endif // CORRELATIONS_H
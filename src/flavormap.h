@@ -0,0 +1,304 @@
+#ifndef FLAVORMAP_H
+#define FLAVORMAP_H
+
+/*
+ * Description: Sparse linear maps from the parton PDFs at one (x, Q) point to
+ *              the flavors of an output representation, used by
+ *              "mcgen.x convert" and "mcgen.x std_devs". The input vector holds the 13 PDFs returned
+ *              by LHAPDF's all-flavor call xfxQ(x, Q, vector), PDG IDs -6..6
+ *              with the gluon at 0, followed by any other partons of the set
+ *              (e.g. the photon), so each point needs one interpolation call
+ *              for all output flavors.
+ *
+ *              Output flavor i is
+ *                out[i] = scale[i] * sum_k coef[k]*in[col[k]],
+ *              with the terms of row i summed in the order they were added.
+ *              ApplyBlock() transforms a block of (x, Q) points at once:
+ *              the inputs are transposed into parton-major order and every
+ *              term becomes a vectorizable loop over the points.
+ *
+ *              Besides the built-in physical and SU(Nf) representations, a
+ *              basis can be read from a text file (ReadFlavorMap):
+ *                # comments
+ *                Partons:  -5 -4 -3 -2 -1 21  1  2  3  4  5
+ *                g          1  0  0  0  0  0  1  0  0  0  0  0
+ *                Sigma     0.2 1  1  1  1  1  0  1  1  1  1  1
+ *                ...
+ *              "Partons:" lists the PDG IDs of the input partons. Every
+ *              other line defines one output flavor: its label, an overall
+ *              factor, and one coefficient per parton. Examples are in
+ *              inc/basis-*.dat.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// number of PDFs returned by LHAPDF's all-flavor call xfxQ(x, Q, vector)
+const int flavorMapNumPartons = 13;
+// number of (x, Q) points transformed together by ApplyBlock()
+const std::size_t flavorMapBlock = 64;
+
+class FlavorMap
+{
+private:
+  std::vector<int> extraPIDs; // partons outside the all-flavor call
+  std::vector<std::size_t> rowStart = std::vector<std::size_t>(1, 0);
+  std::vector<int> col;
+  std::vector<double> coef;
+  std::vector<double> scale;
+  std::vector<std::string> labels;
+
+public:
+  // Position of parton pid in the input vector. Partons other than the
+  // quarks and the gluon (0 or 21) are added to the extra inputs.
+  int Slot(int pid)
+  {
+    if (pid == 21)
+      pid = 0;
+    if (pid >= -6 && pid <= 6)
+      return pid + 6;
+    for (std::size_t i = 0; i < extraPIDs.size(); i++)
+      if (extraPIDs[i] == pid)
+        return flavorMapNumPartons + i;
+    extraPIDs.push_back(pid);
+    return flavorMapNumPartons + extraPIDs.size() - 1;
+  } // Slot()
+
+  // Appends the output flavor w * sum_k c_k f(pid_k), terms = {(pid_k, c_k)}
+  void AddRow(double w, const std::vector<std::pair<int, double>> &terms, const std::string &label = "")
+  {
+    labels.push_back(label);
+    for (std::size_t k = 0; k < terms.size(); k++)
+    {
+      col.push_back(Slot(terms[k].first));
+      coef.push_back(terms[k].second);
+    }
+    rowStart.push_back(col.size());
+    scale.push_back(w);
+  } // AddRow()
+
+  std::size_t NumOutputs() const
+  {
+    return scale.size();
+  }
+
+  std::size_t NumInputs() const
+  {
+    return flavorMapNumPartons + extraPIDs.size();
+  }
+
+  // labels of the output flavors, empty for the built-in representations
+  const std::vector<std::string> &Labels() const
+  {
+    return labels;
+  }
+
+  // PDG IDs of the inputs after the first flavorMapNumPartons
+  const std::vector<int> &ExtraPIDs() const
+  {
+    return extraPIDs;
+  }
+
+  // PDG IDs of all inputs, -6..6 (21 for the gluon) and the extra partons
+  std::vector<int> InputPIDs() const
+  {
+    std::vector<int> pids;
+    for (int pid = -6; pid <= 6; pid++)
+      pids.push_back(pid == 0 ? 21 : pid);
+    pids.insert(pids.end(), extraPIDs.begin(), extraPIDs.end());
+    return pids;
+  }
+
+  // out[i], i = 0..NumOutputs()-1, from in[0..NumInputs()-1]
+  void Apply(const double *in, double *out) const
+  {
+    for (std::size_t i = 0; i < scale.size(); i++)
+    {
+      double acc = 0.;
+      for (std::size_t k = rowStart[i]; k < rowStart[i + 1]; k++)
+        acc += coef[k] * in[col[k]];
+      out[i] = scale[i] * acc;
+    }
+  } // Apply()
+
+  // Transforms ncells points at once. The inputs of point c are
+  // in[c*NumInputs() + j], output flavor i of point c is written into
+  // out[i*ncells + c]. Each point gets the same result as from Apply().
+  void ApplyBlock(const double *in, std::size_t ncells, double *out) const
+  {
+    const std::size_t nin = NumInputs();
+    std::vector<double> inT(nin * flavorMapBlock);
+    double acc[flavorMapBlock];
+
+    for (std::size_t c0 = 0; c0 < ncells; c0 += flavorMapBlock)
+    {
+      const std::size_t m = std::min(flavorMapBlock, ncells - c0);
+      for (std::size_t c = 0; c < m; c++)
+        for (std::size_t j = 0; j < nin; j++)
+          inT[j * m + c] = in[(c0 + c) * nin + j];
+
+      for (std::size_t i = 0; i < scale.size(); i++)
+      {
+        for (std::size_t c = 0; c < m; c++)
+          acc[c] = 0.;
+        for (std::size_t k = rowStart[i]; k < rowStart[i + 1]; k++)
+        {
+          const double w = coef[k];
+          const double *src = &inT[col[k] * m];
+          for (std::size_t c = 0; c < m; c++)
+            acc[c] += w * src[c];
+        }
+        double *dst = out + i * ncells + c0;
+        for (std::size_t c = 0; c < m; c++)
+          dst[c] = scale[i] * acc[c];
+      } // for (std::size_t i = 0...
+    } // for (std::size_t c0 = 0...
+  } // ApplyBlock()
+}; // class FlavorMap
+
+inline FlavorMap ReadFlavorMap(const std::string &filename)
+// Reads a flavor basis from a text file in the format described above
+{
+  std::ifstream file(filename.c_str());
+  if (!file.is_open())
+  {
+    std::cout << "Unable to open file: " << filename << std::endl;
+    exit(1);
+  }
+
+  FlavorMap map;
+  std::vector<int> partons;
+  std::string line;
+  int iline = 0;
+  while (getline(file, line))
+  {
+    iline++;
+    if (line.find('#') != std::string::npos)
+      line.erase(line.find('#'));
+    std::istringstream iss(line);
+    std::string label;
+    if (!(iss >> label))
+      continue;
+
+    if (label == "Partons:")
+    {
+      int pid;
+      while (iss >> pid)
+        partons.push_back(pid);
+      continue;
+    }
+
+    double w, c;
+    std::vector<std::pair<int, double>> terms;
+    std::size_t ncoef = 0;
+    if (!(iss >> w))
+      ncoef = partons.size() + 1; // reported as an error below
+    while (iss >> c)
+    {
+      if (ncoef < partons.size() && c != 0.)
+        terms.push_back(std::make_pair(partons[ncoef], c));
+      ncoef++;
+    }
+    if (partons.empty() || ncoef != partons.size() || !iss.eof())
+    {
+      std::cout << "Error in " << filename << ", line " << iline << ": expected a label, a factor, and "
+                << partons.size() << " coefficients after a Partons: line." << std::endl;
+      exit(1);
+    }
+    map.AddRow(w, terms, label);
+  } // while (getline(file, line))
+
+  if (map.NumOutputs() == 0)
+  {
+    std::cout << "Error: no flavors defined in " << filename << std::endl;
+    exit(1);
+  }
+  return map;
+} // ReadFlavorMap()
+
+inline FlavorMap PhysicalFlavorMap(const std::vector<int> &flavors)
+// Physical representation: the PDFs of the given partons, in their order
+{
+  FlavorMap map;
+  for (std::size_t i = 0; i < flavors.size(); i++)
+    map.AddRow(1., std::vector<std::pair<int, double>>(1, std::make_pair(flavors[i], 1.)));
+  return map;
+} // PhysicalFlavorMap()
+
+inline FlavorMap SUNfFlavorMap(int pdg_id)
+// SU(Nf) representation of the hadron pdg_id:
+//   g
+//   Sigma singlet  (Sum(q_i+q_i^c))/5
+//   5 "-" non-singlets (q_{i,-}=q_i-q_i^c)
+//   T3^c = (q_2^c - q_1^c)
+//   T8^c = 2*q_{3}^c - q_{1}^c - q_{2}^c
+//   T15^c = 3*q_4^c - q_1^c - q_2^c - q_3^c
+//   T24^c = 4*q_5^c - q_1^c - q_2^c - q_3^c - q_4^c
+// where c represents the charge-conjugate of the corresponding particle.
+// q1, q2, q3, q4, q5 are defined based off the particle:
+//
+//   q_i    proton    pi^+    K^+
+//
+//   q_1         u       u      u
+//   q_2         d    dbar   sbar
+//   q_3         s       s      d
+//   q_4         c       c      c
+//   q_5         b       b      b
+//
+// LHAPDF uses the PDG Monte Carlo numbering scheme (d=1, u=2, s=3, c=4, b=5)
+{
+  const int Nqi = 5; // number of qis
+  std::vector<int> qvec; // corresponding PDG ID for qi
+  switch (pdg_id) // assign PDG ID to qi dependent on LHA particle ID
+  {
+  case 2212: // proton
+    qvec = {2, 1, 3, 4, 5};
+    break;
+  case 211: // pi+
+    qvec = {2, -1, 3, 4, 5};
+    break;
+  case 321: // K+
+    qvec = {2, -3, 1, 4, 5};
+    break;
+  default:
+    std::cout << "PDG ID = " << pdg_id << " PDF set not supported." << std::endl;
+    exit(1);
+  } // add more particles here
+
+  typedef std::vector<std::pair<int, double>> Terms;
+  FlavorMap map;
+
+  map.AddRow(1., Terms(1, std::make_pair(21, 1.))); // g
+
+  Terms sigma; // Sigma
+  for (int i = 0; i < Nqi; i++)
+  {
+    sigma.push_back(std::make_pair(qvec[i], 1.));
+    sigma.push_back(std::make_pair(-qvec[i], 1.));
+  }
+  map.AddRow(1. / Nqi, sigma);
+
+  for (int i = 0; i < Nqi; i++) // q_{i,-}
+    map.AddRow(1., {std::make_pair(qvec[i], 1.), std::make_pair(-qvec[i], -1.)});
+
+  for (int n = 1; n < Nqi; n++) // T3c, T8c, T15c, T24c
+  {
+    Terms t(1, std::make_pair(-qvec[n], (double)n));
+    for (int i = 0; i < n; i++)
+      t.push_back(std::make_pair(-qvec[i], -1.));
+    map.AddRow(1., t);
+  }
+  return map;
+} // SUNfFlavorMap()
+
+#endif // FLAVORMAP_H
@@ -0,0 +1,212 @@
+#ifndef GRIDCACHE_H
+#define GRIDCACHE_H
+
+/*
+ * Description: Least-recently-used cache of parsed inputs (LHAGrid member
+ *              grids, LHAPDF members), kept by "mcgen.x serve" between jobs
+ *              and by "mcgen.x pipeline" between its steps.
+ *
+ *              Entries are keyed by the absolute path of the file they were
+ *              parsed from and stamped with its modification time and size,
+ *              so a file that changed on disk is parsed again. Every entry has a
+ *              cost in bytes; the least recently used entries are dropped
+ *              when the total exceeds the budget. The budget is 0 outside of
+ *              "serve" and "pipeline", and then nothing is kept: Find()
+ *              misses and Insert() drops the entry.
+ *
+ *              The server runs each job in a child process (fork), which
+ *              inherits the cache of the server. Paths that missed in the
+ *              child are recorded (RecordMisses()), and the server parses
+ *              them into its own cache after the job, so the next job on the
+ *              same inputs finds them.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct CacheStamp
+{
+  int64_t mtime = -1; // nanoseconds, -1 if the file does not exist
+  int64_t size = -1;
+
+  bool operator==(const CacheStamp &other) const
+  {
+    return mtime == other.mtime && size == other.size;
+  }
+};
+
+// Stamp of a file on disk. A packed member "file.lhapack:k" is stamped with
+// the container file.
+inline CacheStamp cacheStampOf(const std::string &path)
+{
+  std::string file = path;
+  const std::size_t colon = path.rfind(':');
+  if (colon != std::string::npos && colon >= 8 && path.compare(colon - 8, 8, ".lhapack") == 0)
+    file = path.substr(0, colon);
+  CacheStamp stamp;
+  struct stat st;
+  if (stat(file.c_str(), &st) == 0)
+  {
+    stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    stamp.size = st.st_size;
+  }
+  return stamp;
+} // cacheStampOf()
+
+// Absolute path of a file, for keys that do not depend on the working directory
+inline std::string cacheKey(const std::string &path)
+{
+  if (path.empty() || path[0] == '/')
+    return path;
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    return path;
+  return std::string(cwd) + "/" + path;
+} // cacheKey()
+
+template <class T>
+class LRUCache
+{
+private:
+  struct Entry
+  {
+    std::string key;
+    CacheStamp stamp;
+    std::shared_ptr<T> value;
+    std::size_t cost;
+  };
+  std::list<Entry> entries; // most recently used first
+  std::map<std::string, typename std::list<Entry>::iterator> index;
+  std::size_t budget = 0, total = 0;
+  std::size_t hits = 0, misses = 0;
+  bool recording = false;
+  std::vector<std::string> missed;
+  std::mutex mutex;
+
+  void Evict()
+  {
+    while (total > budget && !entries.empty())
+    {
+      total -= entries.back().cost;
+      index.erase(entries.back().key);
+      entries.pop_back();
+    }
+  }
+
+public:
+  void SetBudget(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    Evict();
+  }
+
+  bool Enabled()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget > 0;
+  }
+
+  // The cached value of the file path if the file still has the stamp it was
+  // parsed with, otherwise NULL. Misses are recorded if RecordMisses() was called.
+  std::shared_ptr<T> Find(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (budget == 0)
+      return std::shared_ptr<T>();
+    const std::string key = cacheKey(path);
+    typename std::map<std::string, typename std::list<Entry>::iterator>::iterator it = index.find(key);
+    if (it != index.end() && it->second->stamp == cacheStampOf(key))
+    {
+      entries.splice(entries.begin(), entries, it->second);
+      hits++;
+      return entries.front().value;
+    }
+    if (it != index.end())
+    { // stale
+      total -= it->second->cost;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    misses++;
+    if (recording)
+      missed.push_back(key);
+    return std::shared_ptr<T>();
+  } // Find()
+
+  void Insert(const std::string &path, const CacheStamp &stamp, std::shared_ptr<T> value, std::size_t cost)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (budget == 0 || cost > budget || stamp.mtime < 0)
+      return;
+    const std::string key = cacheKey(path);
+    typename std::map<std::string, typename std::list<Entry>::iterator>::iterator it = index.find(key);
+    if (it != index.end())
+    {
+      total -= it->second->cost;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    Entry entry;
+    entry.key = key;
+    entry.stamp = stamp;
+    entry.value = value;
+    entry.cost = cost;
+    entries.push_front(entry);
+    index[key] = entries.begin();
+    total += cost;
+    Evict();
+  } // Insert()
+
+  void RecordMisses()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    recording = true;
+    missed.clear();
+  }
+
+  std::vector<std::string> Misses()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return missed;
+  }
+
+  std::size_t Size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+  std::size_t Bytes()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return total;
+  }
+
+  std::size_t Hits()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+  }
+
+  std::size_t NumMisses()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+  }
+}; // class LRUCache
+
+#endif // GRIDCACHE_H
@@ -0,0 +1,810 @@
+#ifndef GRIDIO_H
+#define GRIDIO_H
+
+/*
+ * Description: Streams for reading and writing LHAPDF grid files that may be
+ *              compressed. The compression is chosen by the file extension:
+ *                name.dat      plain text
+ *                name.dat.gz   gzip (zlib)
+ *                name.dat.zst  zstandard, if mcgen.x is compiled with
+ *                              -DMCGEN_ZSTD (make ZSTD=yes)
+ *              igridstream and ogridstream are used in place of std::ifstream
+ *              and std::ofstream. An ogridstream to a compressed file collects
+ *              the formatted text in large buffers and passes every full
+ *              buffer to its own writer thread, which compresses and writes it
+ *              while the next buffer is being filled.
+ *
+ *              GridFileWriter writes whole files that were formatted in memory
+ *              on its own thread, in the order in which they are queued, with a
+ *              bounded queue; "mcgen.x generate" formats the replicas on the
+ *              thread pool while earlier ones are written. The writer thread
+ *              takes all files waiting in the queue at once and writes the
+ *              plain ones with gridWriteFiles().
+ *
+ *              gridWriteFiles() and gridReadFiles() write and read many whole
+ *              plain files in one batch. With -DMCGEN_IO_URING
+ *              (make IO_URING=yes) a batch is submitted to io_uring
+ *              (gridring.h) with many opens, reads, writes and closes in
+ *              flight; otherwise, or if io_uring is not available at run
+ *              time, the files are handled one after the other. GridReadAhead
+ *              reads the member files of a loop in such batches ahead of the
+ *              loop, and igridstream::open() takes a file that was read ahead
+ *              from memory.
+ *
+ *              gridFileExtension() returns the extension of the replica files
+ *              written by "mcgen.x generate", selected by the environment
+ *              variable MCGEN_COMPRESS=gz or zst (default: plain .dat).
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+#ifdef MCGEN_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MCGEN_IO_URING
+#include "gridring.h"
+#endif
+
+enum GridCompression
+{
+  compressNone,
+  compressGzip,
+  compressZstd
+};
+
+inline bool gridEndsWith(const std::string &name, const std::string &suffix)
+{
+  return name.size() >= suffix.size() &&
+         name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline GridCompression gridCompression(const std::string &filename)
+// Compression of a grid file, from its extension
+{
+  if (gridEndsWith(filename, ".gz"))
+    return compressGzip;
+  if (gridEndsWith(filename, ".zst"))
+  {
+#ifndef MCGEN_ZSTD
+    std::cout << "Error: " << filename << " is compressed with zstd, but mcgen.x was compiled without it." << std::endl;
+    std::cout << "Recompile with: make mcgen.x ZSTD=yes" << std::endl;
+    exit(1);
+#endif
+    return compressZstd;
+  }
+  return compressNone;
+} // gridCompression()
+
+inline std::string gridFileExtension()
+// Extension of the LHAPDF grid files written by "mcgen.x generate"
+{
+  const char *env = getenv("MCGEN_COMPRESS");
+  std::string method = (env != NULL) ? env : "";
+  if (method == "" || method == "none")
+    return ".dat";
+  if (method == "gz" || method == "gzip")
+    return ".dat.gz";
+  if (method == "zst" || method == "zstd")
+  {
+    gridCompression(".zst"); // stops if zstd is not compiled in
+    return ".dat.zst";
+  }
+  std::cout << "Error: MCGEN_COMPRESS = " << method << " is not supported. Use gz or zst." << std::endl;
+  exit(1);
+} // gridFileExtension()
+
+//========================================================================
+// Reading
+
+const std::size_t gridBufferSize = 1 << 18;
+
+class GzInputBuf : public std::streambuf
+// Decompresses a gzip file
+{
+private:
+  gzFile file;
+  std::vector<char> buffer;
+
+protected:
+  int_type underflow()
+  {
+    if (gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    int n = gzread(file, buffer.data(), buffer.size());
+    if (n <= 0)
+      return traits_type::eof();
+    setg(buffer.data(), buffer.data(), buffer.data() + n);
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  GzInputBuf(gzFile f) : file(f), buffer(gridBufferSize)
+  {
+    gzbuffer(file, gridBufferSize);
+    setg(buffer.data(), buffer.data(), buffer.data());
+  }
+
+  ~GzInputBuf()
+  {
+    gzclose(file);
+  }
+}; // class GzInputBuf
+
+#ifdef MCGEN_ZSTD
+class ZstdInputBuf : public std::streambuf
+// Decompresses a zstandard file
+{
+private:
+  FILE *file;
+  ZSTD_DCtx *dctx;
+  std::vector<char> inbuffer, buffer;
+  ZSTD_inBuffer in;
+
+protected:
+  int_type underflow()
+  {
+    if (gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    ZSTD_outBuffer out = {buffer.data(), buffer.size(), 0};
+    while (out.pos == 0)
+    {
+      if (in.pos == in.size)
+      {
+        in.size = fread(inbuffer.data(), 1, inbuffer.size(), file);
+        in.pos = 0;
+        if (in.size == 0)
+          return traits_type::eof();
+      }
+      std::size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(ret))
+      {
+        std::cout << "Error: zstd decompression failed: " << ZSTD_getErrorName(ret) << std::endl;
+        exit(1);
+      }
+    }
+    setg(buffer.data(), buffer.data(), buffer.data() + out.pos);
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  ZstdInputBuf(FILE *f) : file(f), dctx(ZSTD_createDCtx()),
+                          inbuffer(ZSTD_DStreamInSize()), buffer(ZSTD_DStreamOutSize())
+  {
+    in.src = inbuffer.data();
+    in.size = 0;
+    in.pos = 0;
+    setg(buffer.data(), buffer.data(), buffer.data());
+  }
+
+  ~ZstdInputBuf()
+  {
+    ZSTD_freeDCtx(dctx);
+    fclose(file);
+  }
+}; // class ZstdInputBuf
+#endif // MCGEN_ZSTD
+
+class StringInputBuf : public std::streambuf
+// Input buffer over the contents of a file that was read ahead
+{
+private:
+  std::string text;
+
+public:
+  explicit StringInputBuf(std::string &&contents) : text(std::move(contents))
+  {
+    char *p = &text[0];
+    setg(p, p, p + text.size());
+  }
+}; // class StringInputBuf
+
+// Reads the whole plain files names[i] into contents[i]; ok[i] is false if
+// the file could not be read
+inline void gridReadFiles(const std::vector<std::string> &names, std::vector<std::string> &contents,
+                          std::vector<bool> &ok)
+{
+#ifdef MCGEN_IO_URING
+  if (gridRingReadFiles(names, contents, ok))
+    return;
+#endif
+  contents.assign(names.size(), std::string());
+  ok.assign(names.size(), false);
+  for (std::size_t i = 0; i < names.size(); i++)
+  {
+    std::ifstream in(names[i].c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+      continue;
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if (size < 0)
+      continue;
+    contents[i].resize(size);
+    in.read(&contents[i][0], size);
+    ok[i] = (bool)in;
+  }
+} // gridReadFiles()
+
+class GridReadAheadStore
+// Contents of the plain files read by GridReadAhead, until igridstream takes them
+{
+private:
+  std::map<std::string, std::string> files;
+  std::mutex mutex;
+
+public:
+  void Put(const std::string &name, std::string &&text)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    files[name] = std::move(text);
+  }
+
+  bool Take(const std::string &name, std::string &text)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (files.empty())
+      return false;
+    std::map<std::string, std::string>::iterator it = files.find(name);
+    if (it == files.end())
+      return false;
+    text = std::move(it->second);
+    files.erase(it);
+    return true;
+  }
+
+  void Drop(const std::string &name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.erase(name);
+  }
+}; // class GridReadAheadStore
+
+inline GridReadAheadStore &gridReadAheadStore()
+{
+  static GridReadAheadStore store;
+  return store;
+}
+
+class GridReadAhead
+// Reads the files of a loop in batches of batchsize ahead of the loop, if
+// enabled (callers pass false when the grids come from LHAGridCache()). Need(k)
+// is called before file k is opened (from any thread) and reads the next batch
+// once the loop is half way into the last one read. Only plain files are read
+// ahead, and only with io_uring: without it the batch would only copy the
+// files that igridstream reads as fast. Files that were read ahead but not
+// opened are dropped by the destructor.
+{
+private:
+  std::vector<std::string> names;
+  std::size_t batchsize, next = 0;
+  std::mutex mutex;
+
+public:
+  GridReadAhead([[maybe_unused]] const std::vector<std::string> &files, [[maybe_unused]] bool enabled,
+                std::size_t batchsize = 32)
+      : batchsize(batchsize > 0 ? batchsize : 1)
+  {
+#ifdef MCGEN_IO_URING
+    if (enabled)
+      names = files;
+#endif
+  }
+
+  void Need(std::size_t k)
+  {
+    std::vector<std::string> batch;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (next >= names.size() || k + batchsize / 2 < next)
+        return;
+      const std::size_t end = std::min(names.size(), std::max(next, k) + batchsize);
+      for (std::size_t i = next; i < end; i++)
+        if (gridCompression(names[i]) == compressNone)
+          batch.push_back(names[i]);
+      next = end;
+    }
+    std::vector<std::string> contents;
+    std::vector<bool> ok;
+    gridReadFiles(batch, contents, ok);
+    for (std::size_t i = 0; i < batch.size(); i++)
+      if (ok[i])
+        gridReadAheadStore().Put(batch[i], std::move(contents[i]));
+  } // Need()
+
+  ~GridReadAhead()
+  {
+    for (std::size_t i = 0; i < next; i++)
+      gridReadAheadStore().Drop(names[i]);
+  }
+}; // class GridReadAhead
+
+class igridstream : public std::istream
+// Input stream for a plain or compressed grid file
+{
+private:
+  std::unique_ptr<std::streambuf> buf;
+
+public:
+  igridstream() : std::istream(NULL) {}
+
+  explicit igridstream(const std::string &filename) : std::istream(NULL)
+  {
+    open(filename);
+  }
+
+  void open(const std::string &filename)
+  {
+    close();
+    clear();
+    GridCompression method = gridCompression(filename);
+    if (method == compressGzip)
+    {
+      gzFile f = gzopen(filename.c_str(), "rb");
+      if (f != NULL)
+        buf.reset(new GzInputBuf(f));
+    }
+#ifdef MCGEN_ZSTD
+    else if (method == compressZstd)
+    {
+      FILE *f = fopen(filename.c_str(), "rb");
+      if (f != NULL)
+        buf.reset(new ZstdInputBuf(f));
+    }
+#endif
+    else
+    {
+      std::string text;
+      if (gridReadAheadStore().Take(filename, text))
+        buf.reset(new StringInputBuf(std::move(text)));
+      else
+      {
+        std::filebuf *fb = new std::filebuf;
+        if (fb->open(filename.c_str(), std::ios::in))
+          buf.reset(fb);
+        else
+          delete fb;
+      }
+    }
+    rdbuf(buf.get());
+    if (!buf)
+      setstate(std::ios::failbit);
+  } // open()
+
+  bool is_open() const
+  {
+    return buf != NULL;
+  }
+
+  void close()
+  {
+    rdbuf(NULL);
+    buf.reset();
+  }
+}; // class igridstream
+
+//========================================================================
+// Writing
+
+class GridCodec
+// Compresses a sequence of byte blocks into a file
+{
+public:
+  virtual ~GridCodec() {}
+  virtual bool Write(const char *data, std::size_t n) = 0;
+  virtual bool Finish() = 0;
+}; // class GridCodec
+
+class GzCodec : public GridCodec
+{
+private:
+  gzFile file;
+
+public:
+  GzCodec(gzFile f) : file(f)
+  {
+    gzbuffer(file, gridBufferSize);
+  }
+
+  bool Write(const char *data, std::size_t n)
+  {
+    return n == 0 || gzwrite(file, data, n) == (int)n;
+  }
+
+  bool Finish()
+  {
+    return gzclose(file) == Z_OK;
+  }
+}; // class GzCodec
+
+#ifdef MCGEN_ZSTD
+class ZstdCodec : public GridCodec
+{
+private:
+  FILE *file;
+  ZSTD_CCtx *cctx;
+  std::vector<char> outbuffer;
+
+  bool Compress(const char *data, std::size_t n, ZSTD_EndDirective mode)
+  {
+    ZSTD_inBuffer in = {data, n, 0};
+    bool done = false;
+    while (!done)
+    {
+      ZSTD_outBuffer out = {outbuffer.data(), outbuffer.size(), 0};
+      std::size_t remaining = ZSTD_compressStream2(cctx, &out, &in, mode);
+      if (ZSTD_isError(remaining))
+        return false;
+      if (fwrite(outbuffer.data(), 1, out.pos, file) != out.pos)
+        return false;
+      done = (mode == ZSTD_e_end) ? (remaining == 0) : (in.pos == in.size);
+    }
+    return true;
+  }
+
+public:
+  ZstdCodec(FILE *f) : file(f), cctx(ZSTD_createCCtx()), outbuffer(ZSTD_CStreamOutSize())
+  {
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 3);
+  }
+
+  bool Write(const char *data, std::size_t n)
+  {
+    return Compress(data, n, ZSTD_e_continue);
+  }
+
+  bool Finish()
+  {
+    bool ok = Compress(NULL, 0, ZSTD_e_end);
+    ZSTD_freeCCtx(cctx);
+    return (fclose(file) == 0) && ok;
+  }
+}; // class ZstdCodec
+#endif // MCGEN_ZSTD
+
+class CompressedOutputBuf : public std::streambuf
+// Collects output in a buffer. Full buffers are compressed and written by a
+// writer thread, while the caller fills the next buffer.
+{
+private:
+  std::unique_ptr<GridCodec> codec;
+  std::vector<char> filling, pending;
+  std::thread writer;
+  std::mutex writerMutex;
+  std::condition_variable writerCondition;
+  bool hasPending = false, finishing = false, ok = true;
+
+  void WriterLoop()
+  {
+    std::unique_lock<std::mutex> lock(writerMutex);
+    while (true)
+    {
+      writerCondition.wait(lock, [this] { return hasPending || finishing; });
+      if (hasPending)
+      {
+        lock.unlock();
+        bool written = codec->Write(pending.data(), pending.size());
+        lock.lock();
+        ok = ok && written;
+        hasPending = false;
+        writerCondition.notify_all();
+      }
+      else // finishing, nothing left to write
+      {
+        ok = codec->Finish() && ok;
+        return;
+      }
+    }
+  } // WriterLoop()
+
+  void HandOff()
+  // pass the filled part of the buffer to the writer thread
+  {
+    std::size_t n = pptr() - pbase();
+    std::unique_lock<std::mutex> lock(writerMutex);
+    writerCondition.wait(lock, [this] { return !hasPending; });
+    filling.resize(n);
+    filling.swap(pending);
+    hasPending = true;
+    writerCondition.notify_all();
+    lock.unlock();
+    filling.resize(gridBufferSize);
+    setp(filling.data(), filling.data() + filling.size());
+  } // HandOff()
+
+protected:
+  int_type overflow(int_type c)
+  {
+    HandOff();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  // std::endl does not force a write; the data are written in full buffers
+  int sync()
+  {
+    return 0;
+  }
+
+public:
+  CompressedOutputBuf(GridCodec *c) : codec(c), filling(gridBufferSize)
+  {
+    setp(filling.data(), filling.data() + filling.size());
+    writer = std::thread([this] { WriterLoop(); });
+  }
+
+  // Writes the remaining data and waits for the writer thread.
+  // Returns false if anything could not be written.
+  bool Close()
+  {
+    if (!writer.joinable())
+      return ok;
+    HandOff();
+    {
+      std::lock_guard<std::mutex> lock(writerMutex);
+      finishing = true;
+    }
+    writerCondition.notify_all();
+    writer.join();
+    return ok;
+  }
+
+  ~CompressedOutputBuf()
+  {
+    Close();
+  }
+}; // class CompressedOutputBuf
+
+class ogridstream : public std::ostream
+// Output stream for a plain or compressed grid file
+{
+private:
+  std::unique_ptr<std::streambuf> buf;
+  std::string name;
+
+public:
+  ogridstream() : std::ostream(NULL) {}
+
+  explicit ogridstream(const std::string &filename) : std::ostream(NULL)
+  {
+    open(filename);
+  }
+
+  void open(const std::string &filename)
+  {
+    close();
+    clear();
+    name = filename;
+    GridCompression method = gridCompression(filename);
+    if (method == compressGzip)
+    {
+      gzFile f = gzopen(filename.c_str(), "wb6");
+      if (f != NULL)
+        buf.reset(new CompressedOutputBuf(new GzCodec(f)));
+    }
+#ifdef MCGEN_ZSTD
+    else if (method == compressZstd)
+    {
+      FILE *f = fopen(filename.c_str(), "wb");
+      if (f != NULL)
+        buf.reset(new CompressedOutputBuf(new ZstdCodec(f)));
+    }
+#endif
+    else
+    {
+      std::filebuf *fb = new std::filebuf;
+      if (fb->open(filename.c_str(), std::ios::out | std::ios::trunc))
+        buf.reset(fb);
+      else
+        delete fb;
+    }
+    rdbuf(buf.get());
+    if (!buf)
+      setstate(std::ios::failbit);
+  } // open()
+
+  bool is_open() const
+  {
+    return buf != NULL;
+  }
+
+  // Flushes and closes the file; exits if any write, the flush, or the close
+  // failed (e.g. a full disk), so that a truncated file is never kept silently
+  void close()
+  {
+    if (!buf)
+      return;
+    flush();
+    bool ok = !fail();
+    CompressedOutputBuf *cbuf = dynamic_cast<CompressedOutputBuf *>(buf.get());
+    std::filebuf *fb = dynamic_cast<std::filebuf *>(buf.get());
+    if (cbuf != NULL)
+      ok = cbuf->Close() && ok;
+    else if (fb != NULL)
+      ok = fb->close() != NULL && ok;
+    rdbuf(NULL);
+    buf.reset();
+    if (!ok)
+    {
+      std::cout << "Error: could not write " << name << std::endl;
+      exit(1);
+    }
+  } // close()
+
+  ~ogridstream()
+  {
+    close();
+  }
+}; // class ogridstream
+
+// Writes the plain files names[i] with the contents *texts[i]
+inline void gridWriteFiles(const std::vector<std::string> &names, const std::vector<const std::string *> &texts)
+{
+#ifdef MCGEN_IO_URING
+  std::size_t failed;
+  int errnum;
+  if (gridRingWriteFiles(names, texts, failed, errnum))
+  {
+    if (failed < names.size())
+    {
+      std::cout << "Error: could not write " << names[failed] << ": " << strerror(errnum) << std::endl;
+      exit(1);
+    }
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i < names.size(); i++)
+  {
+    ogridstream out(names[i]);
+    out.write(texts[i]->data(), texts[i]->size());
+    out.flush();
+    if (!out)
+    {
+      std::cout << "Error: could not write " << names[i] << std::endl;
+      exit(1);
+    }
+  }
+} // gridWriteFiles()
+
+class GridFileWriter
+// Writes files formatted in memory on a writer thread, in the order of Write();
+// the files waiting when the thread is free are written as one batch.
+// At most maxqueued files wait; Write() blocks while the queue is full, so the
+// threads that format the files run at most that far ahead of the disk. The
+// text buffers come from Buffer() and are reused once their file is written.
+{
+private:
+  struct Item
+  {
+    std::string name;
+    std::string *text;
+    std::function<void()> done;
+  };
+  std::deque<Item> queue;
+  std::vector<std::string *> spare; // written buffers, cleared
+  std::size_t maxqueued;
+  bool finishing = false;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread writer;
+
+  void WriterLoop()
+  {
+    while (true)
+    {
+      std::deque<Item> items; // all waiting files
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return finishing || !queue.empty(); });
+        if (queue.empty())
+          return;
+        items.swap(queue);
+      }
+      condition.notify_all(); // room in the queue
+
+      std::vector<std::string> names;
+      std::vector<const std::string *> texts;
+      for (std::size_t i = 0; i < items.size(); i++)
+        if (gridCompression(items[i].name) == compressNone)
+        {
+          names.push_back(items[i].name);
+          texts.push_back(items[i].text);
+        }
+        else
+        {
+          ogridstream out(items[i].name);
+          out.write(items[i].text->data(), items[i].text->size());
+          out.flush();
+          if (!out)
+          {
+            std::cout << "Error: could not write " << items[i].name << std::endl;
+            exit(1);
+          }
+        }
+      gridWriteFiles(names, texts);
+
+      for (std::size_t i = 0; i < items.size(); i++)
+      {
+        if (items[i].done)
+          items[i].done();
+        items[i].text->clear(); // keeps its capacity
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0; i < items.size(); i++)
+        spare.push_back(items[i].text);
+    } // while (true)
+  } // WriterLoop()
+
+public:
+  explicit GridFileWriter(std::size_t maxqueued) : maxqueued(maxqueued > 0 ? maxqueued : 1)
+  {
+    writer = std::thread([this] { WriterLoop(); });
+  }
+
+  // An empty buffer for the text of a file
+  std::string *Buffer()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.empty())
+      return new std::string;
+    std::string *text = spare.back();
+    spare.pop_back();
+    return text;
+  }
+
+  // Queues the file name with the contents *text (from Buffer()); done() is
+  // called on the writer thread after the file is closed.
+  void Write(const std::string &name, std::string *text, std::function<void()> done = std::function<void()>())
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return queue.size() < maxqueued; });
+    Item item = {name, text, done};
+    queue.push_back(item);
+    condition.notify_all();
+  }
+
+  // Returns when all queued files are written
+  void Finish()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finishing = true;
+    }
+    condition.notify_all();
+    if (writer.joinable())
+      writer.join();
+  }
+
+  ~GridFileWriter()
+  {
+    Finish();
+    for (std::size_t i = 0; i < spare.size(); i++)
+      delete spare[i];
+  }
+}; // class GridFileWriter
+
+#endif // GRIDIO_H
@@ -0,0 +1,332 @@
+#ifndef GRIDKERNELS_H
+#define GRIDKERNELS_H
+
+/*
+ * Description: Element kernels used by the LHAGrid operations (add, multiply,
+ *              average, errors). Every kernel works on one contiguous span of PDF
+ *              values, so the operations loop file-major over whole subgrids
+ *              instead of indexing pdfValuesList[isub][i] for each file.
+ *              The loop bodies are kept free of branches and aliasing so that
+ *              the compiler vectorizes them at -O3.
+ *
+ *              kernelPowMul() multiplies a span by f^w. Integer and
+ *              half-integer powers are computed with multiplications and
+ *              sqrt(). General powers use exp(w*log f), evaluated with the
+ *              vectorizable kernelLog()/kernelExp() defined below, and give 0
+ *              for f = 0 and NaN for f < 0, as pow(). For negative powers only,
+ *              values with |f| < small are replaced by copysign(small, f)
+ *              before the power is taken.
+ *
+ *              PDF values kept in memory have the type pdfstore_t, which is
+ *              double by default and float if mcgen.x is compiled with
+ *              -DMCGEN_SINGLE_PRECISION (make PRECISION=single). The grid files
+ *              carry 8 significant digits, so float storage adds a relative
+ *              error of at most 6e-8. Sums, means and variances are always
+ *              accumulated in double; the kernels read pdfstore_t and write
+ *              double. PrecisionReport records the rounding of the values
+ *              stored as float, relative to the double values they came from.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef MCGEN_SINGLE_PRECISION
+typedef float pdfstore_t;
+#else
+typedef double pdfstore_t;
+#endif
+
+// number of values processed at once by the chunked kernels
+const std::size_t kernelChunk = 256;
+// largest |w| that is still treated as an integer or half-integer power
+const double kernelMaxFastPower = 64.;
+
+inline uint64_t kernelBits(double x)
+{
+  uint64_t b;
+  memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+inline double kernelDouble(uint64_t b)
+{
+  double x;
+  memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+inline double kernelLog(double x)
+// Natural logarithm of a positive, finite x. The mantissa is reduced to
+// [sqrt(1/2), sqrt(2)) and log(m) = 2 atanh(s), s = (m-1)/(m+1), is summed
+// as an odd series in s. Agrees with log() to a few ulp.
+{
+  const double ln2 = 0.6931471805599453094;
+  const double two52 = 4503599627370496.0;
+  uint64_t bits = kernelBits(x);
+  // exponent as a double without an int64 -> double conversion
+  double e = kernelDouble((bits >> 52) | 0x4330000000000000ULL) - two52 - 1023.;
+  double m = kernelDouble((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+  bool big = m > 1.4142135623730950488;
+  m = big ? 0.5 * m : m;
+  e = big ? e + 1. : e;
+
+  double s = (m - 1.) / (m + 1.);
+  double s2 = s * s;
+  double p = 1. / 23.;
+  p = p * s2 + 1. / 21.;
+  p = p * s2 + 1. / 19.;
+  p = p * s2 + 1. / 17.;
+  p = p * s2 + 1. / 15.;
+  p = p * s2 + 1. / 13.;
+  p = p * s2 + 1. / 11.;
+  p = p * s2 + 1. / 9.;
+  p = p * s2 + 1. / 7.;
+  p = p * s2 + 1. / 5.;
+  p = p * s2 + 1. / 3.;
+  p = p * s2 + 1.;
+  return e * ln2 + 2. * s * p;
+} // kernelLog ->
+
+inline double kernelExp(double y)
+// Exponential function. y is split as n*ln2 + r with |r| <= ln2/2, exp(r) is
+// summed as a Taylor series, and 2^n is assembled in the exponent bits as
+// 2^n1 * 2^n2 with n1 = n/2 rounded, so that both factors are normal numbers
+// and subnormal results (y down to -745.1) and results up to DBL_MAX
+// (y up to 709.78) are rounded once, as by exp(). Results that over- or
+// underflow are returned as inf or 0.
+{
+  const double log2e = 1.4426950408889634074;
+  const double ln2hi = 6.93147180369123816490e-01;
+  const double ln2lo = 1.90821492927058770002e-10;
+  const double shifter = 6755399441055744.0; // 1.5 * 2^52
+
+  double yc = std::min(std::max(y, -746.), 710.);
+  double t = yc * log2e + shifter;
+  double n = t - shifter;
+  double r = (yc - n * ln2hi) - n * ln2lo;
+
+  double p = 1. / 6227020800.;
+  p = p * r + 1. / 479001600.;
+  p = p * r + 1. / 39916800.;
+  p = p * r + 1. / 3628800.;
+  p = p * r + 1. / 362880.;
+  p = p * r + 1. / 40320.;
+  p = p * r + 1. / 5040.;
+  p = p * r + 1. / 720.;
+  p = p * r + 1. / 120.;
+  p = p * r + 1. / 24.;
+  p = p * r + 1. / 6.;
+  p = p * r + 0.5;
+  p = p * r + 1.;
+  p = p * r + 1.;
+
+  // the low bits of t1 and t2 hold n1 and n2 in two's complement
+  double t1 = 0.5 * n + shifter;
+  double t2 = (n - (t1 - shifter)) + shifter;
+  double scale1 = kernelDouble((kernelBits(t1) - kernelBits(shifter) + 1023) << 52);
+  double scale2 = kernelDouble((kernelBits(t2) - kernelBits(shifter) + 1023) << 52);
+  double result = (p * scale1) * scale2;
+  result = y > 710. ? HUGE_VAL : result;
+  result = y < -746. ? 0. : result;
+  return result;
+} // kernelExp ->
+
+template <class S, class T>
+inline void kernelAxpy(S *__restrict out, const T *__restrict in, double w, std::size_t n)
+// out[i] += w * in[i]
+{
+  for (std::size_t i = 0; i < n; i++)
+    out[i] += w * in[i];
+} // kernelAxpy ->
+
+template <class S>
+inline void kernelScale(S *__restrict out, double w, std::size_t n)
+// out[i] *= w
+{
+  for (std::size_t i = 0; i < n; i++)
+    out[i] *= w;
+} // kernelScale ->
+
+template <class T>
+inline void kernelPairErrors(double *__restrict up, double *__restrict dn, const T *__restrict fc,
+                             const T *__restrict fp, const T *__restrict fm, std::size_t n, bool symmetric)
+// Adds the squared displacements of the pair (fp, fm) from the central values fc,
+// as in std_devs: symmetric (MC) errors add (fp-fc)^2 + (fm-fc)^2 to up and dn,
+// asymmetric (Hessian) errors add max(fp-fc, fm-fc, 0)^2 to up and
+// max(fc-fp, fc-fm, 0)^2 to dn
+{
+  if (symmetric)
+    for (std::size_t i = 0; i < n; i++)
+    {
+      const double dp = (double)fp[i] - fc[i], dm = (double)fm[i] - fc[i];
+      const double s = dp * dp + dm * dm;
+      up[i] += s;
+      dn[i] += s;
+    }
+  else
+    for (std::size_t i = 0; i < n; i++)
+    {
+      const double dp = (double)fp[i] - fc[i], dm = (double)fm[i] - fc[i];
+      const double u = std::max(std::max(dp, dm), 0.), d = std::max(std::max(-dp, -dm), 0.);
+      up[i] += u * u;
+      dn[i] += d * d;
+    }
+} // kernelPairErrors ->
+
+template <class S>
+inline void kernelSqrtScale(S *__restrict out, double w, std::size_t n)
+// out[i] = w * sqrt(out[i])
+{
+  for (std::size_t i = 0; i < n; i++)
+    out[i] = w * sqrt(out[i]);
+} // kernelSqrtScale ->
+
+template <class T>
+inline void kernelPowMul(double *__restrict out, const T *__restrict in, double w,
+                         std::size_t n, double small)
+// out[i] *= in[i]^w
+{
+  if (w == 0.) // f^0 = 1
+    return;
+
+  const double aw = fabs(w);
+  const bool negative = w < 0.;
+  double base[kernelChunk], acc[kernelChunk];
+
+  if (aw <= kernelMaxFastPower && floor(2. * aw) == 2. * aw)
+  // integer and half-integer powers: binary exponentiation, the same
+  // sequence of multiplications for every element of the chunk
+  {
+    const unsigned ipow = (unsigned)floor(aw);
+    const bool half = (aw != floor(aw));
+
+    for (std::size_t i0 = 0; i0 < n; i0 += kernelChunk)
+    {
+      const std::size_t m = std::min(kernelChunk, n - i0);
+      const T *f = in + i0;
+      double *o = out + i0;
+
+      for (std::size_t j = 0; j < m; j++)
+      {
+        double fj = f[j];
+        // clamp small values only when they would be divided by
+        if (negative && fabs(fj) < small)
+          fj = copysign(small, fj);
+        base[j] = fj;
+      }
+
+      if (half)
+        for (std::size_t j = 0; j < m; j++)
+          acc[j] = sqrt(base[j]);
+      else
+        for (std::size_t j = 0; j < m; j++)
+          acc[j] = 1.;
+
+      for (unsigned k = ipow; k != 0; k >>= 1)
+      {
+        if (k & 1)
+          for (std::size_t j = 0; j < m; j++)
+            acc[j] *= base[j];
+        if (k > 1)
+          for (std::size_t j = 0; j < m; j++)
+            base[j] *= base[j];
+      }
+
+      if (negative)
+        for (std::size_t j = 0; j < m; j++)
+          o[j] /= acc[j];
+      else
+        for (std::size_t j = 0; j < m; j++)
+          o[j] *= acc[j];
+    } // for (std::size_t i0...
+    return;
+  } // integer and half-integer powers
+
+  // general powers: f^w = exp(w*log f), as pow(): 0 for f = 0 and w > 0, NaN
+  // for f < 0; f is clamped from below by small only when it is divided by
+  for (std::size_t i0 = 0; i0 < n; i0 += kernelChunk)
+  {
+    const std::size_t m = std::min(kernelChunk, n - i0);
+    const T *f = in + i0;
+    double *o = out + i0;
+
+    for (std::size_t j = 0; j < m; j++)
+    {
+      const double fj = f[j];
+      const double a = negative ? std::max(fabs(fj), small) : fabs(fj);
+      base[j] = w * kernelLog(a > 0. ? a : 1.);
+      acc[j] = fj < 0. ? NAN : (a > 0. ? 1. : 0.); // sign and zero of the result
+    }
+    for (std::size_t j = 0; j < m; j++)
+      o[j] *= acc[j] * kernelExp(base[j]);
+  } // for (std::size_t i0...
+} // kernelPowMul ->
+
+class PrecisionReport
+// Maximal relative difference between double values and their copies
+// stored as pdfstore_t. Only printed in the single-precision build.
+{
+private:
+  double maxrel = 0.;
+  std::size_t nvalues = 0;
+
+public:
+  void Record(double exact, pdfstore_t stored)
+  {
+    if (exact != 0.)
+      maxrel = std::max(maxrel, fabs((stored - exact) / exact));
+    nvalues++;
+  }
+
+  void Merge(const PrecisionReport &other)
+  {
+    maxrel = std::max(maxrel, other.maxrel);
+    nvalues += other.nvalues;
+  }
+
+  double MaxRelativeError() const
+  {
+    return maxrel;
+  }
+
+  void Print(const std::string &what) const
+  {
+    if (sizeof(pdfstore_t) == sizeof(double))
+      return;
+    std::cout << "Single-precision storage of " << what << ": " << nvalues
+              << " values, max. relative deviation from double precision = "
+              << std::scientific << std::setprecision(2) << maxrel
+              << std::defaultfloat << std::endl;
+  }
+}; // class PrecisionReport
+
+inline void kernelStore(std::vector<double> &sums, std::vector<double> &values, PrecisionReport &)
+// Moves accumulated double sums into the stored values (double build).
+{
+  values.swap(sums);
+  std::vector<double>().swap(sums);
+} // kernelStore ->
+
+inline void kernelStore(std::vector<double> &sums, std::vector<float> &values, PrecisionReport &report)
+// Rounds accumulated double sums into the stored values (single-precision build).
+{
+  values.resize(sums.size());
+  for (std::size_t i = 0; i < sums.size(); i++)
+  {
+    values[i] = sums[i];
+    report.Record(sums[i], values[i]);
+  }
+  std::vector<double>().swap(sums);
+} // kernelStore ->
+
+#endif // GRIDKERNELS_H
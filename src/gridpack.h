@@ -0,0 +1,407 @@
+#ifndef GRIDPACK_H
+#define GRIDPACK_H
+
+/*
+ * Description: Packed container for a whole LHAPDF ensemble in one file
+ *              (extension .lhapack), written by "mcgen.x pack" and converted
+ *              back into an LHAPDF directory by "mcgen.x unpack". Opening one
+ *              file instead of one file per member saves the metadata
+ *              operations that dominate on parallel filesystems.
+ *
+ *              All members of a packed ensemble share one grid layout (the
+ *              x, Q, and flavor lists of every subgrid), which is stored once.
+ *              Layout of the file (integers are little-endian uint64 unless
+ *              noted, all blocks start at multiples of 8 bytes):
+ *                header:  magic "LHAPACK1", number of members, offset and
+ *                         size of the set name, of the .info file, of the
+ *                         layout, and offset of the member index
+ *                layout:  number of subgrids; for each subgrid nx, nq, nfl,
+ *                         followed by the x values, the Q values (double) and
+ *                         the flavor IDs (int64)
+ *                index:   offset and size of each member payload
+ *                members: size of the header text, the header lines of the
+ *                         member file separated by '\n', padding, and the PDF
+ *                         values of all subgrids as double, in the order of
+ *                         the .dat file
+ *              LHAPackReader maps the file into memory with mmap, so member k
+ *              is read without parsing any other member. A packed member is
+ *              referred to as "file.lhapack:k", e.g. in LHAGrid(filename).
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const char LHAPackMagic[9] = "LHAPACK1";
+
+struct LHAPackLayout
+{
+  std::vector<std::vector<double>> xValuesList;
+  std::vector<std::vector<double>> qValuesList;
+  std::vector<std::vector<int>> flavorsList;
+
+  int Ngrids() const
+  {
+    return xValuesList.size();
+  }
+
+  // number of PDF values of subgrid isub
+  std::size_t NumValues(int isub) const
+  {
+    return xValuesList[isub].size() * qValuesList[isub].size() * flavorsList[isub].size();
+  }
+}; // struct LHAPackLayout
+
+inline bool gridPackMember(const std::string &name, std::string &packfile, int &member)
+// Splits a member reference "file.lhapack:k" into the container and k.
+// Returns false if name is not such a reference.
+{
+  std::size_t colon = name.rfind(':');
+  if (colon == std::string::npos || colon + 1 == name.size())
+    return false;
+  std::string file = name.substr(0, colon);
+  if (file.size() < 8 || file.compare(file.size() - 8, 8, ".lhapack") != 0)
+    return false;
+  for (std::size_t i = colon + 1; i < name.size(); i++)
+    if (name[i] < '0' || name[i] > '9')
+      return false;
+  packfile = file;
+  member = atoi(name.c_str() + colon + 1);
+  return true;
+} // gridPackMember()
+
+class LHAPackReader
+// Read-only, memory-mapped view of a .lhapack file
+{
+private:
+  std::string path;
+  int fd = -1;
+  const char *base = NULL;
+  std::size_t fileSize = 0;
+
+  std::string setname, info;
+  LHAPackLayout layout;
+  std::vector<uint64_t> offsets, sizes;
+  uint64_t memberValues = 0; // PDF values of one member
+
+  // true if the bytes [offset, offset + size) are in the file; does not overflow
+  bool Fits(uint64_t offset, uint64_t size) const
+  {
+    return offset <= fileSize && size <= fileSize - offset;
+  }
+
+  uint64_t U64(std::size_t pos) const
+  {
+    uint64_t v;
+    if (!Fits(pos, sizeof(v)))
+      Corrupt();
+    memcpy(&v, base + pos, sizeof(v));
+    return v;
+  }
+
+  void Corrupt() const
+  {
+    std::cout << "Error: " << path << " is not a valid .lhapack file." << std::endl;
+    exit(1);
+  }
+
+  LHAPackReader(const std::string &filename) : path(filename)
+  {
+    fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      std::cout << "Unable to open file: " << filename << std::endl;
+      exit(1);
+    }
+    fileSize = st.st_size;
+    void *p = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      std::cout << "Unable to map file: " << filename << std::endl;
+      exit(1);
+    }
+    base = (const char *)p;
+
+    if (fileSize < 64 || memcmp(base, LHAPackMagic, 8) != 0)
+      Corrupt();
+    const uint64_t nmem = U64(8);
+    const uint64_t nameOffset = U64(16), nameSize = U64(24);
+    const uint64_t infoOffset = U64(32), infoSize = U64(40);
+    const uint64_t layoutOffset = U64(48), indexOffset = U64(56);
+    if (!Fits(nameOffset, nameSize) || !Fits(infoOffset, infoSize))
+      Corrupt();
+    setname.assign(base + nameOffset, nameSize);
+    info.assign(base + infoOffset, infoSize);
+
+    std::size_t pos = layoutOffset;
+    const uint64_t ngrids = U64(pos);
+    pos += 8;
+    for (uint64_t isub = 0; isub < ngrids; isub++)
+    {
+      const uint64_t nx = U64(pos), nq = U64(pos + 8), nfl = U64(pos + 16);
+      pos += 24;
+      // the knots and flavors must fit into the rest of the file, and the values
+      // of a member into the whole file
+      const uint64_t room = (fileSize - pos) / 8, maxvalues = fileSize / 8;
+      if (nx > room || nq > room - nx || nfl > room - nx - nq)
+        Corrupt();
+      if (nx * nq * nfl != 0 && (nq > maxvalues / nx || nfl > maxvalues / (nx * nq) ||
+                                 nx * nq * nfl > maxvalues - memberValues))
+        Corrupt();
+      memberValues += nx * nq * nfl;
+      std::vector<double> x(nx), q(nq);
+      std::vector<int> fl(nfl);
+      memcpy(x.data(), base + pos, 8 * nx);
+      pos += 8 * nx;
+      memcpy(q.data(), base + pos, 8 * nq);
+      pos += 8 * nq;
+      for (uint64_t i = 0; i < nfl; i++)
+        fl[i] = (int)(int64_t)U64(pos + 8 * i);
+      pos += 8 * nfl;
+      layout.xValuesList.push_back(x);
+      layout.qValuesList.push_back(q);
+      layout.flavorsList.push_back(fl);
+    }
+
+    if (indexOffset > fileSize || nmem > (fileSize - indexOffset) / 16)
+      Corrupt();
+    for (uint64_t k = 0; k < nmem; k++)
+    {
+      offsets.push_back(U64(indexOffset + 16 * k));
+      sizes.push_back(U64(indexOffset + 16 * k + 8));
+      if (!Fits(offsets[k], sizes[k]) || sizes[k] < 8)
+        Corrupt();
+    }
+  } // LHAPackReader()
+
+public:
+  // Returns the reader of a .lhapack file. Readers are cached, so that the
+  // file is opened and mapped only once per process.
+  static std::shared_ptr<LHAPackReader> Open(const std::string &filename)
+  {
+    static std::mutex cacheMutex;
+    static std::map<std::string, std::shared_ptr<LHAPackReader>> cache;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::shared_ptr<LHAPackReader> &reader = cache[filename];
+    if (!reader)
+      reader.reset(new LHAPackReader(filename));
+    return reader;
+  }
+
+  int NumMembers() const
+  {
+    return offsets.size();
+  }
+
+  const std::string &SetName() const
+  {
+    return setname;
+  }
+
+  const std::string &Info() const
+  {
+    return info;
+  }
+
+  const LHAPackLayout &Layout() const
+  {
+    return layout;
+  }
+
+  // Header lines and PDF values of member k. values points into the mapped
+  // file and stays valid while the reader exists.
+  void Member(int k, std::vector<std::string> &headers, const char *&values) const
+  {
+    if (k < 0 || k >= NumMembers())
+    {
+      std::cout << "Error: " << path << " has no member " << k << std::endl;
+      exit(1);
+    }
+    std::size_t pos = offsets[k];
+    const uint64_t end = offsets[k] + sizes[k]; // checked by the constructor
+    const uint64_t headerSize = U64(pos);
+    pos += 8;
+    if (headerSize > sizes[k] - 8)
+      Corrupt();
+    std::string text(base + pos, headerSize);
+    headers.clear();
+    std::size_t start = 0;
+    while (start < text.size())
+    {
+      std::size_t end = text.find('\n', start);
+      if (end == std::string::npos)
+        end = text.size();
+      headers.push_back(text.substr(start, end - start));
+      start = end + 1;
+    }
+    pos += (headerSize + 7) / 8 * 8;
+    values = base + pos;
+
+    if (pos > end || memberValues > (end - pos) / 8)
+      Corrupt();
+  } // Member()
+
+  ~LHAPackReader()
+  {
+    if (base != NULL)
+      munmap((void *)base, fileSize);
+    if (fd >= 0)
+      close(fd);
+  }
+}; // class LHAPackReader
+
+class LHAPackWriter
+// Writes a .lhapack file member by member
+{
+private:
+  std::string path;
+  FILE *file = NULL;
+  LHAPackLayout layout;
+  uint64_t nmembers = 0, nwritten = 0, indexOffset = 0;
+  std::vector<uint64_t> index;
+
+  void Put(const void *data, std::size_t n)
+  {
+    if (n > 0 && fwrite(data, 1, n, file) != n)
+    {
+      std::cout << "Error: could not write " << path << std::endl;
+      exit(1);
+    }
+  }
+
+  void PutU64(uint64_t v)
+  {
+    Put(&v, sizeof(v));
+  }
+
+  void Pad()
+  {
+    const char zeros[8] = {0};
+    long pos = ftell(file);
+    Put(zeros, (8 - pos % 8) % 8);
+  }
+
+public:
+  LHAPackWriter(const std::string &filename, const std::string &setname, const std::string &info,
+                const LHAPackLayout &lay, int nmem)
+      : path(filename), layout(lay), nmembers(nmem)
+  {
+    file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+    {
+      std::cout << "Unable to open file: " << filename << std::endl;
+      exit(1);
+    }
+
+    // header with the offsets of the blocks below
+    const uint64_t nameOffset = 64;
+    const uint64_t infoOffset = (nameOffset + setname.size() + 7) / 8 * 8;
+    const uint64_t layoutOffset = (infoOffset + info.size() + 7) / 8 * 8;
+    uint64_t layoutSize = 8;
+    for (int isub = 0; isub < layout.Ngrids(); isub++)
+      layoutSize += 24 + 8 * (layout.xValuesList[isub].size() + layout.qValuesList[isub].size() +
+                              layout.flavorsList[isub].size());
+    indexOffset = layoutOffset + layoutSize;
+
+    Put(LHAPackMagic, 8);
+    PutU64(nmembers);
+    PutU64(nameOffset);
+    PutU64(setname.size());
+    PutU64(infoOffset);
+    PutU64(info.size());
+    PutU64(layoutOffset);
+    PutU64(indexOffset);
+    Put(setname.data(), setname.size());
+    Pad();
+    Put(info.data(), info.size());
+    Pad();
+
+    PutU64(layout.Ngrids());
+    for (int isub = 0; isub < layout.Ngrids(); isub++)
+    {
+      PutU64(layout.xValuesList[isub].size());
+      PutU64(layout.qValuesList[isub].size());
+      PutU64(layout.flavorsList[isub].size());
+      Put(layout.xValuesList[isub].data(), 8 * layout.xValuesList[isub].size());
+      Put(layout.qValuesList[isub].data(), 8 * layout.qValuesList[isub].size());
+      for (std::size_t i = 0; i < layout.flavorsList[isub].size(); i++)
+        PutU64((uint64_t)(int64_t)layout.flavorsList[isub][i]);
+    }
+
+    // placeholder for the index, filled in by Close()
+    index.assign(2 * nmembers, 0);
+    Put(index.data(), 8 * index.size());
+  } // LHAPackWriter()
+
+  // Appends the next member. values[isub] holds the PDF values of subgrid
+  // isub in the order of the .dat file.
+  template <class T>
+  void AddMember(const std::vector<std::string> &headers, const std::vector<std::vector<T>> &values)
+  {
+    const uint64_t k = nwritten;
+    if (k == nmembers || (int)values.size() != layout.Ngrids())
+    {
+      std::cout << "Error: member does not match the layout of " << path << std::endl;
+      exit(1);
+    }
+    const uint64_t offset = ftell(file);
+
+    std::string text;
+    for (std::size_t i = 0; i < headers.size(); i++)
+      text += headers[i] + (i + 1 < headers.size() ? "\n" : "");
+    PutU64(text.size());
+    Put(text.data(), text.size());
+    Pad();
+
+    std::vector<double> buffer;
+    for (int isub = 0; isub < layout.Ngrids(); isub++)
+    {
+      if (values[isub].size() != layout.NumValues(isub))
+      {
+        std::cout << "Error: member does not match the layout of " << path << std::endl;
+        exit(1);
+      }
+      buffer.assign(values[isub].begin(), values[isub].end());
+      Put(buffer.data(), 8 * buffer.size());
+    }
+
+    index[2 * k] = offset;
+    index[2 * k + 1] = ftell(file) - offset;
+    nwritten++;
+  } // AddMember()
+
+  void Close()
+  {
+    if (nwritten != nmembers)
+    {
+      std::cout << "Error: " << nmembers - nwritten << " members missing in " << path << std::endl;
+      exit(1);
+    }
+    fseek(file, indexOffset, SEEK_SET);
+    Put(index.data(), 8 * index.size());
+    if (fclose(file) != 0)
+    {
+      std::cout << "Error: could not write " << path << std::endl;
+      exit(1);
+    }
+    file = NULL;
+  } // Close()
+}; // class LHAPackWriter
+
+#endif // GRIDPACK_H
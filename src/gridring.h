@@ -0,0 +1,367 @@
+#ifndef GRIDRING_H
+#define GRIDRING_H
+
+/*
+ * Description: Batched reading and writing of many whole files with the Linux
+ *              io_uring interface, compiled with -DMCGEN_IO_URING
+ *              (make IO_URING=yes). The ring is set up with the system calls
+ *              directly, so liburing is not needed, only the kernel header
+ *              <linux/io_uring.h>.
+ *
+ *              A batch of files is handled in phases: all opens (and for
+ *              reading, the sizes by statx), then all reads or writes, then all
+ *              closes. Every phase keeps up to the size of the ring of
+ *              operations in flight, so the latency of a network file system
+ *              is paid once per phase and not once per system call. Short reads
+ *              and writes are submitted again for the rest.
+ *
+ *              gridRingReadFiles() and gridRingWriteFiles() return false if
+ *              io_uring cannot be used (kernel older than 5.6, io_uring disabled
+ *              or blocked by seccomp, or MCGEN_IO_URING=off in the environment);
+ *              the callers in gridio.h then use the portable path.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+// operations of one ring in flight
+const unsigned gridRingEntries = 64;
+
+class GridRing
+// A submission and a completion queue shared with the kernel
+{
+private:
+  int ringfd = -1;
+  unsigned entries = 0;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray, *cqhead, *cqtail, *cqmask;
+  io_uring_sqe *sqes;
+  io_uring_cqe *cqes;
+  void *sqring = MAP_FAILED, *cqring = MAP_FAILED, *sqemap = MAP_FAILED;
+  std::size_t sqlen = 0, cqlen = 0, sqelen = 0;
+
+  int Enter(unsigned tosubmit, unsigned minwait)
+  {
+    return syscall(__NR_io_uring_enter, ringfd, tosubmit, minwait, minwait > 0 ? IORING_ENTER_GETEVENTS : 0,
+                   NULL, 0);
+  }
+
+public:
+  explicit GridRing(unsigned n)
+  {
+    const char *env = getenv("MCGEN_IO_URING");
+    if (env != NULL && strcmp(env, "off") == 0)
+      return;
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringfd = syscall(__NR_io_uring_setup, n, &p);
+    if (ringfd < 0)
+      return;
+    // IORING_FEAT_RW_CUR_POS came with 5.6, as openat, statx, read, write, and close
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close(ringfd);
+      ringfd = -1;
+      return;
+    }
+
+    entries = p.sq_entries;
+    sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqlen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+      sqlen = cqlen = std::max(sqlen, cqlen);
+    sqring = mmap(NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    cqring = single ? sqring
+                    : mmap(NULL, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+                           IORING_OFF_CQ_RING);
+    sqelen = p.sq_entries * sizeof(io_uring_sqe);
+    sqemap = mmap(NULL, sqelen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    if (sqring == MAP_FAILED || cqring == MAP_FAILED || sqemap == MAP_FAILED)
+    {
+      Release();
+      return;
+    }
+
+    char *sq = (char *)sqring, *cq = (char *)cqring;
+    sqhead = (unsigned *)(sq + p.sq_off.head);
+    sqtail = (unsigned *)(sq + p.sq_off.tail);
+    sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sqarray = (unsigned *)(sq + p.sq_off.array);
+    cqhead = (unsigned *)(cq + p.cq_off.head);
+    cqtail = (unsigned *)(cq + p.cq_off.tail);
+    cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    sqes = (io_uring_sqe *)sqemap;
+    cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  } // GridRing()
+
+  bool Valid() const
+  {
+    return ringfd >= 0;
+  }
+
+  void Release()
+  {
+    if (sqemap != MAP_FAILED)
+      munmap(sqemap, sqelen);
+    if (cqring != MAP_FAILED && cqring != sqring)
+      munmap(cqring, cqlen);
+    if (sqring != MAP_FAILED)
+      munmap(sqring, sqlen);
+    sqemap = cqring = sqring = MAP_FAILED;
+    if (ringfd >= 0)
+      close(ringfd);
+    ringfd = -1;
+  }
+
+  ~GridRing()
+  {
+    Release();
+  }
+
+  // Runs the operations i = 0..n-1 with up to the ring size in flight.
+  // prep(i, sqe) fills the submission of operation i; done(i, res) takes its
+  // result and returns false if the operation is to be submitted again (e.g.
+  // for the rest of a short write). Returns false if the ring fails.
+  template <class Prep, class Done>
+  bool Run(std::size_t n, const Prep &prep, const Done &done)
+  {
+    std::deque<std::size_t> todo;
+    for (std::size_t i = 0; i < n; i++)
+      todo.push_back(i);
+    unsigned inflight = 0, queued = 0; // queued: in the submission queue, not yet taken by the kernel
+    while (!todo.empty() || inflight > 0 || queued > 0)
+    {
+      unsigned tail = *sqtail;
+      while (!todo.empty() && inflight + queued < entries)
+      {
+        const unsigned index = tail & *sqmask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        prep(todo.front(), sqe);
+        sqe->user_data = todo.front();
+        sqarray[index] = index;
+        todo.pop_front();
+        tail++;
+        queued++;
+      }
+      __atomic_store_n(sqtail, tail, __ATOMIC_RELEASE);
+
+      int ret = Enter(queued, 1);
+      if (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        continue; // the queued operations are submitted by the next call
+      if (ret < 0 || (unsigned)ret > queued || (ret == 0 && inflight == 0))
+        return false; // nothing taken and nothing to wait for
+      queued -= ret;
+      inflight += ret;
+
+      unsigned head = *cqhead;
+      while (head != __atomic_load_n(cqtail, __ATOMIC_ACQUIRE))
+      {
+        const io_uring_cqe &cqe = cqes[head & *cqmask];
+        const std::size_t i = cqe.user_data;
+        const int res = cqe.res;
+        head++;
+        inflight--;
+        if (!done(i, res))
+          todo.push_back(i);
+      }
+      __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+    } // while (!todo.empty()...
+    return true;
+  } // Run()
+}; // class GridRing
+
+// Opens the files with flags on the ring; fds[i] is the descriptor or -errno
+inline bool gridRingOpen(GridRing &ring, const std::vector<std::string> &names, int flags, std::vector<int> &fds)
+{
+  fds.assign(names.size(), -1);
+  return ring.Run(
+      names.size(),
+      [&](std::size_t i, io_uring_sqe *sqe) {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)names[i].c_str();
+        sqe->len = 0666; // mode
+        sqe->open_flags = flags | O_CLOEXEC;
+      },
+      [&](std::size_t i, int res) {
+        fds[i] = res;
+        return true;
+      });
+} // gridRingOpen()
+
+// Closes the open descriptors of fds on the ring; each one is set to -1 as
+// soon as its close completes, so that a caller falling back to close()
+// after a failed ring only closes the others
+inline bool gridRingClose(GridRing &ring, std::vector<int> &fds)
+{
+  std::vector<std::size_t> open;
+  for (std::size_t i = 0; i < fds.size(); i++)
+    if (fds[i] >= 0)
+      open.push_back(i);
+  return ring.Run(
+      open.size(),
+      [&](std::size_t k, io_uring_sqe *sqe) {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fds[open[k]];
+      },
+      [&](std::size_t k, int) {
+        fds[open[k]] = -1; // the kernel releases the descriptor even if close fails
+        return true;
+      });
+} // gridRingClose()
+
+// Reads the whole files names[i] into contents[i]; ok[i] is false for a file
+// that could not be read. Returns false if io_uring cannot be used.
+inline bool gridRingReadFiles(const std::vector<std::string> &names, std::vector<std::string> &contents,
+                              std::vector<bool> &ok)
+{
+  GridRing ring(gridRingEntries);
+  if (!ring.Valid())
+    return false;
+  const std::size_t n = names.size();
+  contents.assign(n, std::string());
+  ok.assign(n, false);
+
+  std::vector<int> fds;
+  std::vector<struct statx> st(n);
+  bool valid = gridRingOpen(ring, names, O_RDONLY, fds);
+  valid = valid && ring.Run(
+                       n,
+                       [&](std::size_t i, io_uring_sqe *sqe) {
+                         sqe->opcode = IORING_OP_STATX;
+                         sqe->fd = fds[i] >= 0 ? fds[i] : AT_FDCWD;
+                         sqe->addr = (uint64_t)(uintptr_t)(fds[i] >= 0 ? "" : names[i].c_str());
+                         sqe->statx_flags = fds[i] >= 0 ? AT_EMPTY_PATH : 0;
+                         sqe->len = STATX_SIZE;
+                         sqe->off = (uint64_t)(uintptr_t)&st[i];
+                       },
+                       [&](std::size_t i, int res) {
+                         ok[i] = fds[i] >= 0 && res == 0;
+                         if (ok[i])
+                           contents[i].resize(st[i].stx_size);
+                         return true;
+                       });
+
+  std::vector<std::size_t> done(n, 0), reading;
+  for (std::size_t i = 0; i < n; i++)
+    if (ok[i] && !contents[i].empty())
+      reading.push_back(i);
+  valid = valid && ring.Run(
+                       reading.size(),
+                       [&](std::size_t k, io_uring_sqe *sqe) {
+                         const std::size_t i = reading[k];
+                         sqe->opcode = IORING_OP_READ;
+                         sqe->fd = fds[i];
+                         sqe->addr = (uint64_t)(uintptr_t)(&contents[i][0] + done[i]);
+                         sqe->len = std::min<std::size_t>(contents[i].size() - done[i], 1 << 30);
+                         sqe->off = done[i];
+                       },
+                       [&](std::size_t k, int res) {
+                         const std::size_t i = reading[k];
+                         if (res == -EINTR || res == -EAGAIN)
+                           return false;
+                         if (res <= 0)
+                         { // end of a file that became shorter, or an error
+                           if (res < 0)
+                             ok[i] = false;
+                           contents[i].resize(done[i]);
+                           return true;
+                         }
+                         done[i] += res;
+                         return done[i] == contents[i].size();
+                       });
+
+  if (!gridRingClose(ring, fds))
+    valid = false;
+  if (!valid)
+  { // the ring failed: close what is still open (closed ones are -1)
+    for (std::size_t i = 0; i < n; i++)
+      if (fds[i] >= 0)
+        close(fds[i]);
+    return false;
+  }
+  return true;
+} // gridRingReadFiles()
+
+// Writes texts[i] into the files names[i]. failed is the index of a file that
+// could not be written and errnum its error, or failed = n. Returns false if
+// io_uring cannot be used.
+inline bool gridRingWriteFiles(const std::vector<std::string> &names, const std::vector<const std::string *> &texts,
+                               std::size_t &failed, int &errnum)
+{
+  GridRing ring(gridRingEntries);
+  if (!ring.Valid())
+    return false;
+  const std::size_t n = names.size();
+  failed = n;
+  errnum = 0;
+
+  std::vector<int> fds;
+  bool valid = gridRingOpen(ring, names, O_WRONLY | O_CREAT | O_TRUNC, fds);
+  std::vector<std::size_t> done(n, 0), writing;
+  for (std::size_t i = 0; i < n && valid; i++)
+    if (fds[i] < 0 && failed == n)
+    {
+      failed = i;
+      errnum = -fds[i];
+    }
+    else if (fds[i] >= 0 && !texts[i]->empty())
+      writing.push_back(i);
+
+  valid = valid && ring.Run(
+                       writing.size(),
+                       [&](std::size_t k, io_uring_sqe *sqe) {
+                         const std::size_t i = writing[k];
+                         sqe->opcode = IORING_OP_WRITE;
+                         sqe->fd = fds[i];
+                         sqe->addr = (uint64_t)(uintptr_t)(texts[i]->data() + done[i]);
+                         sqe->len = std::min<std::size_t>(texts[i]->size() - done[i], 1 << 30);
+                         sqe->off = done[i];
+                       },
+                       [&](std::size_t k, int res) {
+                         const std::size_t i = writing[k];
+                         if (res == -EINTR || res == -EAGAIN)
+                           return false;
+                         if (res <= 0)
+                         {
+                           if (failed == n || i < failed)
+                           {
+                             failed = i;
+                             errnum = res < 0 ? -res : EIO;
+                           }
+                           return true;
+                         }
+                         done[i] += res;
+                         return done[i] == texts[i]->size();
+                       });
+
+  if (!gridRingClose(ring, fds))
+    valid = false;
+  if (!valid)
+  {
+    for (std::size_t i = 0; i < n; i++)
+      if (fds[i] >= 0)
+        close(fds[i]);
+    return false;
+  }
+  return true;
+} // gridRingWriteFiles()
+
+#endif // GRIDRING_H
@@ -0,0 +1,79 @@
+/*
+ * Description: Checks the vectorizable kernelExp() and kernelLog() of
+ *              gridkernels.h against exp() and log() over their full range,
+ *              including the subnormal and overflow edges of exp().
+ *              make check builds and runs it; the exit status is 1 if an
+ *              error exceeds the tolerance.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "gridkernels.h"
+
+// difference of a and b in units in the last place of b; 0 if both are
+// inf or both are 0, and a large number if only one is
+double ulps(double a, double b)
+{
+  if (std::isinf(b) || b == 0.)
+    return a == b ? 0. : 1.e30;
+  return fabs(a - b) / (nextafter(fabs(b), HUGE_VAL) - fabs(b));
+} // ulps ->
+
+int main()
+{
+  const double maxulps = 2.; // normal results
+  const double maxsub = 1.;  // subnormal results, rounded once at 2^-1074
+
+  // dense sweep plus the edges: the under- and overflow thresholds, and the
+  // ends of the range where the exponent is assembled from one factor
+  std::vector<double> ys;
+  for (double y = -750.; y <= 712.; y += 1.e-3)
+    ys.push_back(y);
+  for (double y : {-745.2, -745.1332191019412, -745.13, -744.44, -740., -708.4, -708.3964185322641, -708.,
+                   0., 708., 709., 709.5, 709.782712893384, 709.7827128933841, 709.79, 710.})
+  {
+    ys.push_back(y);
+    ys.push_back(nextafter(y, -HUGE_VAL));
+    ys.push_back(nextafter(y, HUGE_VAL));
+  }
+
+  double worst = 0., worstsub = 0., yworst = 0., yworstsub = 0.;
+  for (double y : ys)
+  {
+    const double e = exp(y), k = kernelExp(y);
+    if (e != 0. && e < DBL_MIN)
+    {
+      const double d = fabs(k - e) / DBL_TRUE_MIN;
+      if (d > worstsub)
+        worstsub = d, yworstsub = y;
+    }
+    else if (ulps(k, e) > worst)
+      worst = ulps(k, e), yworst = y;
+  }
+  std::cout << "kernelExp: " << ys.size() << " points, worst " << worst << " ulp at y = " << yworst
+            << ", subnormal " << worstsub << " ulp at y = " << yworstsub << std::endl;
+
+  double worstlog = 0., xworst = 0.;
+  for (double l = -1020.; l <= 1020.; l += 1.e-3)
+  {
+    const double x = exp2(l);
+    if (fabs(log(x)) < 1.e-3) // near x = 1 the absolute error is what counts
+      continue;
+    if (ulps(kernelLog(x), log(x)) > worstlog)
+      worstlog = ulps(kernelLog(x), log(x)), xworst = x;
+  }
+  std::cout << "kernelLog: worst " << worstlog << " ulp at x = " << xworst << std::endl;
+
+  if (worst > maxulps || worstsub > maxsub || worstlog > 4. * maxulps)
+  {
+    std::cout << "Error: the kernels differ from exp() and log() by more than the tolerance." << std::endl;
+    return 1;
+  }
+  return 0;
+} // main ->
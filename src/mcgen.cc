@@ -18,6 +18,26 @@
 //
 //
 // History
+// 2026-10 LK Generate writes the replicas on the x and Q grids of the card, regridded by the stencils in every subgrid
+// 2026-10 LK Grid files are read ahead and written in batches, through io_uring with IO_URING=yes
+// 2026-10 LK Generate samples and formats the replicas on the thread pool while a writer thread writes them
+// 2026-10 LK Added shard=i/N for generate and merge-shards, for generation on many nodes
+// 2026-10 LK Added batch: many jobs in one process tree, sharing their input sets; run parameters in MCjob
+// 2026-10 LK Added pipeline: generate, convert, and std_devs in one process, replicas kept in memory
+// 2026-10 LK Added serve/submit: resident server that keeps parsed inputs between jobs
+// 2026-10 LK Added validate: replica mean, spread, and skewness against the sampled Hessian prior
+// 2026-10 LK Added mc2hessian: Hessian members from the principal components of MC replicas
+// 2026-10 LK Added compress: selection of MC replicas that preserves the statistics
+// 2026-10 LK Added std_devs_grid: errors on the knots of the LHAPDF grids, without LHAPDF
+// 2026-10 LK Added correlations: covariance and correlation matrices on the plt grid
+// 2026-10 LK std_devs writes percentile bands of MC replicas (error type pct)
+// 2026-10 LK std_devs accumulates the errors while the members are read, in parallel
+// 2026-10 LK Convert and std_devs interpolate the members with shared stencils
+// 2026-10 LK Convert runs in parallel over members and blocks of Q values
+// 2026-10 LK Convert streams the .plt files member by member
+// 2026-10 LK Flavor bases for convert and std_devs can be read from files
+// 2026-10 LK Convert evaluates all flavors with one LHAPDF call per point
+// 2026-10 LK Added pack/unpack of LHAPDF ensembles into single .lhapack files
 // 2025-02-06 LK Included routine to select physical or SU(Nf) representation for plt output
 // 2023       LK Modified functions to be more dynamic by reading LHAPDF data
 //               Routines include NQ subgrids instead of just 1 for Q0.
@@ -36,11 +56,27 @@
 #include <fstream>
 #include <math.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 // lk23 added header containing custom class object
 #include "subgrid.h"
+#include "flavormap.h"
+#include "stencil.h"
+#include "quantiles.h"
+#include "correlations.h"
+#include "compress.h"
+#include "svd.h"
 #include "LHAPDF/GridPDF.h"
 #include "LHAPDF/Paths.h"
 
@@ -49,39 +85,128 @@ using namespace boost::algorithm;
 
 //========================================================================
 
-string cardname = "mcgen.card", inpdfname = "CT14nnlo", outpdfname = "mcCT14nnlo",
-       err_type = "he90";
-string xlhaname = "../inc/xgrid-lha6.dat", qlhaname = "../inc/qgrid-lha6.dat",
-       xpltname = "../inc/xgrid-plt.dat", qpltname = "../inc/qgrid-plt.dat";
-unsigned short int nmc = 100, nstart = 1;
-short int nsym = 1, nshift = 0, ktype = 1;
+// lk26 Parameters of one run of mcgen, formerly file-scope globals: the values
+//      read from the input card and the options of the operation. MCrun creates
+//      one context per operation and passes it to the functions below, so
+//      "mcgen.x batch" can hold the contexts of many jobs at once.
+struct MCjob
+{
+  string cardname = "mcgen.card", inpdfname = "CT14nnlo", outpdfname = "mcCT14nnlo",
+         err_type = "he90";
+  string xlhaname = "../inc/xgrid-lha6.dat", qlhaname = "../inc/qgrid-lha6.dat",
+         xpltname = "../inc/xgrid-plt.dat", qpltname = "../inc/qgrid-plt.dat";
+  unsigned short int nmc = 100, nstart = 1;
+  short int nsym = 1, nshift = 0, ktype = 1;
+  // lk25 plt_representation and PDG_ID for the "convert" option
+  string plt_rep = "physical"; int pdg_id = 2212;
+  // lk26 optional flavor basis file for the "std_devs" option (default: physical basis)
+  string basisname = "";
+  // lk26 order of alpha_s and alpha_s(MZ) of the card, which select the header
+  //      ../inc/Header_<order>_<alpha_s(MZ)>.info of the .info file of "pipeline"
+  string alphasorder = "", alphasmz = "";
+  // lk26 set by the "pipeline" option: generate writes the replicas into the set
+  //      directory outpdfname/ and keeps them in LHAGridCache() for convert and std_devs
+  bool keepReplicas = false;
+  // lk26 set by "generate mcgen.card shard=i/N": this run writes shard i of N,
+  //      combined by "mcgen.x merge-shards mcgen.card N" (0 = all replicas)
+  int shard = 0, nshards = 0;
+};
 const double small = 1.0e-10;
-// lk25 added global variables for plt_representation and PDG_ID for the "convert" option
-string plt_rep = "physical"; int pdg_id = 2212;
 
-int MCread_card();
-int MCGenerateLHAPDF();
-int MCLHAPDF2plt();
-int MCStdDevs();
+int MCread_card(MCjob &job);
+int MCGenerateLHAPDF(MCjob &job);
+int MCLHAPDF2plt(MCjob &job);
+int MCStdDevs(MCjob &job);
+int MCStdDevsGrid(MCjob &job, int argc, char *argv[]);
+int MCpipeline(MCjob &job, int argc, char *argv[]);
+int MCmergeShards(MCjob &job, int argc, char *argv[]);
+void MCparseShard(MCjob &job, const string &spec);
+void MCshardRange(const MCjob &job, int shard, int &first, int &last);
+string MCshardFileName(const MCjob &job, int shard, const string &suffix);
+string MCreplicaFileName(const string &prefix, int imc, const string &ext);
+string MCshardCardSignature(const MCjob &job);
+bool MCoutputKnots(const MCjob &job, const LHAGrid &input, vector<vector<double>> &xgrid,
+                   vector<vector<double>> &qgrid);
+void MCcheckPltOptions(const MCjob &job);
+vector<string> MCgridFiles(const string &input);
+int MCcorrelations(MCjob &job, int argc, char *argv[]);
+int MCcompress(MCjob &job, int argc, char *argv[]);
+int MCmc2hessian(MCjob &job, int argc, char *argv[]);
+int MCvalidate(MCjob &job, int argc, char *argv[]);
 int MCaverage(int argc, char *argv[]);
 int MCadd(int argc, char *argv[]);
+int MCpack(int argc, char *argv[]);
+int MCunpack(int argc, char *argv[]);
+string MCunpackSet(const string &packfile, const string &outdir);
+string MCsetInfoFile(const string &setname);
+map<string, string> MCparseOptions(int argc, char *argv[], int first, const string &operation,
+                                   const vector<string> &keys, const string &usage, bool allowempty = false);
+string MCoption(const map<string, string> &options, const string &key, const string &fallback);
+void MCoptionError(const string &arg, const string &operation, const string &usage);
+void MCreadPltGrid(const MCjob &job, vector<double> &xgrid, vector<double> &qgrid);
+void MCwriteSetInfo(const string &inname, const string &outname, int nmem, const string &errortype,
+                    const string &conflevel);
+void MCopenPackedInput(MCjob &job);
 // lk23 added function to sort flavors in plt order
 bool pltSort(int a, int b);
 // lk25 added new functions used in MCLHAPDF2plt
 string getLHAInfoValue(const LHAPDF::PDFInfo& pdfInfo, const string& variableName);
+// lk26 added function to evaluate a flavor basis on a row of x values
+void MCevaluateFlavors(LHAPDF::PDF *p, const FlavorMap &flavormap, const vector<double> &xgrid, double q,
+                       vector<double> &xfcells, vector<double> &xfout);
+// lk26 added stencils of the LHAPDF interpolation on the output points, shared by all members
+InterpolationStencils MCmakeStencils(const LHAPDF::PDFInfo &info, const LHAGrid &layout, const FlavorMap &flavormap,
+                                     const vector<double> &xgrid, const vector<double> &qgrid, int sub = -1);
+void MCevaluateFlavors(const InterpolationStencils &stencils, const LHAGrid &member, const FlavorMap &flavormap,
+                       size_t iq, vector<double> &xfcells, vector<double> &xfout);
+// lk26 added function to evaluate all members of a set on a grid in parallel
+void MCevaluateMembers(LHAPDF::PDFSet &set, const string &setname, LHAPDF::PDF *pdf0,
+                       const InterpolationStencils &stencils, const FlavorMap &flavormap, const vector<int> &flsel,
+                       const vector<double> &xgrid, const vector<double> &qgrid, const vector<double> &xweight,
+                       int nread, vector<double> &F);
+// lk26 added function to parse lists of grid indices for the "correlations" option
+vector<int> MCparseIndexList(const string &list, int n, const string &what);
+// lk26 added function to round a value as it is written with the given number of digits
+double MCroundAsWritten(double value, int digits);
+// lk26 added functions for the resident server mode, see MCserve
+int MCrun(int argc, char *argv[]);
+int MCserve(int argc, char *argv[]);
+int MCsubmit(int argc, char *argv[]);
+int MCbatch(int argc, char *argv[]);
+LRUCache<LHAPDF::PDF> &MCpdfCache();
+shared_ptr<LHAPDF::PDF> MCmemberPDF(const LHAPDF::PDFSet &set, const string &setname, int imem);
 
 int main(int argc, char *argv[])
 {
+  return MCrun(argc, argv);
+} // main -> ==============================================================
+
+int MCrun(int argc, char *argv[])
+// Runs the operation argv[1], called by main and for the jobs of "mcgen.x serve"
+{
+  MCjob job; // parameters of this run
   //========================================================================
   if (argc < 3)
   {
     cout << "Usage examples" << endl;
-    cout << "   mcgen.x generate mcgen.card" << endl;
+    cout << "   mcgen.x generate mcgen.card [shard=i/N]" << endl;
+    cout << "   mcgen.x merge-shards mcgen.card N" << endl;
+    cout << "   mcgen.x pipeline mcgen.card [plt_representation=physical] [PDG_ID=2212(proton)] [cache=MB]" << endl;
     cout << "   mcgen.x convert LHAPDF_set [plt_representation=physical] [PDG_ID=2212(proton)]" << endl;
-    cout << "   mcgen.x std_devs LHAPDF_set error_type" << endl;
+    cout << "   mcgen.x std_devs LHAPDF_set error_type [basis_file]" << endl;
+    cout << "   mcgen.x std_devs_grid set_directory|packed_set.lhapack|grid_list error_type [output_prefix]" << endl;
+    cout << "   mcgen.x correlations LHAPDF_set error_type [basis=file] [flavors=list] [x=list] [q=list]" << endl;
+    cout << "   mcgen.x compress LHAPDF_set Nout [output=set] [iterations=20000] [seed=1]" << endl;
+    cout << "   mcgen.x mc2hessian LHAPDF_set Neig [output=set] [power=2] [seed=1]" << endl;
+    cout << "   mcgen.x validate Hessian_set MC_directory|MC.lhapack|MC_list [error_type=he90] [ktype=1] [replicas=N]" << endl;
     cout << "   mcgen.x average average.dat input1.dat input2.dat ..." << endl;
     cout << "   mcgen.x add sum.dat input1.dat input2.dat w1 w2" << endl;
     cout << "   mcgen.x multiply prod.dat input1.dat input2.dat power1 power2" << endl;
+    cout << "   mcgen.x pack LHAPDF_set [packed_set.lhapack]" << endl;
+    cout << "   mcgen.x unpack packed_set.lhapack [output_directory=.]" << endl;
+    cout << "   mcgen.x serve socket_path [cache=4096]" << endl;
+    cout << "   mcgen.x submit socket_path generate|convert|std_devs|add|average|stop [parameters]" << endl;
+    cout << "   mcgen.x batch jobs.list [jobs=N] [cache=4096]" << endl;
     cout << "Stop: too few parameters passed to mcgen" << endl;
     exit(1);
   }
@@ -89,9 +214,31 @@ int main(int argc, char *argv[])
   if (strcmp(argv[1], "generate") == 0)
   { // Generate random replicas,
     // by reading parameters from the input card cardname;
-    cardname = argv[2];
-    MCread_card(); // Read parameters from the input card
-    MCGenerateLHAPDF();
+    job.cardname = argv[2];
+    // lk26 shard=i/N (or --shard i/N): replicas of shard i of N only
+    for (int iarg = 3; iarg < argc; iarg++)
+      if (strncmp(argv[iarg], "shard=", 6) == 0)
+        MCparseShard(job, argv[iarg] + 6);
+      else if (strcmp(argv[iarg], "--shard") == 0 && iarg + 1 < argc)
+        MCparseShard(job, argv[++iarg]);
+      else
+      {
+        cout << "Usage: mcgen.x generate mcgen.card [shard=i/N]" << endl;
+        exit(1);
+      }
+    MCread_card(job); // Read parameters from the input card
+    MCopenPackedInput(job);
+    MCGenerateLHAPDF(job);
+  }
+  else if (strcmp(argv[1], "merge-shards") == 0)
+  { // Combine the shards of "generate mcgen.card shard=i/N":
+    // the mean replica and the shifts of all replicas
+    MCmergeShards(job, argc, argv);
+  }
+  else if (strcmp(argv[1], "pipeline") == 0)
+  { // Generate the replicas, convert them into .plt files, and
+    // compute the errors of the input and output sets in one process
+    MCpipeline(job, argc, argv);
   }
   else if (strcmp(argv[1], "convert") == 0)
   { // Create .plt grids from
@@ -101,46 +248,109 @@ int main(int argc, char *argv[])
     //      PDG_ID is not required if the particle ID is defined within the LHAPDF info file. If not included as an argument,
     //      mcgen assumes the LHAPDF input set is for the proton.
     //      By default, mcgen assumes the plt flavors are in the physical representation.
+    // lk26 plt_representation can also be a file with a flavor basis, see flavormap.h
     if (argc < 3)
     {
       cout << "Stop: too few parameters passed to mcgen" << endl;
       cout << "Usage: mcgen.x convert LHAPDF_set [plt_representation=physical] [PDG_ID=2212]" << endl;
     }
-    inpdfname = argv[2];
+    job.inpdfname = argv[2];
     // lk25
     if (argc >= 4)
     {
-      plt_rep = argv[3];
+      job.plt_rep = argv[3];
       if (argc == 5)
-	pdg_id = stoi(argv[4]);
+	job.pdg_id = stoi(argv[4]);
+    }
+    MCcheckPltOptions(job);
+    MCopenPackedInput(job);
+    MCLHAPDF2plt(job);
+  }
+  else if (strcmp(argv[1], "std_devs") == 0)
+  { // Create .er files containing
+    // standard deviations for PDFs and other miscellaneous information
+    if (argc < 4)
+    {
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x std_devs LHAPDF_set error_type [basis_file]" << endl;
+      exit(1);
     }
-    // check if plt_rep is not "physical" or "sunf"
-    if (plt_rep != "physical" && plt_rep != "sunf")
+
+    job.inpdfname = argv[2];
+    job.err_type = argv[3];
+    if (argc >= 5)
+      job.basisname = argv[4];
+    MCopenPackedInput(job);
+    MCStdDevs(job);
+  }
+  else if (strcmp(argv[1], "std_devs_grid") == 0)
+  { // Create LHAPDF grids with the central values and
+    // errors on the knots of the input grids
+    if (argc < 4)
     {
-      cout << "plt representation: " << plt_rep << " is not a supported option.\nUse physical or sunf representation for plt files." << endl;
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x std_devs_grid set_directory|packed_set.lhapack|grid_list error_type [output_prefix]" << endl;
       exit(1);
     }
-    // check to see if pdg_id is allowed option
-    if (pdg_id != 2212 && pdg_id != 211 && pdg_id != 321)
+
+    MCStdDevsGrid(job, argc, argv);
+  }
+  else if (strcmp(argv[1], "correlations") == 0)
+  { // Create covariance and correlation matrices
+    // of the PDFs on the .plt grid
+    if (argc < 4)
     {
-      cout << "pdg_id = " << pdg_id << " is not a supported particle.\nUse proton=2212, pi+=211, or K+=321." << endl;
-      exit(1);      
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x correlations LHAPDF_set error_type [basis=file] [flavors=list] [x=list] [q=list]" << endl;
+      exit(1);
     }
-    MCLHAPDF2plt();
+
+    job.inpdfname = argv[2];
+    job.err_type = argv[3];
+    MCopenPackedInput(job);
+    MCcorrelations(job, argc, argv);
   }
-  else if (strcmp(argv[1], "std_devs") == 0)
-  { // Create .er files containing
-    // standard deviations for PDFs and other miscellaneous information
+  else if (strcmp(argv[1], "compress") == 0)
+  { // Select a subset of MC replicas
+    // with the statistics of the full ensemble
+    if (argc < 4)
+    {
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x compress LHAPDF_set Nout [output=set] [iterations=20000] [seed=1]" << endl;
+      exit(1);
+    }
+
+    job.inpdfname = argv[2];
+    MCopenPackedInput(job);
+    MCcompress(job, argc, argv);
+  }
+  else if (strcmp(argv[1], "mc2hessian") == 0)
+  { // Convert MC replicas into symmetric
+    // Hessian members along their principal components
+    if (argc < 4)
+    {
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x mc2hessian LHAPDF_set Neig [output=set] [power=2] [seed=1]" << endl;
+      exit(1);
+    }
+
+    job.inpdfname = argv[2];
+    MCopenPackedInput(job);
+    MCmc2hessian(job, argc, argv);
+  }
+  else if (strcmp(argv[1], "validate") == 0)
+  { // Compare the mean and spread of MC replicas
+    // to their Hessian prior at every knot
     if (argc < 4)
     {
       cout << "Stop: too few parameters passed to mcgen" << endl;
-      cout << "Usage: mcgen.x std_devs LHAPDF_set error_type" << endl;
+      cout << "Usage: mcgen.x validate Hessian_set MC_directory|MC.lhapack|MC_list [error_type=he90] [ktype=1] [replicas=N]" << endl;
       exit(1);
     }
 
-    inpdfname = argv[2];
-    err_type = argv[3];
-    MCStdDevs();
+    job.inpdfname = argv[2];
+    MCopenPackedInput(job);
+    MCvalidate(job, argc, argv);
   }
   else if (strcmp(argv[1], "average") == 0)
   { // Compute the zeroth replica,
@@ -167,6 +377,34 @@ int main(int argc, char *argv[])
 
     MCadd(argc, argv);
   }
+  else if (strcmp(argv[1], "pack") == 0)
+  { // Pack all members of an LHAPDF set into one .lhapack file
+    MCpack(argc, argv);
+  }
+  else if (strcmp(argv[1], "unpack") == 0)
+  { // Recreate the LHAPDF set directory from a .lhapack file
+    MCunpack(argc, argv);
+  }
+  else if (strcmp(argv[1], "serve") == 0)
+  { // Run jobs sent to a Unix socket, keeping
+    // the parsed inputs in memory between them
+    MCserve(argc, argv);
+  }
+  else if (strcmp(argv[1], "submit") == 0)
+  { // Send a job to "mcgen.x serve"
+    if (argc < 4)
+    {
+      cout << "Stop: too few parameters passed to mcgen" << endl;
+      cout << "Usage: mcgen.x submit socket_path generate|convert|std_devs|add|average|stop [parameters]" << endl;
+      exit(1);
+    }
+    return MCsubmit(argc, argv);
+  }
+  else if (strcmp(argv[1], "batch") == 0)
+  { // Run the jobs of a list in child processes,
+    // several at a time, sharing the input sets they read
+    return MCbatch(argc, argv);
+  }
   else
   {
     cout << "mcgen does not recognize requested operation " << argv[1] << endl;
@@ -174,49 +412,55 @@ int main(int argc, char *argv[])
   }
 
   return 0;
-} // main -> ==============================================================
+} // MCrun -> ==============================================================
 
-int MCread_card()
+int MCread_card(MCjob &job)
 // Read parameters of the calculation from an input card
 //========================================================================
 {
   string dummy;
 
   cout << "Reading parameters from the input card" << endl;
-  ifstream infile(cardname.c_str());
+  ifstream infile(job.cardname.c_str());
 
   if (infile.fail())
   {
-    cout << "Problem with reading " << cardname << endl;
+    cout << "Problem with reading " << job.cardname << endl;
     exit(1);
   }
 
   getline(infile, dummy);
   getline(infile, dummy);
-  getline(infile, inpdfname, '#');
+  getline(infile, job.inpdfname, '#');
   getline(infile, dummy);
-  trim_right(inpdfname); // input PDF name
-  getline(infile, outpdfname, '#');
+  trim_right(job.inpdfname); // input PDF name
+  getline(infile, job.outpdfname, '#');
   getline(infile, dummy);
-  trim_right(outpdfname); // output PDF name
-  getline(infile, err_type, '#');
+  trim_right(job.outpdfname); // output PDF name
+  getline(infile, job.err_type, '#');
   getline(infile, dummy);
-  trim_right(err_type); // error type (Hessian/MC)
+  trim_right(job.err_type); // error type (Hessian/MC)
 
-  infile >> nmc;
+  infile >> job.nmc;
   getline(infile, dummy); // number of MC replicas to generate
-  infile >> nstart;
+  infile >> job.nstart;
   getline(infile, dummy); // the starting random number
-  infile >> ktype;
+  infile >> job.ktype;
   getline(infile, dummy);   // type of the replicas;
-  nsym = ktype % 10;        // symmetric or asymmetric PDF error
-  nshift = abs(ktype / 10); // shifted replicas or not
-  getline(infile, xlhaname, '#');
+  job.nsym = job.ktype % 10;        // symmetric or asymmetric PDF error
+  job.nshift = abs(job.ktype / 10); // shifted replicas or not
+  getline(infile, job.xlhaname, '#');
   getline(infile, dummy); // grid of output x values
-  trim_right(xlhaname);
-  getline(infile, qlhaname, '#');
+  trim_right(job.xlhaname);
+  getline(infile, job.qlhaname, '#');
   getline(infile, dummy); // grid of output Q values
-  trim_right(qlhaname);
+  trim_right(job.qlhaname);
+  getline(infile, job.alphasorder, '#');
+  getline(infile, dummy); // order of alpha_s (NLO/NNLO), for the .info file of "pipeline"
+  trim(job.alphasorder);
+  getline(infile, job.alphasmz, '#');
+  getline(infile, dummy); // alpha_s(MZ)
+  trim(job.alphasmz);
 
   infile.clear();
   infile.close();
@@ -224,14 +468,125 @@ int MCread_card()
   return 0;
 } // MCread_card -> ========================================================
 
-int MCGenerateLHAPDF()
+void MCcheckPltOptions(const MCjob &job)
+// Check the plt_representation and PDG_ID options of "convert" and "pipeline"
+{
+  // check if plt_rep is not "physical" or "sunf" or a basis file
+  if (job.plt_rep != "physical" && job.plt_rep != "sunf" && !ifstream(job.plt_rep.c_str()).good())
+  {
+    cout << "plt representation: " << job.plt_rep << " is not a supported option.\nUse physical or sunf representation or a flavor basis file for plt files." << endl;
+    exit(1);
+  }
+  // check to see if pdg_id is allowed option
+  if (job.pdg_id != 2212 && job.pdg_id != 211 && job.pdg_id != 321)
+  {
+    cout << "pdg_id = " << job.pdg_id << " is not a supported particle.\nUse proton=2212, pi+=211, or K+=321." << endl;
+    exit(1);      
+  }
+} // MCcheckPltOptions -> ==================================================
+
+// lk26 Header line, after the standard ones, of the replicas that a shard writes unshifted
+//      (shard=i/N and nshift != 0); "merge-shards" shifts them and writes them again without it
+const string shardUnshiftedHeader = "MCgenShard: unshifted";
+
+template <class Value>
+void MCformatReplica(string &text, const vector<vector<double>> &xgrid, const vector<vector<double>> &qgrid,
+                     const vector<int> &flavors, const Value &value, bool exact, LHAGrid *replica)
+// Appends the replica file of "generate" to text. value(isub, ix, iq, ifl) is the PDF
+// at the knot (the last x knot is written as 0). With exact, the knots and values are
+// written with all their digits, for the unshifted replicas of a shard. The replica,
+// if given, gets the values as they are read back from the file.
+//========================================================================
+{
+  const int kdigits = exact ? 16 : 6;
+  const int vdigits = exact ? numeric_limits<pdfstore_t>::max_digits10 - 1 : 8;
+  const int vwidth = exact ? vdigits + 9 : 16;
+  char buf[64];
+  int n;
+
+  // Write the header into the .dat file
+  text += "PdfType: central\n";
+  text += "Format: lhagrid1\n";
+  if (exact)
+    text += shardUnshiftedHeader + "\n";
+  text += "---\n";
+
+  //lk23 added routine to perform task for each subgrid when writing to file.
+  for (size_t isub = 0; isub < xgrid.size(); ++isub)
+  {
+    int nqtot = qgrid[isub].size();
+    int nxtot = xgrid[isub].size();
+
+    // Write the x grid into the .dat file
+    for (int ix = 0; ix < nxtot; ++ix)
+    {
+      n = snprintf(buf, sizeof(buf), ix == 0 ? "%.*e" : " %.*e", kdigits, xgrid[isub][ix]);
+      text.append(buf, n);
+    }
+    text += "\n";
+
+    // Write the Q grid into the .dat file
+    for (int iq = 0; iq < nqtot; ++iq)
+    {
+      n = snprintf(buf, sizeof(buf), iq == 0 ? "%.*e" : " %.*e", kdigits, qgrid[isub][iq]);
+      text.append(buf, n);
+    }
+    text += "\n";
+
+    // Write the PDF values into the .dat file
+    for (size_t i = 0; i < flavors.size(); ++i)
+    {
+      n = snprintf(buf, sizeof(buf), "%d ", flavors[i]);
+      text.append(buf, n);
+    }
+    text += "\n";
+
+    for (int ix = 0; ix < nxtot; ++ix)
+    {
+      for (int iq = 0; iq < nqtot; ++iq)
+      {
+        for (size_t ifl = 0; ifl < flavors.size(); ++ifl)
+        {
+          // last point; just write 0
+          const pdfstore_t f = ix == nxtot - 1 ? 0. : value(isub, ix, iq, ifl);
+          n = snprintf(buf, sizeof(buf), "%*.*e", vwidth, vdigits, (double)f);
+          text.append(buf, n);
+          if (replica && ix < nxtot - 1) // read back into the replica in memory
+            replica->subgrid(isub)(ix, iq, ifl) = strtod(buf, NULL);
+        } // for (int ifl=...
+        text += "\n";
+      } // for (int iq
+    } // for (int ix
+
+    text += "---\n";
+  } // for (int isub...
+} // MCformatReplica -> =====================================================
+
+template <class Value>
+void MCwriteReplicaFile(const string &fname, const vector<vector<double>> &xgrid,
+                        const vector<vector<double>> &qgrid, const vector<int> &flavors, const Value &value,
+                        bool exact)
+// Writes a replica file of "generate", see MCformatReplica. Exits if the file cannot
+// be written completely, so merge-shards never renames a truncated file over a replica.
+{
+  string text;
+  MCformatReplica(text, xgrid, qgrid, flavors, value, exact, NULL);
+  ogridstream datfile(fname);
+  if (!datfile.is_open())
+  {
+    cout << "Unable to open file: " << fname << endl;
+    exit(1);
+  }
+  datfile << text;
+  datfile.close(); // exits if a write, the flush, or the close failed
+} // MCwriteReplicaFile -> ==================================================
+
+int MCGenerateLHAPDF(MCjob &job)
 // Generate LHAPDF files for MC replicas
 //========================================================================
 {
 
-  //lk23 added another dimension to xgrid and qgrid to accomodate subgrids.
-  vector<vector<double>> xgrid, qgrid; // Vectors with x and Q values
-  double num, ErrorScaling, pdiff;
+  double num, ErrorScaling;
 
   int nxtot = 0, nqtot = 0, iran, nmcmax;
 
@@ -239,34 +594,38 @@ int MCGenerateLHAPDF()
   ofstream outfile;  // output file stream
   vector<double> rn; // array with random displacements
 
-  // lk23 added another dimension to pdfin, pdfout, mean, and var to accomodate subgrids.
-  vector<vector<vector<vector<vector<double>>>>> pdfin, pdfout;
-  vector<vector<vector<vector<double>>>> mean, var;
+  // lk23 added another dimension to pdfin to accomodate subgrids.
+  // Input PDFs are stored as pdfstore_t (float in the single-precision build).
+  vector<vector<vector<vector<vector<pdfstore_t>>>>> pdfin;
+  PrecisionReport inreport, outreport;
 
   // Prepare random displacements for conversion of Hessian replicas
-  if (strcmp(err_type.c_str(), "he90") == 0)
+  if (strcmp(job.err_type.c_str(), "he90") == 0)
     ErrorScaling = 1 / 1.65;
   else
     ErrorScaling = 1.0;
 
   // Open the LHAPDF6 object for the input PDFs
-  LHAPDF::PDFSet set(inpdfname);
+  LHAPDF::PDFSet set(job.inpdfname);
   const int nmem = set.size() - 1; // number of PDF sets in the input PDF ensemble,
                                    // including the zeroth set
-  vector<LHAPDF::PDF *> pdfs = set.mkPDFs();
+  // lk26 members kept by "mcgen.x serve" are not read again; the members other than 0
+  //      are loaded below if they are evaluated by LHAPDF
+  vector<shared_ptr<LHAPDF::PDF>> pdfs(set.size());
+  pdfs[0] = MCmemberPDF(set, job.inpdfname, 0);
 
   // For Monte-Carlo input replicas, check that the number of required replicas
   // does not exceed the number of input replicas
-  if (strcmp(err_type.c_str(), "mc") == 0)
+  if (strcmp(job.err_type.c_str(), "mc") == 0)
   {
-    nmcmax = nstart + nmc - 1; // maximal number of the input replicas
+    nmcmax = job.nstart + job.nmc - 1; // maximal number of the input replicas
     if (nmcmax > nmem)
     {
       cout << "GenerateMCLHAPDF: The number of final replicas exceeds "
            << "the number of input member sets in the LHAPDF grid" << endl;
       cout << "Number of input member sets = " << nmem;
       cout << "Number of final replicas, # of replicas to skip = "
-           << nmc << ", " << nstart << endl;
+           << job.nmc << ", " << job.nstart << endl;
       exit(1);
     } // if (nmcmax > nmem..
   }   // if err_type == "mc"
@@ -275,13 +634,13 @@ int MCGenerateLHAPDF()
   // randnum_gaussian.dat. The file contains random numbers from a standard
   // normal distribution defined on the interval (-infty, infty).
   string fname = "../inc/randnum_gaussian.dat";
-  if (err_type != "mc")
+  if (job.err_type != "mc")
   {
     // number of random seeds that have been read, to skip at the beginning,
     // and to read in total
     iran = 0;
-    int nskip = (nstart - 1) * nmem;
-    nmcmax = nmc * nmem;
+    int nskip = (job.nstart - 1) * nmem;
+    nmcmax = job.nmc * nmem;
     int nstop = nskip + nmcmax;
 
     infile.open(fname.c_str());
@@ -314,18 +673,14 @@ int MCGenerateLHAPDF()
   int member_index = 0; // 0 corresponds to the central PDF
   const LHAPDF::GridPDF* grid_pdf = dynamic_cast<const LHAPDF::GridPDF*>(set.mkPDF(member_index));
   // const vector<double> x_vals = grid_pdf->xKnots();
-  string gridpath = LHAPDF::findpdfmempath(inpdfname, 0); // returns full path to 0th set of given PDF
-  LHAGrid *grid = new LHAGrid(gridpath); // creates LHAGrid of 0th set to extract Ngrids, x, q values from
-  const int nsub = grid->getNgrids();
-  const vector<vector<double>> x_vals = grid->getxValuesList();
-  const vector<vector<double>> q_vals = grid->getqValuesList();
-
-  // copy values from x_vals and q_vals to xgrid and qgrid
-  for (int isub=0; isub<nsub; ++isub)
-    xgrid.push_back(x_vals[isub]);
-
-  for (int isub=0; isub<nsub; ++isub)
-    qgrid.push_back(q_vals[isub]);
+  string gridpath = LHAPDF::findpdfmempath(job.inpdfname, 0); // returns full path to 0th set of given PDF
+  LHAGrid grid(gridpath); // creates LHAGrid of 0th set to extract Ngrids, x, q values from
+  const int nsub = grid.getNgrids();
+  //lk23 added another dimension to xgrid and qgrid to accomodate subgrids.
+  // lk26 The replicas have the x and Q values of xlhaname and qlhaname of the card in
+  //      every subgrid of the input set (MCoutputKnots), or the knots of the input set.
+  vector<vector<double>> xgrid, qgrid;
+  const bool regrid = MCoutputKnots(job, grid, xgrid, qgrid);
 
   //lk23 write the x, q, and flavors to the output file
    outfile.open("flavor_output.txt");
@@ -357,106 +712,165 @@ int MCGenerateLHAPDF()
   outfile.clear();
   outfile.close();
 
+  // lk26 Output replicas of this run, in the order in which they are sampled:
+  //      0..nmc, or with shard=i/N member 0 and the replicas [first, last) of the
+  //      shard. The mean replica nmc of Hessian input is then written by merge-shards.
+  const bool hessian = job.err_type != "mc";
+  int first = 1, last = job.nmc + 1;
+  if (job.nshards > 0)
+    MCshardRange(job, job.shard, first, last);
+  vector<int> members(1, 0);
+  for (int imc = first; imc < last; ++imc)
+    members.push_back(imc);
+
   // Prepare an array pdfin to store input PDFs (nqtot x nxtot x nfltot)
   pdfin.resize(nsub);
-  pdfout.resize(nsub);
-  mean.resize(nsub);
-  var.resize(nsub);
 
   //lk23 added routine to perform task for each subgrid.
   for (int isub = 0; isub < nsub; ++isub)
   {
-    int nqtot = q_vals[isub].size();
-    int nxtot = x_vals[isub].size();
+    int nqtot = qgrid[isub].size();
+    int nxtot = xgrid[isub].size();
 
     pdfin[isub].resize(nqtot);
-    pdfout[isub].resize(nqtot);
-    mean[isub].resize(nqtot);
-    var[isub].resize(nqtot);
     for (int iq = 0; iq < nqtot; ++iq)
     {
       pdfin[isub][iq].resize(nxtot);
-      pdfout[isub][iq].resize(nxtot);
-      mean[isub][iq].resize(nxtot);
-      var[isub][iq].resize(nxtot);
       for (int ix = 0; ix < nxtot; ++ix)
       {
         pdfin[isub][iq][ix].resize(nfltot);
-        pdfout[isub][iq][ix].resize(nfltot);
-        mean[isub][iq][ix].resize(nfltot);
-        var[isub][iq][ix].resize(nfltot);
         for (int ifl = 0; ifl < nfltot; ++ifl)
         {
           pdfin[isub][iq][ix][ifl].resize(nmem + 1);
-          pdfout[isub][iq][ix][ifl].resize(nmc + 1);
         } // for (int ifl
       } // for (int ix
     } // for (int iq
   } // for (int isub
 
-  // Read the input PDFs into array pdfin
-  int ninput = 0;
+  // Stores the value xf of input member imem at the knot (isub, iq, ix, ifl) into pdfin
+  auto storeInput = [&](int imem, int isub, int iq, int ix, int ifl, double xf, PrecisionReport &report) {
+    if (abs(job.nsym) == 2)
+    { // pn2016 check the positivity, sample the log of the PDF
+      const double x = xgrid[isub][ix];
+      if (xf < 0)
+      {
+        cout << "Error: log-normal sampling requires positive PDFs" << endl;
+        cout << "pid, x, q, xf =" << LHAPDFflavors[ifl] << ", " << x << ", " << qgrid[isub][iq] << ", " << xf
+             << endl;
+        exit(1);
+      }
+      else if (fabs(xf) < small * x)
+        xf = small * x;
 
-  BOOST_FOREACH (LHAPDF::PDF *p, pdfs)
+      xf = log(xf);
+    }
+    // otherwise sample the PDF itself
+    pdfin[isub][iq][ix][ifl][imem] = xf;
+    report.Record(xf, pdfin[isub][iq][ix][ifl][imem]);
+  }; // storeInput
+
+  // lk26 On the knots of the card, the members are interpolated from their knot values by
+  //      the stencils of the LHAPDF interpolation (stencil.h), which are computed once for
+  //      all members: every subgrid of the output from the same subgrid of the input, so the
+  //      values on both sides of a flavor threshold are kept. A member is evaluated on a
+  //      whole output subgrid in sweeps over x and the flavors, and the members run on
+  //      the thread pool. If the stencils are not valid, LHAPDF evaluates the members.
+  const FlavorMap flavormap = PhysicalFlavorMap(LHAPDFflavors);
+  vector<InterpolationStencils> stencils;
+  if (regrid)
   {
-    // lk23 added routine to perform task for each subgrid
+    const LHAPDF::PDFInfo info(job.inpdfname, 0);
     for (int isub = 0; isub < nsub; ++isub)
     {
-      int nqtot = q_vals[isub].size();
-      int nxtot = x_vals[isub].size();
-      for (int iq = 0; iq < nqtot; ++iq)
+      stencils.push_back(MCmakeStencils(info, grid, flavormap, xgrid[isub], qgrid[isub], isub));
+      if (!stencils.back().Valid())
       {
-        double q = qgrid[isub][iq];
+        stencils.clear();
+        break;
+      }
+    }
+  } // if (regrid)
 
-        for (int ix = 0; ix < nxtot; ++ix)
+  // Read the input PDFs into array pdfin
+  if (!stencils.empty())
+  {
+    vector<string> memberfiles(nmem + 1); // read ahead in batches (gridio.h)
+    for (int imem = 0; imem <= nmem; ++imem)
+      memberfiles[imem] = LHAPDF::findpdfmempath(job.inpdfname, imem);
+    GridReadAhead readahead(memberfiles, !LHAGridCache().Enabled());
+    vector<PrecisionReport> reports(nmem + 1);
+    mcgenPool().parallelFor(nmem + 1, [&](size_t imem) {
+      readahead.Need(imem);
+      const LHAGrid member(memberfiles[imem]);
+      stencils[0].CheckMember(member); // all stencils have the layout of member 0
+      vector<double> xfcells, xfout;
+      for (int isub = 0; isub < nsub; ++isub)
+      {
+        const int nxtot = xgrid[isub].size();
+        for (int iq = 0; iq < (int)qgrid[isub].size(); ++iq)
         {
-          double x = xgrid[isub][ix];
-
-          for (int ifl = 0; ifl < nfltot; ++ifl)
-          {
+          MCevaluateFlavors(stencils[isub], member, flavormap, iq, xfcells, xfout);
+          for (int ix = 0; ix < nxtot; ++ix)
+            for (int ifl = 0; ifl < nfltot; ++ifl)
+              storeInput(imem, isub, iq, ix, ifl, xfout[ifl * nxtot + ix], reports[imem]);
+        }
+      }
+    });
+    for (int imem = 0; imem <= nmem; ++imem)
+      inreport.Merge(reports[imem]);
+  }
+  else
+  {
+    for (size_t imem = 1; imem < pdfs.size(); imem++)
+      pdfs[imem] = MCmemberPDF(set, job.inpdfname, imem);
+    int ninput = 0;
 
-            int pid = LHAPDFflavors[ifl];
-            double xf = p->xfxQ(pid, x, q);
-            if (abs(nsym) == 2)
-            { // pn2016 check the positivity, sample the log of the PDF
-              if (xf < 0)
-              {
-                cout << "Error: log-normal sampling requires positive PDFs" << endl;
-                cout << "pid, x, q, xf =" << pid << ", " << x << ", " << q << ", " << xf << endl;
-                exit(1);
-              }
-              else if (fabs(xf) < small * x)
-                xf = small * x;
-
-              pdfin[isub][iq][ix][ifl][ninput] = log(xf);
-            }
-            else // sample the PDF itself
-              pdfin[isub][iq][ix][ifl][ninput] = xf;
+    BOOST_FOREACH (shared_ptr<LHAPDF::PDF> &p, pdfs)
+    {
+      // lk23 added routine to perform task for each subgrid
+      for (int isub = 0; isub < nsub; ++isub)
+      {
+        int nqtot = qgrid[isub].size();
+        int nxtot = xgrid[isub].size();
+        for (int iq = 0; iq < nqtot; ++iq)
+        {
+          double q = qgrid[isub][iq];
 
-          } // for (int ifl
-        } //  for (int ix
-      } // for (int iq=0
-    } // for (int isub
+          for (int ix = 0; ix < nxtot; ++ix)
+          {
+            double x = xgrid[isub][ix];
 
-    // pn 2017
-    // cout << "g(0.15,1.3) ="  << pdfin[0][95][nfltot-1][ninput] << endl;
-    ninput++;
+            for (int ifl = 0; ifl < nfltot; ++ifl)
+              storeInput(ninput, isub, iq, ix, ifl, p->xfxQ(LHAPDFflavors[ifl], x, q), inreport);
+          } //  for (int ix
+        } // for (int iq=0
+      } // for (int isub
 
-    delete p;
-  } // foreach (LHAPDF::PDF* p, pdfs)
+      // pn 2017
+      // cout << "g(0.15,1.3) ="  << pdfin[0][95][nfltot-1][ninput] << endl;
+      ninput++;
 
-  // Create LHAPDF6 .dat file for each final MC replica.
-  // imc denotes the ID of the output MC replica. The zeroth output replica,
-  // corresponding to imc=0, is just the copied zeroth set of the input set
-  iran = 0;
-  outfile.open("MC_distances.txt"); // lk24 create header for distance output file
-  outfile << "# iMC\td" << endl;
-  for (int imc = 0; imc < nmc + 1; ++imc)
-  {
+      p.reset();
+    } // foreach (LHAPDF::PDF* p, pdfs)
+  }
 
-    double rr[nmem / 2];
+  // lk26 A replica is kept in one array: the knots ix < nxtot-1 of every subgrid
+  //      (ix = nxtot-1 always gives pdf=0), then iq, then the flavor
+  vector<size_t> offset(nsub + 1, 0);
+  for (int isub = 0; isub < nsub; ++isub)
+    offset[isub + 1] = offset[isub] + (xgrid[isub].size() - 1) * qgrid[isub].size() * nfltot;
+  const size_t npoints = offset[nsub];
+  auto point = [&](int isub, int ix, int iq, int ifl) {
+    return offset[isub] + (ix * qgrid[isub].size() + iq) * nfltot + ifl;
+  };
+
+  // lk26 Replica imc takes the random displacements rr[1..nmem/2] from
+  //      rn[imc*(nmem/2)] on, so a shard generates the same replicas as the run
+  //      over all of them.
+  auto replicaDistance = [&](int imc, double rr[]) {
+    int iran = imc * (nmem / 2);
     double Dout = 0;
-    if (err_type != "mc")
+    if (job.err_type != "mc")
       //lk24 included routine to print out the D=(1/sqrt(nmem))Sum(rr[imem]^2) for each replica.
       for (int imem = 1; imem <= nmem / 2; imem++)
       {
@@ -465,201 +879,334 @@ int MCGenerateLHAPDF()
       }
     double Dout_norm = sqrt( 1. / (nmem / 2.) );
     Dout *= Dout_norm * Dout; // lk24 multiply Dout by (1 / sqrt(nmem/2) ) 
-    
-    outfile << imc << "\t" << Dout << endl;
-    
+    return Dout;
+  };
+
+  // Output replica imc, in the sampled variable (log of the PDF for log-normal sampling).
+  // The zeroth output replica, corresponding to imc=0, is just the copied zeroth set
+  // of the input set
+  auto sampleReplica = [&](int imc, const double rr[], vector<double> &y, PrecisionReport &report) {
+    size_t ip = 0;
     // lk23 added routine to perform task for each subgrid
     for (int isub = 0; isub < nsub; ++isub)
     {
-      int nqtot = q_vals[isub].size();
-      int nxtot = x_vals[isub].size();
+      int nqtot = qgrid[isub].size();
+      int nxtot = xgrid[isub].size();
 
       for (int ix = 0; ix < nxtot - 1; ++ix)
       { // ix=nxtot always gives pdf=0 below
         for (int iq = 0; iq < nqtot; ++iq)
         {
 
-          for (int ifl = 0; ifl < nfltot; ++ifl)
+          for (int ifl = 0; ifl < nfltot; ++ifl, ++ip)
           {
+            const vector<pdfstore_t> &fin = pdfin[isub][iq][ix][ifl];
 
-            if (strcmp(err_type.c_str(), "mc") == 0) // input MC replicas:
+            if (strcmp(job.err_type.c_str(), "mc") == 0) // input MC replicas:
             // copy a replica with an offset and finish the cycle
             {
-              pdfout[isub][iq][ix][ifl][imc] = pdfin[isub][iq][ix][ifl][imc + nstart - 1];
+              y[ip] = fin[imc + job.nstart - 1];
               continue;
             } // input MC replicas
 
             // Generate Hessian replicas
             if (imc == 0) // zeroth output replica = zeroth input replica
             {
-              pdfout[isub][iq][ix][ifl][imc] = pdfin[isub][iq][ix][ifl][0];
-              mean[isub][iq][ix][ifl] = 0.0; // Start accumulating mean
-              var[isub][iq][ix][ifl] = 0.0;  // and variance
-            }
-            else if (imc < nmc)
-            {
-              double f0, fm, fp, df1, df2, pout[15];
-              f0 = pdfin[isub][iq][ix][ifl][0];
-              pout[ifl] = f0;
-
-              for (int l = 1; l <= nmem / 2; l++)
-              {
-                fm = pdfin[isub][iq][ix][ifl][2 * l - 1];
-                fp = pdfin[isub][iq][ix][ifl][2 * l];
-
-                if (nsym == -3)
-                {                // Watt-Thorne'2012 asym. error
-                  if (rr[l] > 0) // choose positive error
-                    pdiff = fp - f0;
-                  else // choose negative error
-                    pdiff = fm - f0;
-                  pout[ifl] += pdiff * fabs(rr[l]);
-                  continue;
-                } // nsym == -3
-
-                // Default CT sequence: an estimate of the first derivative
-                df1 = (fp - fm) / 2.0;
-                pout[ifl] += df1 * rr[l];
-
-                if (nsym < 0) // asymmetric errors;
-                {             // add an estimate of the second derivative
-                  df2 = fp + fm - 2 * f0;
-                  pout[ifl] += 0.5 * df2 * rr[l] * rr[l];
-                } // asymmetric errors
-                // pn 2017
-                // if (ix == 95 && iq==0 && ifl == nfltot-1)
-                //   cout << "imc, l, f0, fm, fp, rr, df, = "<<imc << " "<<l<<" "
-                //        <<f0<<" "<<fm<<" "<<fp<<" "<<rr[l]<<" "<<
-                //     df1*rr[l]+0.5*df2*rr[l]*rr[l]<<endl;
-
-              } // for (int l=1...
-
-              pdfout[isub][iq][ix][ifl][imc] = pout[ifl];
-              mean[isub][iq][ix][ifl] += pout[ifl];            // accumulate the mean replica
-              var[isub][iq][ix][ifl] += pout[ifl] * pout[ifl]; // and the variance
+              y[ip] = fin[0];
+              continue;
             }
-            else // imc = nmc; apply shifts if requested;
-                 // the last MC replica is the mean of all previous replicas
-            {
-              mean[isub][iq][ix][ifl] /= nmc;
-              var[isub][iq][ix][ifl] = var[isub][iq][ix][ifl] / nmc - mean[isub][iq][ix][ifl] * mean[isub][iq][ix][ifl];
-              pdfout[isub][iq][ix][ifl][imc] = mean[isub][iq][ix][ifl];
 
-              if (nshift != 0)
-                for (int jmc = 1; jmc < nmc + 1; ++jmc)
-                {
-                  double shift = pdfout[isub][iq][ix][ifl][0] - mean[isub][iq][ix][ifl];
-                  if (abs(nsym) == 2) // additional contribution for the log shift
-                    shift -= var[isub][iq][ix][ifl] / 2;
-
-                  pdfout[isub][iq][ix][ifl][jmc] += shift;
-                } // if(nshift != 0)
-            }     // imc = nmc -1
+            double f0, fm, fp, df1, df2, pout, pdiff;
+            f0 = fin[0];
+            pout = f0;
 
+            for (int l = 1; l <= nmem / 2; l++)
+            {
+              fm = fin[2 * l - 1];
+              fp = fin[2 * l];
+
+              if (job.nsym == -3)
+              {                // Watt-Thorne'2012 asym. error
+                if (rr[l] > 0) // choose positive error
+                  pdiff = fp - f0;
+                else // choose negative error
+                  pdiff = fm - f0;
+                pout += pdiff * fabs(rr[l]);
+                continue;
+              } // nsym == -3
+
+              // Default CT sequence: an estimate of the first derivative
+              df1 = (fp - fm) / 2.0;
+              pout += df1 * rr[l];
+
+              if (job.nsym < 0) // asymmetric errors;
+              {             // add an estimate of the second derivative
+                df2 = fp + fm - 2 * f0;
+                pout += 0.5 * df2 * rr[l] * rr[l];
+              } // asymmetric errors
+            } // for (int l=1...
+
+            y[ip] = pout;
+            const pdfstore_t stored = pout;
+            report.Record(pout, stored);
           } // for (int ifl=...
         } // for (int iq
       } // for (int ix
     } // for (int isub
-  } // for (int imc #1...
-  outfile.clear(); // lk24 clear and close outfile after finishing imc loop
-  outfile.close();
+  }; // sampleReplica
 
   // Create LHAPDF6 .dat file for each final MC replica.
-  // imc denotes the ID of the output MC replica. The zeroth output replica,
-  // corresponding to imc=-1, is just the copied zeroth set of the input set
-  for (int imc = 0; imc < nmc + 1; ++imc)
+  // The files are compressed if requested by MCGEN_COMPRESS (.dat.gz, .dat.zst).
+  // lk26 With keepReplicas ("pipeline"), the files are written into the set directory
+  //      outpdfname/, and every replica is also kept in LHAGridCache() as the grid
+  //      that would be parsed from its file: the knots and values are rounded to the
+  //      digits that are written. Convert and std_devs then take the replicas from
+  //      memory instead of reading them again.
+  const string datext = gridFileExtension();
+  const string datprefix = job.keepReplicas ? job.outpdfname + "/" + job.outpdfname : job.outpdfname;
+  vector<string> replicaheaders;
+  vector<vector<double>> replicax(nsub), replicaq(nsub);
+  const vector<vector<int>> replicaflavors(nsub, LHAPDFflavors);
+  if (job.keepReplicas)
   {
-
-    // Generate the name of the .dat file
-    if (imc < 10)
+    replicaheaders.push_back("PdfType: central");
+    replicaheaders.push_back("Format: lhagrid1");
+    for (int isub = 0; isub < nsub; ++isub)
     {
-      fname = outpdfname + "_000" + boost::lexical_cast<string>(imc) + ".dat";
+      for (size_t ix = 0; ix < xgrid[isub].size(); ++ix)
+        replicax[isub].push_back(MCroundAsWritten(xgrid[isub][ix], 6));
+      for (size_t iq = 0; iq < qgrid[isub].size(); ++iq)
+        replicaq[isub].push_back(MCroundAsWritten(qgrid[isub][iq], 6));
     }
-    else if (imc < 100)
+  }
+
+  // lk26 The replicas are sampled and formatted on the thread pool, up to nahead
+  //      replicas ahead of the one whose mean and variance are accumulated here (in
+  //      the order of imc, so the sums do not depend on the threads), and the
+  //      formatted files are written by the writer thread while the next replicas
+  //      are sampled. Replicas that need the shift of nshift, which needs the mean
+  //      of all replicas, are kept until all are sampled and then formatted in the
+  //      same way. The queue of the writer bounds the memory; the buffers of the
+  //      sampled values and of the formatted files are reused.
+  struct SampledReplica
+  {
+    vector<double> y;
+    double distance = 0.;
+    PrecisionReport report;
+    string *text = NULL;
+    shared_ptr<LHAGrid> replica;
+  };
+  ThreadPool &pool = mcgenPool();
+  const int nahead = 2 * pool.size();
+  GridFileWriter writer(nahead);
+  vector<SampledReplica *> spare;
+  mutex spareMutex;
+
+  // replicas written by this run, and those that wait for the shift; the mean
+  // replica nmc of Hessian input is not sampled
+  auto written = [&](int imc) { return imc > 0 || job.shard <= 1; };
+  auto waitsForShift = [&](int imc) { return hessian && job.nshift != 0 && job.nshards == 0 && imc > 0; };
+  const bool unshifted = job.nshards > 0 && job.nshift != 0 && hessian; // shifted by merge-shards
+  const int nsampled = hessian && job.nshards == 0 ? members.size() - 1 : members.size();
+
+  // Formats a replica, given by value(isub, ix, iq, ifl), into a buffer of the writer
+  auto formatReplica = [&](const function<pdfstore_t(int, int, int, int)> &value, bool exact,
+                           string *&text, shared_ptr<LHAGrid> &replica) {
+    text = writer.Buffer();
+    if (job.keepReplicas)
+      replica.reset(new LHAGrid(replicaheaders, replicax, replicaq, replicaflavors));
+    MCformatReplica(*text, xgrid, qgrid, LHAPDFflavors, value, exact, replica.get());
+  };
+  auto writeReplica = [&](int imc, string *text, shared_ptr<LHAGrid> replica) {
+    const string fname = MCreplicaFileName(datprefix, imc, datext);
+    writer.Write(fname, text, [fname, replica] {
+      if (replica)
+        LHAGridCache().Insert(fname, cacheStampOf(fname), replica, replica->Bytes());
+    });
+  };
+
+  auto sampleTask = [&](int k) {
+    SampledReplica *s = NULL;
     {
-      fname = outpdfname + "_00" + boost::lexical_cast<string>(imc) + ".dat";
+      lock_guard<mutex> lock(spareMutex);
+      if (!spare.empty())
+      {
+        s = spare.back();
+        spare.pop_back();
+      }
     }
-    else if (imc < 1000)
+    if (s == NULL)
+      s = new SampledReplica;
+    const int imc = members[k];
+    vector<double> rr(nmem / 2 + 1); // lk26 rr[1..nmem/2]
+    s->distance = replicaDistance(imc, rr.data());
+    s->report = PrecisionReport();
+    s->y.resize(npoints);
+    sampleReplica(imc, rr.data(), s->y, s->report);
+    if (written(imc) && !waitsForShift(imc))
     {
-      fname = outpdfname + "_0" + boost::lexical_cast<string>(imc) + ".dat";
+      const bool exact = unshifted && imc > 0;
+      formatReplica(
+          [&](int isub, int ix, int iq, int ifl) {
+            pdfstore_t f = s->y[point(isub, ix, iq, ifl)];
+            if (abs(job.nsym) == 2 && !exact) // log-normal sampling
+              f = exp(f);
+            return f;
+          },
+          exact, s->text, s->replica);
     }
-    else
+    return s;
+  }; // sampleTask
+
+  vector<double> mean(npoints, 0.), var(npoints, 0.); // accumulated in double
+  vector<vector<pdfstore_t>> waiting(nsampled);       // replicas that wait for the shift
+  vector<future<SampledReplica *>> sampled(nsampled);
+  // lk24 create header for distance output file
+  outfile.open(job.nshards > 0 ? MCshardFileName(job, job.shard, "_distances.txt").c_str() : "MC_distances.txt");
+  outfile << "# iMC\td" << endl;
+  int nsubmitted = 0;
+  for (int k = 0; k < nsampled; ++k)
+  {
+    for (; nsubmitted < nsampled && nsubmitted <= k + nahead; nsubmitted++)
     {
-      fname = outpdfname + "_" + boost::lexical_cast<string>(imc) + ".dat";
+      const int kk = nsubmitted;
+      sampled[kk] = pool.submit([&sampleTask, kk] { return sampleTask(kk); });
     }
-
-    // Write the header into the .dat file
-    outfile.open(fname.c_str());
-    outfile << "PdfType: central" << endl;
-    outfile << "Format: lhagrid1" << endl;
-    outfile << "---" << endl;
-
-    //lk23 added routine to perform task for each subgrid when writing to file.
-    for (int isub = 0; isub < nsub; ++isub)
-    {
-      int nqtot = q_vals[isub].size();
-      int nxtot = x_vals[isub].size();
-
-      // Write the x grid into the .dat file
-      for (int ix = 0; ix < nxtot; ++ix)
+    SampledReplica *s = sampled[k].get();
+    const int imc = members[k];
+    if (written(imc))
+      outfile << imc << "\t" << s->distance << endl;
+    outreport.Merge(s->report);
+
+    if (hessian && imc > 0)
+      for (size_t ip = 0; ip < npoints; ++ip)
       {
-        if (ix == 0)
-          outfile << scientific << setprecision(6) << xgrid[isub][ix];
-        else
-          outfile << " " << scientific << setprecision(6) << xgrid[isub][ix];
+        mean[ip] += s->y[ip]; // accumulate the mean replica
+        var[ip] += s->y[ip] * s->y[ip]; // and the variance
       }
+    if (s->text != NULL)
+      writeReplica(imc, s->text, s->replica);
+    else if (waitsForShift(imc))
+      waiting[k].assign(s->y.begin(), s->y.end());
+    s->text = NULL;
+    s->replica.reset();
+
+    lock_guard<mutex> lock(spareMutex);
+    spare.push_back(s);
+  } // for (int k = 0...
+  for (size_t i = 0; i < spare.size(); i++)
+    delete spare[i];
+  spare.clear();
+
+  // the distance of the mean replica
+  if (hessian && (job.nshards == 0 || job.shard == job.nshards))
+  {
+    vector<double> rr(nmem / 2 + 1);
+    outfile << job.nmc << "\t" << replicaDistance(job.nmc, rr.data()) << endl;
+  }
+  outfile.clear(); // lk24 clear and close outfile after finishing imc loop
+  outfile.close();
 
-      outfile << endl;
-
-      // Write the Q grid into the .dat file
-      for (int iq = 0; iq < nqtot; ++iq)
-      {
-        if (iq == 0)
-          outfile << scientific << setprecision(6) << qgrid[isub][iq];
-        else
-          outfile << " " << scientific << setprecision(6) << qgrid[isub][iq];
-      }
-      outfile << endl;
+  inreport.Print("the input PDFs");
+  outreport.Print("the MC replicas");
 
-      // Write the PDF values into the .dat file
-      for (int i = 0; i < nfltot; ++i)
-        outfile << LHAPDFflavors[i] << " ";
-      outfile << endl;
+  // lk26 A shard writes the sums of its replicas for merge-shards: member 0, the sum,
+  //      and the sum of squares at every knot, in hexadecimal to keep all digits
+  if (job.nshards > 0)
+  {
+    outfile.open(MCshardFileName(job, job.shard, ".stats").c_str());
+    outfile << "# mcgen.x generate " << job.cardname << " shard=" << job.shard << "/" << job.nshards << endl;
+    outfile << "Shard: " << job.shard << "/" << job.nshards << endl;
+    outfile << "Replicas: " << first << " " << last << endl;
+    outfile << "Card: " << MCshardCardSignature(job) << endl;
+    outfile << "Points: " << (hessian ? npoints : 0) << endl;
+    for (int isub = 0; isub < nsub && hessian; ++isub)
+      for (size_t ix = 0; ix + 1 < xgrid[isub].size(); ++ix)
+        for (size_t iq = 0; iq < qgrid[isub].size(); ++iq)
+          for (int ifl = 0; ifl < nfltot; ++ifl)
+          {
+            const size_t ip = point(isub, ix, iq, ifl);
+            char line[128];
+            snprintf(line, sizeof(line), "%a %a %a", (double)pdfin[isub][iq][ix][ifl][0], mean[ip], var[ip]);
+            outfile << line << "\n";
+          }
+    outfile.close();
+    if (!outfile)
+    {
+      cout << "GenerateMCLHAPDF: cannot write " << MCshardFileName(job, job.shard, ".stats") << endl;
+      exit(1);
+    }
+  } // if (job.nshards > 0)
 
-      for (int ix = 0; ix < nxtot; ++ix)
-      {
-        for (int iq = 0; iq < nqtot; ++iq)
-        {
+  // imc = nmc; apply shifts if requested;
+  // the last MC replica is the mean of all previous replicas
+  if (hessian && job.nshards == 0)
+  {
+    vector<double> shift(npoints, 0.);
+    vector<pdfstore_t> meanreplica(npoints);
+    for (int isub = 0; isub < nsub; ++isub)
+      for (size_t ix = 0; ix + 1 < xgrid[isub].size(); ++ix)
+        for (size_t iq = 0; iq < qgrid[isub].size(); ++iq)
           for (int ifl = 0; ifl < nfltot; ++ifl)
           {
+            const size_t ip = point(isub, ix, iq, ifl);
+            mean[ip] /= job.nmc;
+            var[ip] = var[ip] / job.nmc - mean[ip] * mean[ip];
+            meanreplica[ip] = mean[ip];
 
-            if (ix == (nxtot - 1))
-            { // last point; just write 0
-              outfile << setw(16) << scientific << setprecision(8) << 0.0;
-              continue;
+            if (job.nshift != 0)
+            {
+              shift[ip] = pdfin[isub][iq][ix][ifl][0] - mean[ip];
+              if (abs(job.nsym) == 2) // additional contribution for the log shift
+                shift[ip] -= var[ip] / 2;
+              meanreplica[ip] += shift[ip];
             }
+          }
 
-            if (abs(nsym) == 2) // log-normal sampling
-              pdfout[isub][iq][ix][ifl][imc] = exp(pdfout[isub][iq][ix][ifl][imc]);
-
-            outfile << setw(16) << scientific << setprecision(8) << pdfout[isub][iq][ix][ifl][imc];
-          } // for (int ifl=...
-          outfile << endl;
-        } // for (int iq
-      } // for (int ix
-
-      outfile << "---" << endl;
-    } // for (int isub...
-
-    outfile.clear();
-    outfile.close();
-
-  } // for (int imc #2...
+    // the replicas that waited for the shift (k = 1..nsampled-1), then the mean
+    // replica (k = nsampled), formatted on the thread pool in the same way
+    typedef pair<string *, shared_ptr<LHAGrid>> FormattedReplica;
+    auto formatTask = [&](int k) {
+      FormattedReplica out(NULL, shared_ptr<LHAGrid>());
+      const vector<pdfstore_t> &f = k < nsampled ? waiting[k] : meanreplica;
+      formatReplica(
+          [&](int isub, int ix, int iq, int ifl) {
+            pdfstore_t fout = f[point(isub, ix, iq, ifl)];
+            if (k < nsampled)
+              fout += shift[point(isub, ix, iq, ifl)];
+            if (abs(job.nsym) == 2) // log-normal sampling
+              fout = exp(fout);
+            return fout;
+          },
+          false, out.first, out.second);
+      if (k < nsampled)
+        vector<pdfstore_t>().swap(waiting[k]);
+      return out;
+    };
+    vector<int> remaining;
+    for (int k = 1; k < nsampled; ++k)
+      if (waitsForShift(members[k]))
+        remaining.push_back(k);
+    remaining.push_back(nsampled);
+    vector<future<FormattedReplica>> formatted(remaining.size());
+    nsubmitted = 0;
+    for (size_t i = 0; i < remaining.size(); ++i)
+    {
+      for (; nsubmitted < (int)remaining.size() && nsubmitted <= (int)i + nahead; nsubmitted++)
+      {
+        const int k = remaining[nsubmitted];
+        formatted[nsubmitted] = pool.submit([&formatTask, k] { return formatTask(k); });
+      }
+      FormattedReplica out = formatted[i].get();
+      writeReplica(members[remaining[i]], out.first, out.second);
+    }
+  } // if (hessian && job.nshards == 0)
 
+  writer.Finish();
   return 0;
 } // MCGenerateLHAPDF -> ===================================================
 
-int MCLHAPDF2plt()
+int MCLHAPDF2plt(MCjob &job)
 // Convert LHAPDF files into .plt files
 //========================================================================
 {
@@ -670,18 +1217,21 @@ int MCLHAPDF2plt()
 
   ifstream infile;  // input file stream
   ofstream outfile; // output file streams
-  string fname;
 
-  vector<vector<vector<vector<double>>>> pdfin; // stores input PDFs
+  PrecisionReport report;
 
   // Open the LHAPDF6 object for the input PDFs
-  LHAPDF::PDFSet set(inpdfname);
-  vector<LHAPDF::PDF *> pdfs = set.mkPDFs();
+  // lk26 the members are loaded one at a time when they are converted
+  LHAPDF::PDFSet set(job.inpdfname);
   const int nmem = set.size() - 1; // number of PDF sets in the input PDF ensemble,
   // including the zeroth set
+  int member_index = 0; // 0 corresponds to the central PDF
+  // lk26 member 0 is shared with the other steps of "mcgen.x pipeline"
+  const shared_ptr<LHAPDF::PDF> pdf0 = MCmemberPDF(set, job.inpdfname, member_index);
+  const LHAPDF::GridPDF* grid_pdf = dynamic_cast<const LHAPDF::GridPDF *>(pdf0.get());
 
   // lk23 pull flavors from grid
-  std::vector<int> inflavors = pdfs[0]->flavors();
+  std::vector<int> inflavors = grid_pdf->flavors();
   // PDF flavors to write to the LHAPDF grid
   int nfltot = inflavors.size(); // Maximal number of PDF flavors
   // lk24 created to match META representation
@@ -728,8 +1278,6 @@ int MCLHAPDF2plt()
   int nxintot = 0, nqintot = 0;
 
   // lk24 Get the x and q2 values from the 0th LHAgrid and print out values in external file
-  int member_index = 0; // 0 corresponds to the central PDF
-  const LHAPDF::GridPDF* grid_pdf = dynamic_cast<const LHAPDF::GridPDF *>(set.mkPDF(member_index));
   const vector<double> xin_vals = grid_pdf->xKnots();
 
   nxintot = xin_vals.size();
@@ -754,7 +1302,7 @@ int MCLHAPDF2plt()
 
   // lk24 read x adn q values from external file xpltname qpltname
   //Read hardwired x values for .plt files
-  infile.open(xpltname.c_str());
+  infile.open(job.xpltname.c_str());
 
   while (infile.good()) {  
     infile >> num;
@@ -765,7 +1313,7 @@ int MCLHAPDF2plt()
   infile.close();
 
   //Read hardwired Q values for the .plt grid
-  infile.open(qpltname.c_str());
+  infile.open(job.qpltname.c_str());
   while (infile >> num) {  
     qgrid.push_back(num);
     nqtot++;
@@ -774,7 +1322,7 @@ int MCLHAPDF2plt()
   infile.close();
 
   //lk25 added LHAPDF::Info object to track if optional parameters are defined (i.e. mc,mb,mt, mz, pdg id)
-  const LHAPDF::PDFInfo info(inpdfname,0);
+  const LHAPDF::PDFInfo info(job.inpdfname,0);
   
   // lk24 parse mc, mb, mt, alphas_MZ, MZ, alphas_OrderQCD, NumFlavors, and OrderQCD using get_entry()   
   // parse mandatory flags from .info file
@@ -793,12 +1341,12 @@ int MCLHAPDF2plt()
   string mzin = getLHAInfoValue(info, "MZ");
   string pdg_idstr = getLHAInfoValue(info, "Particle");
   if (pdg_idstr != "Particle")
-    pdg_id = stoi(pdg_idstr);
+    job.pdg_id = stoi(pdg_idstr);
     
   // lk25 commented out config file
   /*
   // lk24 write the xin, qin, and flavors to the output file
-  outfile.open(inpdfname + "_mp4lhc_gridgen.config");
+  outfile.open(job.inpdfname + "_mp4lhc_gridgen.config");
   outfile << "# mc  mb  mt  alphas_mZ  mZ  alphas_order  Nfl  Order_QCD" << endl;
   outfile << mcin << "  " << mbin << "  " << mtin << "  " << alphasMZin << "  " << mzin << "  " << alphas_orderin << "  " << NumFlavsin << "  " << orderqcdin << endl;
   outfile << "# flavors: " << endl;
@@ -819,11 +1367,11 @@ int MCLHAPDF2plt()
   */
 
   // lk25 create .mev file v.2025-02 from Pavel
-  outfile.open(inpdfname + ".mev_header");
-  outfile << "#v.2025-02# .mev file created from " + inpdfname + "LHAPDF set" << endl;
+  outfile.open(job.inpdfname + ".mev_header");
+  outfile << "#v.2025-02# .mev file created from " + job.inpdfname + "LHAPDF set" << endl;
   outfile << orderqcdin << ", " << Q0in << ", " << alphasMZin << ", " << mzin << " # QCD order ,Q0 (GeV), alphas(MZ), MZ" << endl;
   outfile << mcin << ", " << mbin << ", " << mtin << " # mcharm, mbottom, mtop (GeV)" << endl;
-  outfile << NEVin << ", " << pdg_id << " # Number of EV sets, PDG hadron ID (2212=proton, 211=pi+)" << endl;
+  outfile << NEVin << ", " << job.pdg_id << " # Number of EV sets, PDG hadron ID (2212=proton, 211=pi+)" << endl;
   outfile << "# Flavors in the LHAPDF grid and compressed META representation" << endl;
   for (int i = 0; i < nfltot-1; i++)
     outfile << inflavors[i] << ", ";
@@ -901,190 +1449,164 @@ int MCLHAPDF2plt()
     }
   }
   */
-  // set number of flavors to 11 if using SU(Nf) representation. Otherwise, use the max allowed physical flavors from LHA grid.
-  if (plt_rep == "sunf")
-    nfltot = 11;
-
-  // Prepare an array pdfin to store input PDFs (nqtot x nxtot x nfltot)
-  pdfin.resize(nqtot);
-
-  for (int iq = 0; iq < nqtot; ++iq)
-  {
-    pdfin[iq].resize(nxtot);
-
-    for (int ix = 0; ix < nxtot; ++ix)
+  // lk26 The output flavors are a linear map of the PDFs of all partons:
+  //      the physical flavors, the SU(Nf) representation, or a basis read from the file plt_rep
+  FlavorMap flavormap;
+  if (job.plt_rep == "physical")
+    flavormap = PhysicalFlavorMap(outflavors);
+  else if (job.plt_rep == "sunf")
+    flavormap = SUNfFlavorMap(job.pdg_id);
+  else
+    flavormap = ReadFlavorMap(job.plt_rep);
+  // number of output flavors
+  nfltot = flavormap.NumOutputs();
+
+  // Weight of the .plt values, 3 x^(2/3)
+  vector<double> xweight(nxtot);
+  for (int ix = 0; ix < nxtot; ++ix)
+    xweight[ix] = 3. * pow(xgrid[ix], 2. / 3.);
+
+  // lk26 The knot search and the interpolation weights of the output points are the
+  //      same for all members; they are computed once from the knots of member 0.
+  const LHAGrid layout(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const InterpolationStencils stencils = MCmakeStencils(info, layout, flavormap, xgrid, qgrid);
+
+  // lk26 Each .plt file depends on one member only. The conversion is split
+  //      into tasks (member, block of Q values) that run on the thread pool; the
+  //      threads take the tasks in the order of the members, so only the members
+  //      being converted are held in memory. The task that finishes the last block of a member
+  //      formats and writes its .plt file. The files do not depend on the number
+  //      of threads. Every task reads the knot values of its member and applies the
+  //      stencils, or it loads an LHAPDF object of the member if the stencils are not
+  //      valid. The flavor map is applied to a row of x values.
+  //      Member 0 was loaded on this thread above, which fills the caches of
+  //      LHAPDF before PDF objects are created on several threads.
+  ThreadPool &pool = mcgenPool();
+  const int nplt = nmem + 1; // number of .plt files
+  // split Q only if there are too few members to keep the threads busy
+  const int nqblocks = min(nqtot, max(1, (int)(2 * pool.size() + nplt - 1) / nplt));
+  const int nqblock = (nqtot + nqblocks - 1) / nqblocks; // Q values per block
+
+  // PDF values of member imc, pdfmem[imc][(iq*nxtot + ix)*nfltot + ifl]
+  vector<vector<pdfstore_t>> pdfmem(nplt);
+  vector<atomic<int>> nblocksleft(nplt);
+  for (int imc = 0; imc < nplt; ++imc)
+    nblocksleft[imc] = nqblocks;
+  mutex convertMutex; // guards the allocation of pdfmem and the report
+
+  // lk26 The member grids are read ahead in batches, and the .plt files are
+  //      written in batches by a writer thread (gridio.h; batched on io_uring
+  //      with IO_URING=yes).
+  vector<string> memberfiles;
+  for (int imc = 0; imc < nplt && stencils.Valid(); ++imc)
+    memberfiles.push_back(LHAPDF::findpdfmempath(job.inpdfname, imc));
+  GridReadAhead readahead(memberfiles, !LHAGridCache().Enabled());
+  GridFileWriter pltwriter(2 * pool.size());
+
+  pool.parallelFor(nplt * nqblocks, [&](size_t itask) {
+    const int imc = itask / nqblocks;
+    const int iq0 = (itask % nqblocks) * nqblock, iq1 = min(nqtot, iq0 + nqblock);
+    pdfstore_t *values;
     {
-      pdfin[iq][ix].resize(nfltot);
-
-      for (int ifl = 0; ifl < nfltot; ++ifl)
-      {
-        pdfin[iq][ix][ifl].resize(nmem + 1);
-      } // for (int ifl
-    } // for (int ix
-  } // for (int iq
+      lock_guard<mutex> lock(convertMutex);
+      if (pdfmem[imc].empty())
+	pdfmem[imc].resize(nqtot * nxtot * nfltot);
+      values = pdfmem[imc].data();
+    }
 
-  // Read the input PDFs into array pdfin
-  int ninput = 0;
-  BOOST_FOREACH (LHAPDF::PDF *p, pdfs)
-  {
-    for (int iq = 0; iq < nqtot; ++iq)
+    PrecisionReport taskreport;
+    vector<double> xfcells, xfout;
+    LHAGrid *member = NULL;
+    LHAPDF::PDF *p = NULL;
+    if (stencils.Valid())
+    {
+      readahead.Need(imc);
+      member = new LHAGrid(memberfiles[imc]);
+      stencils.CheckMember(*member);
+    }
+    else
+      p = set.mkPDF(imc);
+    for (int iq = iq0; iq < iq1; ++iq)
     {
-      double q = qgrid[iq];
+      if (member)
+	MCevaluateFlavors(stencils, *member, flavormap, iq, xfcells, xfout);
+      else
+	MCevaluateFlavors(p, flavormap, xgrid, qgrid[iq], xfcells, xfout);
       for (int ix = 0; ix < nxtot; ++ix)
       {
-	double x = xgrid[ix];
 	for (int ifl = 0; ifl < nfltot; ++ifl)
 	{
-	  double xf;
-	  if (plt_rep == "physical")
-	  {
-	    int pid = outflavors[ifl];
-	    xf = p->xfxQ(pid, x, q);
-	  }
-	  if (plt_rep == "sunf")
-	  //      The list of flavors in SU(Nf) representation are:
-	  //        g
-	  //        Sigma singlet  (Sum(q_i+q_i^c))
-	  //        5 "-" non-singlets (q_{i,-}=q_i-q_i^c)
-	  //        T3^c = (q_2^c - q_1^c)
-	  //        T8^c = 2*q_{3}^c - q_{1}^c - q_{2}^c
-	  //        T15^c = 3*q_4^c - q_1^c - q_2^c - q_3^c
-	  //        T24^c = 4*q_5^c - q_1^c - q_2^c - q_3^c - q_4^c
-	  //      where c represents the charge-conjugate of the corresponding particle.
-	  //      q1, q2, q3, q4, q5 are defined based off the particle. A table is listed below.
-	  //
-	  //      q_i    proton    pi^+    K^+
-	  //
-	  //      q_1         u       u      u
-	  //      q_2         d    dbar   sbar
-	  //      q_3         s       s      d
-	  //      q_4         c       c      c
-	  //      q_5         b       b      b
-	  //
-	  //      LHAPDF uses the PDG Monte Carlo numbering scheme (d=1, u=2, s=3, c=4, b=5)
-	  {
-	    int Nqi = 5; // number of qis
-	    int q1fl, q2fl, q3fl, q4fl, q5fl; // corresponding PDG ID for qi  
-	    switch (pdg_id) // assign PDG ID to qi dependent on LHA particle ID
-	    {
-	        case 2212: //proton
-		  q1fl = 2; q2fl = 1; q3fl = 3; q4fl = 4; q5fl = 5;
-		  break;
-	        case 211: //pi+
-		  q1fl = 2; q2fl = -1; q3fl = 3; q4fl = 4; q5fl = 5;
-		  break;
-	        case 321: //K+
-		  q1fl = 2; q2fl = -3; q3fl = 1; q4fl = 4; q5fl = 5;
-		  break;
-	        default:
-		  cout << "PDG ID = " << pdg_id << " PDF set not supported." << endl;
-		  exit(1);
-	    } // add more particles here
-	    vector<int> qvec = {q1fl,q2fl,q3fl,q4fl,q5fl};
-
-	    // assign xf value dependent on current ifl
-	    if (ifl == 0) // g
-	      xf = p->xfxQ(21, x, q);
-	    
-	    if (ifl == 1) // Sigma
-	    {
-	      double xftmp = 0.0; // Initialize xftmp before the loop
-	      for (int i = 0; i < qvec.size(); i++)
-	      {
-		int qi = qvec[i];
-		int qic = -qi;
-		xftmp += (p->xfxQ(qi, x, q) + p->xfxQ(qic, x, q));
-	      }
-	      double xfweight = 1. / Nqi;
-	      xf = xfweight * xftmp;
-	    } // if (ifl == 1) ->
-	    
-	    if (ifl > 1 && ifl < 7) // q_{i,-}
-	    {
-	      int iqfl = qvec[ifl-2];
-	      xf = (p->xfxQ(iqfl, x, q) - p->xfxQ(-iqfl, x, q));
-	    } // (ifl > 1 && ifl < 7) ->
-
-	    if (ifl == 7) // T3c
-	      xf = (p->xfxQ(-q2fl, x, q) - p->xfxQ(-q1fl, x, q));
-
-	    if (ifl == 8) // T8c
-	      xf = (2*p->xfxQ(-q3fl, x, q) - p->xfxQ(-q1fl, x, q) - p->xfxQ(-q2fl, x, q));
-
-	    if (ifl == 9 ) // T15c
-	      xf = (3*p->xfxQ(-q4fl, x, q) - p->xfxQ(-q1fl, x, q) - p->xfxQ(-q2fl, x, q) - p->xfxQ(-q3fl, x, q));
-	    
-	    if (ifl == 10) // T24c
-	      xf = (4* p->xfxQ(-q5fl, x, q) - p->xfxQ(-q1fl, x, q) - p->xfxQ(-q2fl, x, q) - p->xfxQ(-q3fl, x, q) - p->xfxQ(-q4fl, x, q));
-	  } // if (plt_rep == sunf)
-	    
-	    
-	    pdfin[iq][ix][ifl][ninput] = 3. * pow(x, 2. / 3.) * xf;
-	    
+	  double xf = xfout[ifl * nxtot + ix] * xweight[ix];
+	  pdfstore_t &stored = values[(iq * nxtot + ix) * nfltot + ifl];
+	  stored = xf;
+	  taskreport.Record(xf, stored);
 	} // for (int ifl
-	  
       } //  for (int ix
     } // for (int iq=0
+    delete p;
+    delete member;
+    {
+      lock_guard<mutex> lock(convertMutex);
+      report.Merge(taskreport);
+    }
 
-      ninput++;
-
-      delete p;
-  } // foreach (LHAPDF::PDF* p, pdfs)
-
-  // Create .plt file for each input replica.
-  // imc denotes the ID of the output MC replica.
-  for (int imc = 0; imc < nmem + 1; ++imc)
-  {
+    if (--nblocksleft[imc] > 0)
+      return; // other blocks of this member are still being converted
 
     // Generate the name of the .plt file
+    string fname;
     if (imc < 10)
-      fname = inpdfname + "_000" + boost::lexical_cast<string>(imc) + ".plt";
+      fname = job.inpdfname + "_000" + boost::lexical_cast<string>(imc) + ".plt";
     else if (imc < 100)
-      fname = inpdfname + "_00" + boost::lexical_cast<string>(imc) + ".plt";
+      fname = job.inpdfname + "_00" + boost::lexical_cast<string>(imc) + ".plt";
     else if (imc < 1000)
-      fname = inpdfname + "_0" + boost::lexical_cast<string>(imc) + ".plt";
+      fname = job.inpdfname + "_0" + boost::lexical_cast<string>(imc) + ".plt";
     else
-      fname = inpdfname + "_" + boost::lexical_cast<string>(imc) + ".plt";
-
-    // Write the header into the .dat file
-    outfile.open(fname.c_str());
+      fname = job.inpdfname + "_" + boost::lexical_cast<string>(imc) + ".plt";
 
+    ostringstream pltfile;
     for (int iq = 0; iq < nqtot; ++iq)
     {
       double qq = qgrid[iq];
-      outfile << "#   Q = " << setw(15) << scientific << setprecision(6) << qq << endl;
-      if (plt_rep == "physical")
-	outfile << "# ZZ\tx\tbbar\tcbar\tsbar\tubar\tdbar\tg\td\tu\ts\tc\tb" << endl;
-      if (plt_rep == "sunf")
-	outfile << "# ZZ\tx\tg\tSigma\tq1-\tq2-\tq3-\tq4-\tq5-\tT3c\tT8c\tT15c\tT24c" << endl;
-      
-      for (int ix = 0; ix < nxtot; ++ix)
+      pltfile << "#   Q = " << setw(15) << scientific << setprecision(6) << qq << endl;
+      if (job.plt_rep == "physical")
+	pltfile << "# ZZ\tx\tbbar\tcbar\tsbar\tubar\tdbar\tg\td\tu\ts\tc\tb" << endl;
+      if (job.plt_rep == "sunf")
+	pltfile << "# ZZ\tx\tg\tSigma\tq1-\tq2-\tq3-\tq4-\tq5-\tT3c\tT8c\tT15c\tT24c" << endl;
+      if (job.plt_rep != "physical" && job.plt_rep != "sunf")
       {
+	pltfile << "# ZZ\tx";
+	for (int ifl = 0; ifl < nfltot; ++ifl)
+	  pltfile << "\t" << flavormap.Labels()[ifl];
+	pltfile << endl;
+      }
 
-        double pout[nfltot + 2] = {};
-        pout[0] = 1.;
-        pout[1] = xgrid[ix];
-
-        for (int ifl = 0; ifl < nfltot; ++ifl)
-          pout[2 + ifl] = pdfin[iq][ix][ifl][imc];
-
-        for (int ifl = 0; ifl < nfltot + 2; ++ifl)
-          outfile << setw(15) << scientific << setprecision(6) << pout[ifl];
-        outfile << endl;
-
+      for (int ix = 0; ix < nxtot; ++ix)
+      {
+	pltfile << setw(15) << scientific << setprecision(6) << 1.;
+	pltfile << setw(15) << scientific << setprecision(6) << xgrid[ix];
+	for (int ifl = 0; ifl < nfltot; ++ifl)
+	  pltfile << setw(15) << scientific << setprecision(6)
+		  << (double)values[(iq * nxtot + ix) * nfltot + ifl];
+	pltfile << endl;
       } // for (int ix
     } // for (int iq
 
-    outfile.clear();
-    outfile.close();
+    string *text = pltwriter.Buffer();
+    *text = pltfile.str();
+    pltwriter.Write(fname, text);
 
-  } // for (int imc...
+    lock_guard<mutex> lock(convertMutex);
+    vector<pdfstore_t>().swap(pdfmem[imc]); // release the values of the member
+  });
+  pltwriter.Finish();
+  report.Print("the .plt values");
 
   return 0;
 
 } // MCLHAPDF2plt -> ==============================================================
 
-int MCStdDevs()
+int MCStdDevs(MCjob &job)
 // Compute central PDF values, standard deviations, and other miscellaneous
 // information for the provided LHAPDF ensemble inpdfname. Write this information
 // into inpdfname_ce.er, inpdfname_up.err, inpdfname_dn.err files.
@@ -1100,34 +1622,38 @@ int MCStdDevs()
   int nxintot = 0, nqintot = 0;
   
   ifstream infile;                 // input file stream
-  ofstream outfile, outerrfile[3]; // output file streams
+  ofstream outfile; // output file stream
 
   const char *strarray[] = {"ce.err", "up.err", "dn.err"};
   vector<string> outerrname(strarray, strarray + 3);
 
-  vector<vector<vector<vector<double>>>> pdfin;      // stores input PDFs
   vector<vector<vector<double>>> pdferr[3];          // store PDF errors
+  PrecisionReport report;
   vector<vector<vector<double>>> &pdfce = pdferr[0], // aliases for arrays
       &pdfu1 = pdferr[1], &pdfd1 = pdferr[2];        // with PDF errors
 
   // Prepare random displacements for conversion of Hessian replicas
-  if (strcmp(err_type.c_str(), "he90") == 0)
+  if (strcmp(job.err_type.c_str(), "he90") == 0)
     ErrorScaling = 1 / 1.65;
   else
     ErrorScaling = 1.0;
 
   // Open the LHAPDF6 object for the input PDFs
-  LHAPDF::PDFSet set(inpdfname);
+  LHAPDF::PDFSet set(job.inpdfname);
   const int nmem = set.size() - 1; // number of PDF sets in the input PDF ensemble,
   // including the zeroth set
-  vector<LHAPDF::PDF *> pdfs = set.mkPDFs();
+  int member_index = 0; // 0 corresponds to the central PDF
+  // lk26 member 0 is shared with the other steps of "mcgen.x pipeline"
+  const shared_ptr<LHAPDF::PDF> pdf0 = MCmemberPDF(set, job.inpdfname, member_index);
+  const LHAPDF::GridPDF *grid_pdf = dynamic_cast<const LHAPDF::GridPDF *>(pdf0.get());
 
   // lk23 pull flavors from grid and create outflavors
-  std::vector<int> inflavors = pdfs[0]->flavors();
+  std::vector<int> inflavors = grid_pdf->flavors();
   const int nfltot = inflavors.size(); // Maximal number of PDF flavors in
   // Create a copy of the original array
   std::vector<int> outflavors(nfltot);
-  //std::copy(inflavors.begin(), inflavors.end(), outflavors.begin());
+  // lk26 restored the copy; outflavors was left filled with zeros, so all columns were the gluon
+  std::copy(inflavors.begin(), inflavors.end(), outflavors.begin());
 
   //lk23 sort inflavors in plt format
   //std::sort(inflavors.begin(), inflavors.end(), pltSort);
@@ -1145,10 +1671,11 @@ int MCStdDevs()
     if (outflavors[i] == 0)
       outflavors[i] = 21;
 
-   
+  // lk26 errors are computed for the physical flavors or for the flavors of a basis file
+  const FlavorMap flavormap = job.basisname.empty() ? PhysicalFlavorMap(outflavors) : ReadFlavorMap(job.basisname);
+  const int nflout = flavormap.NumOutputs(); // number of output flavors
+
   // lk23 Get the the x and q2 values from the 0th grid
-  int member_index = 0; // 0 corresponds to the central PDF
-  const LHAPDF::GridPDF *grid_pdf = dynamic_cast<const LHAPDF::GridPDF *>(set.mkPDF(member_index));
   const vector<double> x_vals = grid_pdf->xKnots();
   nxintot = x_vals.size();
   for (int i = 0; i < nxintot; ++i)
@@ -1173,7 +1700,7 @@ int MCStdDevs()
 
   //lk24 changed x and q values to be read from external file and not grid
   //Read hardwired x values for .plt files
-  infile.open(xpltname.c_str());
+  infile.open(job.xpltname.c_str());
 
   while (infile.good()) {  
     infile >> num;
@@ -1184,7 +1711,7 @@ int MCStdDevs()
   infile.close();
 
   //Read hardwired Q values for the .plt grid
-  infile.open(qpltname.c_str());
+  infile.open(job.qpltname.c_str());
   while (infile >> num) {  
     qgrid.push_back(num);
     nqtot++;
@@ -1213,8 +1740,11 @@ int MCStdDevs()
 
   // lk25 write the x, q, and flavors used in plt output
   outfile.open("flavor_output.txt");
-  for (int i = 0; i < nfltot; ++i)
-    outfile << outflavors[i] << endl;
+  for (int i = 0; i < nflout; ++i)
+    if (job.basisname.empty())
+      outfile << outflavors[i] << endl;
+    else
+      outfile << flavormap.Labels()[i] << endl;
   outfile.clear();
   outfile.close();
 
@@ -1243,123 +1773,197 @@ int MCStdDevs()
   infile.clear();
   infile.close();
 
-  // Prepare an array pdfin to store input PDFs (nqtot x nxtot x nfltot)
-  pdfin.resize(nqtot);
+  // Prepare the arrays pdferr for the errors (nqtot x nxtot x nflout)
   for (ierr = 0; ierr <= 2; ierr++)
-    pdferr[ierr].resize(nqtot);
-
-  for (int iq = 0; iq < nqtot; ++iq)
   {
-    pdfin[iq].resize(nxtot);
-    for (ierr = 0; ierr <= 2; ierr++)
-      pdferr[ierr][iq].resize(nxtot);
-
-    for (int ix = 0; ix < nxtot; ++ix)
+    pdferr[ierr].resize(nqtot);
+    for (int iq = 0; iq < nqtot; ++iq)
     {
-      pdfin[iq][ix].resize(nfltot);
-      for (ierr = 0; ierr <= 2; ierr++)
-        pdferr[ierr][iq][ix].resize(nfltot);
-
-      for (int ifl = 0; ifl < nfltot; ++ifl)
-      {
-        pdfin[iq][ix][ifl].resize(nmem + 1);
-      } // for (int ifl
-    } // for (int ix
-  } // for (int iq
+      pdferr[ierr][iq].resize(nxtot);
+      for (int ix = 0; ix < nxtot; ++ix)
+        pdferr[ierr][iq][ix].resize(nflout);
+    } // for (int iq
+  } // for (ierr
+
+  // Weight of the .plt values, 3 x^(2/3)
+  vector<double> xweight(nxtot);
+  for (int ix = 0; ix < nxtot; ++ix)
+    xweight[ix] = 3. * pow(xgrid[ix], 2. / 3.);
+
+  // lk26 The interpolation stencils of the output points and of the .int file are
+  //      computed once from the knots of member 0 and applied to the knot values of
+  //      every member. LHAPDF objects of the members are created one at a time
+  //      only if the stencils are not valid.
+  const LHAPDF::PDFInfo info(job.inpdfname, 0);
+  const LHAGrid layout(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const InterpolationStencils stencils = MCmakeStencils(info, layout, flavormap, xgrid, qgrid);
+  const InterpolationStencils intstencils = MCmakeStencils(info, layout, flavormap, xigrid, vector<double>(1, 8.));
+
+  // Write the central PDF into a .int file
+  vector<double> xfcells, xfout;
+  fname = job.inpdfname + ".int";
+  outfile.open(fname.c_str());
+  if (intstencils.Valid())
+    MCevaluateFlavors(intstencils, layout, flavormap, 0, xfcells, xfout);
+  else
+    MCevaluateFlavors((LHAPDF::PDF *)grid_pdf, flavormap, xigrid, 8., xfcells, xfout);
+  for (int ifl = 0; ifl < nflout; ++ifl)
+  {
+    for (int ix = 0; ix < nixtot; ++ix)
+    {
+      double x = xigrid[ix];
+      const double ff = xfout[ifl * nixtot + ix] / x;
+      outfile << setw(15) << scientific << setprecision(6) << ff;
+    }
+    outfile << endl;
+  }
+  outfile.clear();
+  outfile.close();
 
-  // Read the input PDFs into array pdfin
-  int ninput = 0;
-  BOOST_FOREACH (LHAPDF::PDF *p, pdfs)
+  // lk26 The errors are accumulated while the members are read, so the memory does
+  //      not grow with the size of the ensemble. Only the central member f0, the
+  //      first member of the current pair (2n-1, 2n), and the sums over the pairs
+  //      are kept, one value per (Q, x, flavor) cell. The spread of MC replicas is
+  //      taken about the central member, so the sum of (f - f0)^2 is accumulated in
+  //      one pass without a running mean. Hessian pairs add the squares of the
+  //      largest upward and downward displacements.
+  //      The members are evaluated on the thread pool up to 2*pool.size() members
+  //      ahead and accumulated in the order of the members, so the errors do not
+  //      depend on the number of threads.
+  // lk26 For error_type pct, the percentiles of the replicas 1..nmem are estimated
+  //      from a t-digest of every cell (quantiles.h) filled while the members are read.
+  const bool percentiles = (strcmp(job.err_type.c_str(), "pct") == 0);
+  const bool mcerrors = (strcmp(job.err_type.c_str(), "mc") == 0) || percentiles;
+  const int npairs = nmem / 2;    // an unpaired last member is not used for the errors
+  const int nread = percentiles ? nmem + 1 : 2 * npairs + 1; // members 0..nread-1
+  const size_t ncells = (size_t)nqtot * nxtot * nflout; // cell (iq*nxtot + ix)*nflout + ifl
+  vector<pdfstore_t> f0, fminus;
+  vector<double> sumup(ncells, 0.), sumdn(ncells, 0.);
+  QuantileDigests digests(percentiles ? ncells : 0);
+  const size_t ncellblock = 256; // cells per task when the digests are merged
+  const size_t ncellblocks = (ncells + ncellblock - 1) / ncellblock;
+  auto mergeDigests = [&]() {
+    mcgenPool().parallelFor(ncellblocks, [&](size_t ib) {
+      digests.MergeCells(ib * ncellblock, min(ncells, (ib + 1) * ncellblock));
+    });
+    digests.Merged();
+  };
+
+  struct MemberValues
   {
+    vector<pdfstore_t> values; // x-weighted PDFs of all cells
+    PrecisionReport report;
+  };
+  vector<string> memberfiles; // read ahead in batches (gridio.h)
+  for (int imem = 0; imem < nread && stencils.Valid(); imem++)
+    memberfiles.push_back(LHAPDF::findpdfmempath(job.inpdfname, imem));
+  GridReadAhead readahead(memberfiles, !LHAGridCache().Enabled());
+  auto readMember = [&](int imem) {
+    MemberValues *m = new MemberValues;
+    m->values.resize(ncells);
+    vector<double> xfcells, xfout;
+    LHAGrid *member = NULL;
+    LHAPDF::PDF *p = NULL;
+    if (stencils.Valid())
+    {
+      member = new LHAGrid(memberfiles[imem]);
+      stencils.CheckMember(*member);
+    }
+    else
+      p = set.mkPDF(imem);
+
     for (int iq = 0; iq < nqtot; ++iq)
     {
-      double q = qgrid[iq];
+      if (member)
+        MCevaluateFlavors(stencils, *member, flavormap, iq, xfcells, xfout);
+      else
+        MCevaluateFlavors(p, flavormap, xgrid, qgrid[iq], xfcells, xfout);
       for (int ix = 0; ix < nxtot; ++ix)
       {
-        double x = xgrid[ix];
-
-        for (int ifl = 0; ifl < nfltot; ++ifl)
+        for (int ifl = 0; ifl < nflout; ++ifl)
         {
-
-          int pid = outflavors[ifl];
-          const double xf = p->xfxQ(pid, x, q);
-          pdfin[iq][ix][ifl][ninput] = 3. * pow(x, 2. / 3.) * xf;
-
+          const double xf = xweight[ix] * xfout[ifl * nxtot + ix];
+          pdfstore_t &stored = m->values[(iq * nxtot + ix) * nflout + ifl];
+          stored = xf;
+          m->report.Record(xf, stored);
         } // for (int ifl
       } //  for (int ix
     } // for (int iq=0
-
-    if (ninput == 0)
-    { // Write the central PDF into a .int file
-      fname = inpdfname + ".int";
-      outfile.open(fname.c_str());
-      for (int ifl = 0; ifl < nfltot; ++ifl)
+    delete p;
+    delete member;
+    return m;
+  }; // readMember
+
+  ThreadPool &pool = mcgenPool();
+  const int nahead = 2 * pool.size();
+  vector<future<MemberValues *>> members(nread);
+  int nsubmitted = 0;
+  for (int imem = 0; imem < nread; imem++)
+  {
+    for (; nsubmitted < nread && nsubmitted <= imem + nahead; nsubmitted++)
+    {
+      const int k = nsubmitted;
+      readahead.Need(k);
+      members[k] = pool.submit([&readMember, k] { return readMember(k); });
+    }
+    MemberValues *m = members[imem].get();
+    report.Merge(m->report);
+    if (percentiles && imem > 0 && digests.Add(m->values.data()))
+      mergeDigests();
+
+    if (imem == 0)
+      f0.swap(m->values);
+    else if (imem % 2 == 1)
+      fminus.swap(m->values); // f_{2n-1}, paired with the next member
+    else
+    {
+      const vector<pdfstore_t> &fplus = m->values; // f_{2n}
+      for (size_t c = 0; c < ncells; ++c)
       {
-        int pid = outflavors[ifl];
-        for (int ix = 0; ix < nixtot; ++ix)
-        {
-          double x = xigrid[ix];
-          const double ff = (p->xfxQ(pid, x, 8.)) / x;
-          outfile << setw(15) << scientific << setprecision(6) << ff;
+        // differences are taken in double precision
+        const double fc = f0[c], fp = fplus[c], fm = fminus[c];
+        if (mcerrors)
+        { // MC symmetric errors
+          auxu = (fp - fc) * (fp - fc) + (fm - fc) * (fm - fc);
+          auxd = auxu;
         }
-        outfile << endl;
-      }
-      outfile.clear();
-      outfile.close();
-    } // if (ninput == 0)
-
-    ninput++;
-
-    delete p;
-  } // foreach (LHAPDF::PDF* p, pdfs)
+        else
+        { // Hessian asymmetric errors
+          auxu = max(max(fp - fc, fm - fc), 0.);
+          auxd = max(max(fc - fp, fc - fm), 0.);
+          auxu *= auxu;
+          auxd *= auxd;
+        }
+        sumup[c] += auxu;
+        sumdn[c] += auxd;
+      } // for (size_t c = 0...
+    }
+    delete m;
+  } // for (int imem = 0...
+  if (percentiles)
+    mergeDigests(); // the remaining buffered members
+  report.Print("the input PDFs");
 
   // Write input 68% c.l. errors into .er files
   for (int iq = 0; iq < nqtot; ++iq)
   {
     for (int ix = 0; ix < nxtot; ++ix)
     {
-      for (int ifl = 0; ifl < nfltot; ++ifl)
+      for (int ifl = 0; ifl < nflout; ++ifl)
       {
+        const size_t c = (iq * nxtot + ix) * nflout + ifl;
+        pdfce[iq][ix][ifl] = f0[c]; // central PDF value
 
-        // central PDF value
-        pdfce[iq][ix][ifl] = pdfin[iq][ix][ifl][0];
-
-        double sumup = 0.0, sumdn = 0.0;
-
-        for (int n = 1; n <= nmem / 2; ++n)
-        {
-          if (strcmp(err_type.c_str(), "mc") == 0)
-          { // MC symmetric errors
-            auxu = (pdfin[iq][ix][ifl][2 * n] - pdfin[iq][ix][ifl][0]) * (pdfin[iq][ix][ifl][2 * n] - pdfin[iq][ix][ifl][0]) + (pdfin[iq][ix][ifl][2 * n - 1] - pdfin[iq][ix][ifl][0]) * (pdfin[iq][ix][ifl][2 * n - 1] - pdfin[iq][ix][ifl][0]);
-            auxd = auxu;
-          }
-          else
-          { // Hessian asymmetric errors
-            auxu = max(max(pdfin[iq][ix][ifl][2 * n] - pdfin[iq][ix][ifl][0],
-                           pdfin[iq][ix][ifl][2 * n - 1] - pdfin[iq][ix][ifl][0]),
-                       0.);
-            auxd = max(max(pdfin[iq][ix][ifl][0] - pdfin[iq][ix][ifl][2 * n],
-                           pdfin[iq][ix][ifl][0] - pdfin[iq][ix][ifl][2 * n - 1]),
-                       0.);
-            auxu *= auxu;
-            auxd *= auxd;
-          }
-
-          sumup += auxu;
-          sumdn += auxd;
-
-        } // for (int n=1; n<=nmem/2
-
-        if (strcmp(err_type.c_str(), "mc") == 0)
+        if (mcerrors)
         { // MC symmetric errors
-          pdfu1[iq][ix][ifl] = sqrt(sumup / max(nmem - 2, 1));
-          pdfd1[iq][ix][ifl] = sqrt(sumdn / max(nmem - 2, 1));
+          pdfu1[iq][ix][ifl] = sqrt(sumup[c] / max(nmem - 2, 1));
+          pdfd1[iq][ix][ifl] = sqrt(sumdn[c] / max(nmem - 2, 1));
         }
         else
         { // Hessian errors
-          pdfu1[iq][ix][ifl] = sqrt(sumup);
-          pdfd1[iq][ix][ifl] = sqrt(sumdn);
-          if (strcmp(err_type.c_str(), "he90") == 0)
+          pdfu1[iq][ix][ifl] = sqrt(sumup[c]);
+          pdfd1[iq][ix][ifl] = sqrt(sumdn[c]);
+          if (strcmp(job.err_type.c_str(), "he90") == 0)
           {
             pdfu1[iq][ix][ifl] *= ErrorScaling;
             pdfd1[iq][ix][ifl] *= ErrorScaling;
@@ -1370,143 +1974,2480 @@ int MCStdDevs()
     } // for (int ix=0; ix<nxtot; ++ix)
   } // for (int iq=0; iq<nqtot; ++iq)
 
-  // write all errors into .err files
-  for (int ierr = 0; ierr <= 2; ierr++)
-  {
-    outerrname[ierr] = inpdfname + "_" + outerrname[ierr];
-    outerrfile[ierr].open(outerrname[ierr].c_str());
-
+  // lk26 writes the values f(iq, ix, ifl) into the .err file fname
+  auto writeErrFile = [&](const string &fname, const function<double(int, int, int)> &f) {
+    ofstream errfile(fname.c_str());
     for (int iq = 0; iq < nqtot; ++iq)
     {
       double qq = qgrid[iq];
-      outerrfile[ierr] << "#   Q = " << qq << endl;
-      outerrfile[ierr] << "# ZZ" << endl;
+      errfile << "#   Q = " << qq << endl;
+      errfile << "# ZZ" << endl;
       for (int ix = 0; ix < nxtot; ++ix)
       {
         double xx = xgrid[ix];
 	// lk24 commented out Z and x values from pdf err files
-        outerrfile[ierr] << setw(15) << scientific << setprecision(6) << 1.0;
-        outerrfile[ierr] << setw(15) << scientific << setprecision(6) << xx;
-        for (int ifl = 0; ifl < nfltot; ++ifl)
-          outerrfile[ierr] << setw(15) << scientific
-                           << setprecision(6) << pdferr[ierr][iq][ix][ifl];
+        errfile << setw(15) << scientific << setprecision(6) << 1.0;
+        errfile << setw(15) << scientific << setprecision(6) << xx;
+        for (int ifl = 0; ifl < nflout; ++ifl)
+          errfile << setw(15) << scientific
+                  << setprecision(6) << f(iq, ix, ifl);
 
-        outerrfile[ierr] << endl;
+        errfile << endl;
       } // for int ix
     } // for (int iq
+    errfile.close();
+  }; // writeErrFile
 
-    outerrfile[ierr].clear();
-    outerrfile[ierr].close();
+  // write all errors into .err files
+  for (int ierr = 0; ierr <= 2; ierr++)
+  {
+    outerrname[ierr] = job.inpdfname + "_" + outerrname[ierr];
+    writeErrFile(outerrname[ierr], [&](int iq, int ix, int ifl) { return pdferr[ierr][iq][ix][ifl]; });
   } // for int ierr
 
+  // lk26 percentile bands: 68% (p16, p84) and 95% (p2.5, p97.5) c.l., and the median
+  if (percentiles)
+  {
+    const double probs[] = {0.025, 0.16, 0.5, 0.84, 0.975};
+    const char *suffixes[] = {"_p2.5.err", "_p16.err", "_p50.err", "_p84.err", "_p97.5.err"};
+    for (int k = 0; k < 5; k++)
+      writeErrFile(job.inpdfname + suffixes[k], [&](int iq, int ix, int ifl) {
+        return digests.Quantile((iq * nxtot + ix) * nflout + ifl, probs[k]);
+      });
+  }
+
   return 0;
 
 } // MCStdDevs -> ==============================================================
 
-int MCaverage(int argc, char *argv[])
+int MCpipeline(MCjob &job, int argc, char *argv[])
 //========================================================================
-// Usage: MCaverage average outgrid ingrid1 ingrid2 ...
-// Creates an LHAPDF grid outgrid containing the average of PDFs in
-// LHAPDF grids ingrid1 ingrid2....
+// Usage: mcgen.x pipeline mcgen.card [plt_representation=physical] [PDG_ID=2212] [cache=MB]
+// Runs the steps of metamcrp.sh with MP4LHC=yes in one process: generates the
+// replicas of the card into the LHAPDF set outpdfname/, with an .info file made
+// from ../inc/Header_<order>_<alpha_s(MZ)>.info as by metamcrp.sh (or, without
+// it, from the .info of the input set), converts them into .plt files, and
+// computes the .err files of the input set (error type of the card) and of the
+// replicas (error type mc). Every replica is kept in LHAGridCache() when it is
+// written, so convert and std_devs interpolate it from memory and do not read
+// it again; the cache holds half of cache MB (default 4096), and a replica that
+// was dropped from it is read from its file. The replicas, .plt and .err files
+// are the same as those of the separate steps.
 {
-  if ((string)argv[1] != "average")
+  double cachemb = 4096.;
+  int npositional = 0;
+  for (int i = 3; i < argc; i++)
   {
-    cout << "Usage MCaverage:" << endl;
-    cout << "MCaverage average out_lha_grid.dat in_lha_grid1.dat in_lha_grid2.dat ..." << endl;
+    const string arg = argv[i];
+    if (arg.compare(0, 6, "cache=") == 0 && atof(arg.c_str() + 6) >= 0.)
+      cachemb = atof(arg.c_str() + 6);
+    else if (npositional == 0 && arg.find('=') == string::npos)
+      job.plt_rep = argv[3 + npositional++];
+    else if (npositional == 1 && arg.find('=') == string::npos)
+      job.pdg_id = stoi(argv[3 + npositional++]);
+    else
+    {
+      cout << "Unknown option " << arg << " for pipeline" << endl;
+      cout << "Usage: mcgen.x pipeline mcgen.card [plt_representation=physical] [PDG_ID=2212] [cache=MB]" << endl;
+      exit(1);
+    }
+  }
+  MCcheckPltOptions(job);
+  if (gridFileExtension() != ".dat")
+  {
+    cout << "pipeline writes an LHAPDF set, which needs uncompressed replicas; unset MCGEN_COMPRESS" << endl;
     exit(1);
   }
 
-  string outpdfname = argv[2];
-  unsigned short int operation;
-  if (strcmp(argv[1], "add") == 0)
-    operation = 1;
-  else
-    operation = 2;
+  job.cardname = argv[2];
+  MCread_card(job);
+  MCopenPackedInput(job);
+  const string hessianname = job.inpdfname, hessiantype = job.err_type;
 
-  // lk23 use custom object to calculate average
-  const int Nindat = argc - 3; // number of input files
+  // 1. Generate the replicas into the set directory and keep them in memory
+  if (mkdir(job.outpdfname.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    cout << "Unable to create directory: " << job.outpdfname << endl;
+    exit(1);
+  }
+  // the cache MB are split between the replicas and the LHAPDF members, as in serve
+  const size_t budget = (size_t)(cachemb * 0.5 * 1048576.);
+  LHAGridCache().SetBudget(budget);
+  job.keepReplicas = true;
+  MCGenerateLHAPDF(job);
+
+  // .info file of the replicas: as in metamcrp.sh, the header of the order of alpha_s
+  // and alpha_s(MZ) of the card; without it, the .info of the input set. Either way
+  // with the number of members, error type, and confidence level of the replicas.
+  string infoname = "../inc/Header_" + job.alphasorder + "_" + job.alphasmz + ".info";
+  if (job.alphasorder.empty() || job.alphasmz.empty())
+    infoname = MCsetInfoFile(job.inpdfname);
+  else if (access(infoname.c_str(), R_OK) != 0)
+  {
+    cout << "Note: there is no " << infoname << "; the .info file is that of " << job.inpdfname << endl;
+    infoname = MCsetInfoFile(job.inpdfname);
+  }
+  MCwriteSetInfo(infoname, job.outpdfname + "/" + job.outpdfname + ".info", job.nmc + 1, "replicas", "68");
+  cout << "Wrote " << job.nmc + 1 << " replicas into the LHAPDF set " << job.outpdfname << endl;
 
-  vector<string> inputpdfnames;
-  for (int ifile = 0; ifile < Nindat; ifile++)
-  // create vector of grids to be averaged by reading
+  // the set of the replicas is found in the working directory
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
   {
-    string inputpdfname = argv[ifile + 3];
-    inputpdfnames.push_back(inputpdfname);
+    cout << "Error: unable to get the working directory" << endl;
+    exit(1);
   }
+  LHAPDF::pathsPrepend(cwd);
+  MCpdfCache().SetBudget(budget); // the other half: member 0, shared by convert and std_devs
+
+  // 2. Convert the replicas into .plt files
+  job.inpdfname = job.outpdfname;
+  MCLHAPDF2plt(job);
+  cout << "Converted LHAPDF replicas into .plt files" << endl;
+
+  // 3. Errors of the input set and of the replicas
+  job.inpdfname = hessianname;
+  job.err_type = hessiantype;
+  job.basisname = "";
+  MCStdDevs(job);
+  job.inpdfname = job.outpdfname;
+  job.err_type = "mc";
+  MCStdDevs(job);
+  cout << "Computed standard deviations" << endl;
+
+  cout << "Member grids taken from memory: " << LHAGridCache().Hits()
+       << ", read from files: " << LHAGridCache().NumMisses() << endl;
+  return 0;
+} // MCpipeline -> ==============================================================
 
-  LHAGrid outputgrid(argv[1], inputpdfnames);
-  outputgrid.WriteLHAGrid(outpdfname);
+int MCmergeShards(MCjob &job, int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x merge-shards mcgen.card N
+// Combines the outputs of "mcgen.x generate mcgen.card shard=i/N", i = 1..N, that
+// were collected in the working directory. Shard i writes member 0 (i = 1) and its
+// range of replicas (MCshardRange), and the sums of its replicas at every knot
+// (outpdfname_shard_i_of_N.stats). From the sums of all shards, merge-shards writes
+// the mean replica nmc of Hessian input and, with nshift != 0, shifts the
+// replicas of the shards in place, which were written unshifted with all their
+// digits. The replicas are the same as those of "generate" without shards, up to
+// the rounding of the sums in a different order; for N = 1 they are identical.
+// The distances of the shards are collected into MC_distances.txt.
+{
+  if (argc < 4 || atoi(argv[3]) < 1)
+  {
+    cout << "Stop: too few parameters passed to mcgen" << endl;
+    cout << "Usage: mcgen.x merge-shards mcgen.card N" << endl;
+    exit(1);
+  }
+  job.cardname = argv[2];
+  MCread_card(job);
+  MCopenPackedInput(job);
+  job.nshards = atoi(argv[3]);
+  const bool hessian = job.err_type != "mc";
+
+  // knots and flavors of the replicas, as in generate
+  LHAPDF::PDFSet set(job.inpdfname);
+  const vector<int> flavors = MCmemberPDF(set, job.inpdfname, 0)->flavors();
+  LHAGrid grid(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const int nsub = grid.getNgrids();
+  vector<vector<double>> xgrid, qgrid;
+  MCoutputKnots(job, grid, xgrid, qgrid);
+  const size_t nfl = flavors.size();
+  vector<size_t> offset(nsub + 1, 0); // first point of every subgrid
+  for (int isub = 0; isub < nsub; ++isub)
+    offset[isub + 1] = offset[isub] + (xgrid[isub].size() - 1) * qgrid[isub].size() * nfl;
+  const size_t npoints = hessian ? offset[nsub] : 0;
+  auto point = [&](int isub, int ix, int iq, int ifl) {
+    return offset[isub] + (ix * qgrid[isub].size() + iq) * nfl + ifl;
+  };
+
+  // sums of the shards, added in the order of the shards
+  vector<double> y0(npoints), sum(npoints, 0.), sum2(npoints, 0.);
+  const string signature = MCshardCardSignature(job);
+  for (int is = 1; is <= job.nshards; ++is)
+  {
+    const string fname = MCshardFileName(job, is, ".stats");
+    ifstream infile(fname.c_str());
+    int first, last;
+    MCshardRange(job, is, first, last);
+    string line, expected[4] = {"Shard: " + to_string(is) + "/" + to_string(job.nshards),
+                                "Replicas: " + to_string(first) + " " + to_string(last), "Card: " + signature,
+                                "Points: " + to_string(npoints)};
+    getline(infile, line); // comment
+    for (int i = 0; i < 4; i++)
+      if (!getline(infile, line) || line != expected[i])
+      {
+        cout << "merge-shards: " << fname << " is missing or does not belong to this card and N:" << endl;
+        cout << "expected \"" << expected[i] << "\", found \"" << line << "\"" << endl;
+        exit(1);
+      }
+    for (size_t ip = 0; ip < npoints; ++ip)
+    {
+      char *end;
+      if (!getline(infile, line))
+      {
+        cout << "merge-shards: " << fname << " is truncated" << endl;
+        exit(1);
+      }
+      y0[ip] = strtod(line.c_str(), &end);
+      sum[ip] += strtod(end, &end);
+      sum2[ip] += strtod(end, &end);
+    }
+  } // for (int is = 1...
+
+  // mean replica and shifts, as at the end of the replica loop of generate
+  vector<double> shift(npoints, 0.);
+  vector<pdfstore_t> meanreplica(npoints);
+  for (size_t ip = 0; ip < npoints; ++ip)
+  {
+    const double mean = sum[ip] / job.nmc;
+    const double var = sum2[ip] / job.nmc - mean * mean;
+    const pdfstore_t f0 = y0[ip];
+    meanreplica[ip] = mean;
+    if (job.nshift != 0)
+    {
+      shift[ip] = f0 - mean;
+      if (abs(job.nsym) == 2) // additional contribution for the log shift
+        shift[ip] -= var / 2;
+      meanreplica[ip] += shift[ip];
+    }
+    if (abs(job.nsym) == 2) // log-normal sampling
+      meanreplica[ip] = exp(meanreplica[ip]);
+  }
+
+  const string datext = gridFileExtension();
+  if (hessian)
+    MCwriteReplicaFile(MCreplicaFileName(job.outpdfname, job.nmc, datext), xgrid, qgrid, flavors,
+                       [&](int isub, int ix, int iq, int ifl) { return meanreplica[point(isub, ix, iq, ifl)]; },
+                       false);
+
+  // shift the replicas of the shards; a replica without the header of an
+  // unshifted one was shifted by an earlier merge-shards
+  int nshifted = 0, nkept = 0;
+  for (int imc = 1; imc < job.nmc && hessian && job.nshift != 0; ++imc)
+  {
+    const string fname = MCreplicaFileName(job.outpdfname, imc, datext);
+    LHAGrid replica(fname);
+    if (replica.getheader("MCgenShard:") != shardUnshiftedHeader)
+    {
+      nkept++;
+      continue;
+    }
+    if (replica.getNgrids() != nsub || replica.getxValuesList() != xgrid || replica.getqValuesList() != qgrid)
+    {
+      cout << "merge-shards: the knots of " << fname << " differ from those of " << job.inpdfname << endl;
+      exit(1);
+    }
+    // the shifted replica replaces the file only once it is written completely
+    const string tmpname = job.outpdfname + "_merge_tmp" + datext;
+    MCwriteReplicaFile(tmpname, xgrid, qgrid, flavors,
+                       [&](int isub, int ix, int iq, int ifl) {
+                         pdfstore_t f = replica.subgrid(isub)(ix, iq, ifl);
+                         f += shift[point(isub, ix, iq, ifl)];
+                         if (abs(job.nsym) == 2) // log-normal sampling
+                           f = exp(f);
+                         return f;
+                       },
+                       false);
+    if (rename(tmpname.c_str(), fname.c_str()) != 0)
+    {
+      cout << "merge-shards: cannot replace " << fname << endl;
+      exit(1);
+    }
+    nshifted++;
+  } // for (int imc = 1...
+
+  // distances of all replicas, in the order of the shards
+  ofstream outfile("MC_distances.txt");
+  outfile << "# iMC\td" << endl;
+  for (int is = 1; is <= job.nshards; ++is)
+  {
+    ifstream infile(MCshardFileName(job, is, "_distances.txt").c_str());
+    string line;
+    while (getline(infile, line))
+      if (!line.empty() && line[0] != '#')
+        outfile << line << endl;
+  }
 
+  cout << "merge-shards: " << job.nshards << " shards of " << job.outpdfname << ", " << job.nmc << " replicas";
+  if (hessian)
+    cout << "; wrote the mean replica";
+  if (job.nshift != 0 && hessian)
+    cout << "; shifted " << nshifted << " replicas" << (nkept ? " (" + to_string(nkept) + " were shifted before)" : "");
+  cout << endl;
   return 0;
-} // MCaverage ->
+} // MCmergeShards -> ==============================================================
 
-int MCadd(int argc, char *argv[])
+int MCcorrelations(MCjob &job, int argc, char *argv[])
+// Compute the covariance and correlation matrices of the PDFs of the ensemble
+// inpdfname on the .plt grid, or on subsets of its flavors, x and Q values.
+// Write them into inpdfname.corr and a summary into inpdfname_corr.txt.
 //========================================================================
-// Usage: MCadd add outgrid ingrid1 ingrid2 w1 w2
-// Creates an LHAPDF grid outgrid containing the sum of PDFs in
-// LHAPDF grids ingrid1 and ingrid2, multiplied by real numbers
-// w1 and w2. The PDFs in the final grid satistfy
-//
-// pdf(x, Q, ifl, out) = w1*pdf(x,Q,ifl,in1) + w2*pdf(x,Q,ifl,in2).
 {
-  string outpdfname = argv[2];
-  /* unsigned short int operation;
-  if (strcmp(argv[1],"add")==0)
-    operation = 1;
-  else
-    operation = 2;  */
+  const map<string, string> options =
+      MCparseOptions(argc, argv, 4, "correlations", {"basis", "flavors", "x", "q"}, "basis=, flavors=, x=, or q=", true);
+  job.basisname = MCoption(options, "basis", job.basisname);
+  const string flavorlist = MCoption(options, "flavors", ""), xlist = MCoption(options, "x", ""),
+               qlist = MCoption(options, "q", "");
+
+  const bool mcerrors = (strcmp(job.err_type.c_str(), "mc") == 0);
+  if (!mcerrors && strcmp(job.err_type.c_str(), "he68") != 0 && strcmp(job.err_type.c_str(), "he90") != 0)
+  {
+    cout << "error_type = " << job.err_type << " is not supported by correlations, use mc, he68, or he90." << endl;
+    exit(1);
+  }
 
-  const int Nindat = 2; // number of input files
+  // Open the LHAPDF6 object for the input PDFs
+  LHAPDF::PDFSet set(job.inpdfname);
+  const int nmem = set.size() - 1; // number of the last member
+  const int npairs = nmem / 2;     // Hessian pairs; an unpaired last member is not used
+  if (mcerrors ? nmem < 1 : npairs < 1)
+  {
+    cout << "Error: " << job.inpdfname << " has no error members" << endl;
+    exit(1);
+  }
+  LHAPDF::PDF *grid_pdf = set.mkPDF(0);
 
-  // lk23 create vector of weights to pass
-  vector<double> w;
-  double w1 = boost::lexical_cast<double>(argv[5]);
-  double w2 = boost::lexical_cast<double>(argv[6]);
-  w.push_back(w1);
-  w.push_back(w2);
+  // output flavors in plt order, as in std_devs
+  vector<int> outflavors = grid_pdf->flavors();
+  for (size_t i = 0; i < outflavors.size(); ++i)
+    if (outflavors[i] == 21)
+      outflavors[i] = 0;
+  sort(outflavors.begin(), outflavors.end());
+  for (size_t i = 0; i < outflavors.size(); ++i)
+    if (outflavors[i] == 0)
+      outflavors[i] = 21;
+  const FlavorMap flavormap = job.basisname.empty() ? PhysicalFlavorMap(outflavors) : ReadFlavorMap(job.basisname);
+  const int nflout = flavormap.NumOutputs();
+  vector<string> flavornames(nflout);
+  for (int ifl = 0; ifl < nflout; ++ifl)
+    flavornames[ifl] = job.basisname.empty() ? to_string(outflavors[ifl]) : flavormap.Labels()[ifl];
+
+  // Read the x and Q values of the .plt grid
+  vector<double> xgrid, qgrid;
+  MCreadPltGrid(job, xgrid, qgrid);
+
+  // Selected flavors, x and Q values
+  vector<int> isel = MCparseIndexList(xlist, xgrid.size(), "x"), qsel = MCparseIndexList(qlist, qgrid.size(), "Q");
+  vector<int> flsel;
+  if (flavorlist.empty())
+    for (int ifl = 0; ifl < nflout; ++ifl)
+      flsel.push_back(ifl);
+  else
+  {
+    vector<string> names;
+    split(names, flavorlist, is_any_of(","));
+    for (size_t k = 0; k < names.size(); ++k)
+    {
+      const int ifl = find(flavornames.begin(), flavornames.end(), trim_copy(names[k])) - flavornames.begin();
+      if (ifl == nflout)
+      {
+        cout << "Flavor " << names[k] << " is not one of the output flavors:";
+        for (int i = 0; i < nflout; ++i)
+          cout << " " << flavornames[i];
+        cout << endl;
+        exit(1);
+      }
+      flsel.push_back(ifl);
+    }
+  } // if (flavorlist.empty())
+  vector<double> xsub, qsub;
+  for (size_t i = 0; i < isel.size(); ++i)
+    xsub.push_back(xgrid[isel[i]]);
+  for (size_t i = 0; i < qsel.size(); ++i)
+    qsub.push_back(qgrid[qsel[i]]);
+  const size_t nxsub = xsub.size(), nqsub = qsub.size(), nflsub = flsel.size();
+  const size_t nv = nqsub * nxsub * nflsub; // variable (iq*nxsub + ix)*nflsub + ifl
+
+  // Weight of the .plt values, 3 x^(2/3)
+  vector<double> xweight(nxsub);
+  for (size_t ix = 0; ix < nxsub; ++ix)
+    xweight[ix] = 3. * pow(xsub[ix], 2. / 3.);
+
+  const LHAPDF::PDFInfo info(job.inpdfname, 0);
+  const LHAGrid layout(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const InterpolationStencils stencils = MCmakeStencils(info, layout, flavormap, xsub, qsub);
+
+  // lk26 The values of all members are evaluated in parallel, member imem into row imem of F
+  const int nread = mcerrors ? nmem + 1 : 2 * npairs + 1;
+  vector<double> F;
+  MCevaluateMembers(set, job.inpdfname, grid_pdf, stencils, flavormap, flsel, xsub, qsub, xweight, nread, F);
+  delete grid_pdf;
+
+  // lk26 Rows of D, so that the covariance matrix is D^T D:
+  //      MC replicas f_k - f_0, k = 1..nmem, with the normalization of std_devs,
+  //      Hessian pairs (f_{2n} - f_{2n-1})/2, scaled to 68% c.l. for he90.
+  const size_t nrows = mcerrors ? nmem : npairs;
+  double norm = mcerrors ? 1. / sqrt((double)max(nmem - 2, 1)) : 0.5;
+  if (strcmp(job.err_type.c_str(), "he90") == 0)
+    norm /= 1.65;
+  vector<double> D(nrows * nv);
+  for (size_t k = 0; k < nrows; ++k)
+  {
+    const double *fa = &F[(mcerrors ? k + 1 : 2 * k + 2) * nv], *fb = &F[(mcerrors ? 0 : 2 * k + 1) * nv];
+    for (size_t v = 0; v < nv; ++v)
+      D[k * nv + v] = norm * (fa[v] - fb[v]);
+  }
+  vector<double> central(F.begin(), F.begin() + nv);
+  vector<double>().swap(F);
+
+  vector<double> cov;
+  symmetricRankK(D, nrows, nv, cov);
+  vector<double>().swap(D);
+  vector<double> sigma(nv), vq(nv), vx(nv);
+  vector<int> vfl(nv);
+  for (size_t iq = 0; iq < nqsub; ++iq)
+    for (size_t ix = 0; ix < nxsub; ++ix)
+      for (size_t ifl = 0; ifl < nflsub; ++ifl)
+      {
+        const size_t v = (iq * nxsub + ix) * nflsub + ifl;
+        vq[v] = qsub[iq];
+        vx[v] = xsub[ix];
+        vfl[v] = flsel[ifl];
+        sigma[v] = sqrt(cov[v * nv + v]);
+      }
 
-  // lk23 create a vector of input pdf names to create output grid
-  string inputpdfname1 = argv[3];
-  string inputpdfname2 = argv[4];
-  vector<string> inputpdfnames;
-  inputpdfnames.push_back(inputpdfname1);
-  inputpdfnames.push_back(inputpdfname2);
+  const string corrname = job.inpdfname + ".corr";
+  WriteCorrelations(corrname, nrows, vq, vx, vfl, central, sigma, cov);
 
-  // lk23 use custom object to calculate sum or multiplication of input grids
-  LHAGrid outputgrid(argv[1], inputpdfnames, w);
-  outputgrid.WriteLHAGrid(outpdfname);
+  // The strongest correlations between different variables
+  const size_t ntop = 20;
+  vector<pair<double, pair<size_t, size_t>>> top; // (-|corr|, (i, j)), sorted
+  for (size_t i = 0; i < nv; ++i)
+    for (size_t j = i + 1; j < nv; ++j)
+    {
+      const double c = -fabs(correlation(cov, sigma, i, j));
+      if (top.size() < ntop || c < top.back().first)
+      {
+        top.insert(upper_bound(top.begin(), top.end(), make_pair(c, make_pair(i, j))), make_pair(c, make_pair(i, j)));
+        if (top.size() > ntop)
+          top.pop_back();
+      }
+    }
+
+  const string summaryname = job.inpdfname + "_corr.txt";
+  ofstream outfile(summaryname.c_str());
+  outfile << "# Correlations of " << job.inpdfname << ", error type " << job.err_type << endl;
+  outfile << "# " << nv << " variables, " << nrows << (mcerrors ? " replicas" : " eigenvector pairs")
+          << ", matrices in " << corrname << endl;
+  outfile << "# flavors:" << endl;
+  for (int ifl = 0; ifl < nflout; ++ifl)
+    outfile << "#" << setw(4) << ifl << "  " << flavornames[ifl] << endl;
+  outfile << "# variable" << setw(15) << "Q" << setw(15) << "x" << setw(8) << "flavor" << setw(15) << "central"
+          << setw(15) << "sigma" << endl;
+  for (size_t v = 0; v < nv; ++v)
+    outfile << setw(10) << v << scientific << setprecision(6) << setw(15) << vq[v] << setw(15) << vx[v] << setw(8)
+            << vfl[v] << setw(15) << central[v] << setw(15) << sigma[v] << endl;
+  outfile << "# strongest correlations between different variables" << endl;
+  outfile << "#       i         j    correlation" << endl;
+  for (size_t k = 0; k < top.size(); ++k)
+  {
+    const size_t i = top[k].second.first, j = top[k].second.second;
+    outfile << setw(10) << i << setw(10) << j << setw(15) << fixed << setprecision(6) << correlation(cov, sigma, i, j)
+            << endl;
+  }
+  outfile.close();
+  cout << "Wrote the covariance and correlation matrices of " << nv << " variables into " << corrname << " and "
+       << summaryname << endl;
 
   return 0;
-} // MCadd ->
+} // MCcorrelations -> ==============================================================
 
-// lk23 added function to sort flavors plt format
-bool pltSort(int a, int b) 
+int MCcompress(MCjob &job, int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x compress LHAPDF_set Nout [output=LHAPDF_set_cNout] [iterations=20000] [seed=1]
+// Selects Nout of the MC replicas of LHAPDF_set whose mean, standard deviation,
+// higher moments, distribution, and correlations on the .plt grid are closest
+// to those of all replicas (see compress.h), and writes them as the LHAPDF set
+// output, with member 0 the average of the selected replicas.
 {
-  int abs_a = std::abs(a);
-  int abs_b = std::abs(b);
+  const int nout = atoi(argv[3]);
+  string outname = job.inpdfname + "_c" + to_string(nout);
+  const map<string, string> options =
+      MCparseOptions(argc, argv, 4, "compress", {"output", "iterations", "seed"}, "output=, iterations=, or seed=");
+  outname = MCoption(options, "output", outname);
+  const size_t iterations = stoul(MCoption(options, "iterations", "20000"));
+  const uint64_t seed = stoull(MCoption(options, "seed", "1"));
 
-  // Check if a or b is 21
-  if (abs_a == 21 || abs_b == 21) 
-    // If either is 21, it should come first
-    return abs_a == 21;
+  // Open the LHAPDF6 object for the input PDFs
+  LHAPDF::PDFSet set(job.inpdfname);
+  const int nmem = set.size() - 1; // number of replicas
+  const LHAPDF::PDFInfo info(job.inpdfname, 0);
+  string errortype = info.has_key("ErrorType") ? info.get_entry("ErrorType") : "replicas";
+  to_lower(errortype);
+  if (errortype.find("replicas") == string::npos)
+  {
+    cout << job.inpdfname << " has ErrorType " << errortype << "; compress needs MC replicas." << endl;
+    exit(1);
+  }
+  if (nout < 2 || nout >= nmem)
+  {
+    cout << "Nout = " << argv[3] << " must be between 2 and " << nmem - 1 << " for " << job.inpdfname << endl;
+    exit(1);
+  }
+  LHAPDF::PDF *grid_pdf = set.mkPDF(0);
+  const vector<int> flavors = grid_pdf->flavors();
+  const FlavorMap flavormap = PhysicalFlavorMap(flavors);
+  const int nfl = flavors.size();
+  vector<int> flsel(nfl);
+  for (int ifl = 0; ifl < nfl; ++ifl)
+    flsel[ifl] = ifl;
+
+  // Read the x and Q values of the .plt grid
+  vector<double> xgrid, qgrid;
+  MCreadPltGrid(job, xgrid, qgrid);
+  const size_t nx = xgrid.size(), nq = qgrid.size(), nv = nq * nx * nfl;
+
+  const LHAGrid layout(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const InterpolationStencils stencils = MCmakeStencils(info, layout, flavormap, xgrid, qgrid);
+  vector<double> F;
+  MCevaluateMembers(set, job.inpdfname, grid_pdf, stencils, flavormap, flsel, xgrid, qgrid, vector<double>(nx, 1.), nmem + 1, F);
+  delete grid_pdf;
+  F.erase(F.begin(), F.begin() + nv); // replicas 1..nmem
+
+  // lk26 correlations are compared between all flavors at every 12th x value,
+  //      at the lowest and the highest Q
+  vector<size_t> anchors;
+  for (size_t iq = 0; iq < nq; iq += max<size_t>(nq - 1, 1))
+    for (size_t ix = 0; ix < nx; ix += 12)
+      for (int ifl = 0; ifl < nfl; ++ifl)
+        anchors.push_back((iq * nx + ix) * nfl + ifl);
+
+  ReplicaCompressor compressor(F, nmem, nv, anchors);
+  vector<double>().swap(F);
+  cout << "Compressing " << nmem << " replicas of " << job.inpdfname << " into " << nout << " replicas: "
+       << compressor.NumPoints() << " points, " << compressor.NumPairs() << " correlations, " << compressChains
+       << " chains of " << iterations << " iterations" << endl;
+  double randomterms[compressTerms], terms[compressTerms];
+  compressor.Normalize(nout, seed, randomterms);
+  const vector<size_t> selected = compressor.Compress(nout, iterations, seed);
+  const double error = compressor.Error(selected, terms);
+
+  const char *termnames[compressTerms] = {"mean", "std", "skewness", "kurtosis", "KS", "corr"};
+  cout << setw(10) << "term" << setw(15) << "random" << setw(15) << "compressed" << endl;
+  for (int t = 0; t < compressTerms; t++)
+    cout << setw(10) << termnames[t] << setw(15) << fixed << setprecision(6) << 1. << setw(15) << terms[t] << endl;
+  cout << setw(10) << "total" << setw(15) << (double)compressTerms << setw(15) << error << endl;
+  cout << defaultfloat;
+
+  // Write the compressed set: member 0 is the average of the selected replicas
+  const string setdir = outname;
+  if (mkdir(setdir.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    cout << "Unable to create directory: " << setdir << endl;
+    exit(1);
+  }
+  MCwriteSetInfo(MCsetInfoFile(job.inpdfname), setdir + "/" + outname + ".info", nout + 1, "", "");
+
+  vector<string> replicas(nout);
+  for (int k = 0; k < nout; k++)
+    replicas[k] = LHAPDF::findpdfmempath(job.inpdfname, selected[k] + 1);
+  LHAGrid average("average", replicas);
+  GridFileWriter writer(2 * mcgenPool().size()); // writes the files in batches (gridio.h)
+  average.WriteLHAGrid(setdir + "/" + outname + "_0000.dat", writer);
+  GridReadAhead readahead(replicas, !LHAGridCache().Enabled());
+  mcgenPool().parallelFor(nout, [&](size_t k) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d.dat", (int)k + 1);
+    readahead.Need(k);
+    LHAGrid grid(replicas[k]);
+    grid.WriteLHAGrid(setdir + "/" + outname + suffix, writer);
+  });
+  writer.Finish();
+
+  ofstream listfile((outname + "_replicas.txt").c_str());
+  listfile << "# replicas of " << job.inpdfname << " in " << outname << ", error function " << error << endl;
+  for (int k = 0; k < nout; k++)
+    listfile << selected[k] + 1 << endl;
+  listfile.close();
+  cout << "Wrote " << nout << " replicas into the LHAPDF set " << setdir << ", their numbers into " << outname
+       << "_replicas.txt" << endl;
+  return 0;
+} // MCcompress ->
 
-  // Check if a is -2 and b is 2, in which case -2 should come before 2
-  if (abs_a == 2 && abs_b == 2)
-    return a > b;
+int MCmc2hessian(MCjob &job, int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x mc2hessian LHAPDF_set Neig [output=LHAPDF_set_hNeig] [power=2] [seed=1]
+// Converts the MC replicas of LHAPDF_set into Neig pairs of symmetric Hessian
+// members along the leading principal components of the replicas on the knots
+// of the set. Writes the LHAPDF set output and the fraction of the variance
+// of every knot value that is retained, output_retained.dat.
+{
+  const int neig = atoi(argv[3]);
+  string outname = job.inpdfname + "_h" + to_string(neig);
+  const map<string, string> options =
+      MCparseOptions(argc, argv, 4, "mc2hessian", {"output", "power", "seed"}, "output=, power=, or seed=");
+  outname = MCoption(options, "output", outname);
+  const int power = stoi(MCoption(options, "power", "2"));
+  const uint64_t seed = stoull(MCoption(options, "seed", "1"));
+
+  LHAPDF::PDFSet set(job.inpdfname);
+  const int nrep = set.size() - 1; // number of replicas
+  const LHAPDF::PDFInfo info(job.inpdfname, 0);
+  string errortype = info.has_key("ErrorType") ? info.get_entry("ErrorType") : "replicas";
+  to_lower(errortype);
+  if (errortype.find("replicas") == string::npos)
+  {
+    cout << job.inpdfname << " has ErrorType " << errortype << "; mc2hessian needs MC replicas." << endl;
+    exit(1);
+  }
+  if (neig < 1 || neig >= nrep)
+  {
+    cout << "Neig = " << argv[3] << " must be between 1 and " << nrep - 1 << " for " << job.inpdfname << endl;
+    exit(1);
+  }
 
-  // Check if a or b is 2 or -2
-  if (abs_a == 2 || abs_b == 2)
-    // If either is 2 or -2, it should come before 1 or -1
-    return abs_a == 2;
+  // lk26 The knot values of the replicas are the rows of A; the subgrids of member 0
+  //      give the layout, all members must have the same knots.
+  LHAGrid grid0(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  const int nsub = grid0.getNgrids();
+  vector<size_t> offsets(nsub + 1, 0);
+  for (int isub = 0; isub < nsub; isub++)
+    offsets[isub + 1] = offsets[isub] + grid0.getpdfValuesList()[isub].size();
+  const size_t ncols = offsets[nsub];
+  vector<double> A((size_t)nrep * ncols);
+  vector<string> replicas(nrep); // read ahead in batches (gridio.h)
+  for (int irep = 0; irep < nrep; irep++)
+    replicas[irep] = LHAPDF::findpdfmempath(job.inpdfname, irep + 1);
+  GridReadAhead readahead(replicas, !LHAGridCache().Enabled());
+  mcgenPool().parallelFor(nrep, [&](size_t irep) {
+    readahead.Need(irep);
+    LHAGrid grid(replicas[irep]);
+    grid0.CompareLHAGrid(&grid0, &grid, irep + 1);
+    for (int isub = 0; isub < nsub; isub++)
+      copy(grid.getpdfValuesList()[isub].begin(), grid.getpdfValuesList()[isub].end(),
+           A.begin() + irep * ncols + offsets[isub]);
+  });
+
+  // center the replicas on their mean
+  vector<double> mean(ncols, 0.), variance(ncols, 0.);
+  const size_t colblock = 2048, ncolblocks = (ncols + colblock - 1) / colblock;
+  mcgenPool().parallelFor(ncolblocks, [&](size_t ib) {
+    const size_t c0 = ib * colblock, c1 = min(ncols, c0 + colblock);
+    for (int irep = 0; irep < nrep; irep++)
+      for (size_t c = c0; c < c1; c++)
+        mean[c] += A[irep * ncols + c];
+    for (size_t c = c0; c < c1; c++)
+      mean[c] /= nrep;
+    for (int irep = 0; irep < nrep; irep++)
+      for (size_t c = c0; c < c1; c++)
+      {
+        A[irep * ncols + c] -= mean[c];
+        variance[c] += A[irep * ncols + c] * A[irep * ncols + c] / (nrep - 1);
+      }
+  });
+
+  cout << "Computing " << neig << " principal components of " << nrep << " replicas of " << job.inpdfname << " at "
+       << ncols << " knot values" << endl;
+  vector<double> s, V;
+  randomizedSVD(A, nrep, ncols, neig, 10, power, seed, s, V);
+  vector<double>().swap(A);
+
+  // displacements d_k = s_k/sqrt(nrep-1) V_k (68% c.l.) and the retained variance
+  vector<double> retained(ncols, 0.);
+  double totalvariance = 0., retainedvariance = 0., meanfraction = 0.;
+  size_t nvarying = 0;
+  for (int k = 0; k < neig; k++)
+  {
+    const double scale = s[k] / sqrt((double)(nrep - 1));
+    for (size_t c = 0; c < ncols; c++)
+    {
+      V[k * ncols + c] *= scale;
+      retained[c] += V[k * ncols + c] * V[k * ncols + c];
+    }
+  }
+  for (size_t c = 0; c < ncols; c++)
+  {
+    totalvariance += variance[c];
+    retainedvariance += retained[c];
+    retained[c] = variance[c] > 0. ? retained[c] / variance[c] : 1.;
+    if (variance[c] > 0.)
+    {
+      meanfraction += retained[c];
+      nvarying++;
+    }
+  }
 
-  // Check if both numbers have the same absolute value
-  if (abs_a == abs_b) 
-    // If absolute values are the same, sort by their sign
-    return a > b;
+  // Write the Hessian set: member 0 is the mean, members 2k-1 and 2k are the mean -/+ d_k
+  const string setdir = outname;
+  if (mkdir(setdir.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    cout << "Unable to create directory: " << setdir << endl;
+    exit(1);
+  }
+  MCwriteSetInfo(MCsetInfoFile(job.inpdfname), setdir + "/" + outname + ".info", 2 * neig + 1, "hessian",
+                 "68.268949");
+
+  // writes mean + w*d_k (k < 0: the mean) or values into a copy of grid0;
+  // the files are written in batches (gridio.h)
+  GridFileWriter writer(2 * mcgenPool().size());
+  auto writeGrid = [&](const string &fname, int k, double w, const vector<double> *values) {
+    LHAGrid grid(grid0);
+    for (int isub = 0; isub < nsub; isub++)
+    {
+      pdfstore_t *f = grid.subgrid(isub).data;
+      for (size_t c = offsets[isub]; c < offsets[isub + 1]; c++)
+        f[c - offsets[isub]] = values ? (*values)[c] : mean[c] + (k >= 0 ? w * V[k * ncols + c] : 0.);
+    }
+    grid.WriteLHAGrid(fname, writer);
+  };
+  mcgenPool().parallelFor(2 * neig + 1, [&](size_t imem) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d.dat", (int)imem);
+    writeGrid(setdir + "/" + outname + suffix, (int)(imem + 1) / 2 - 1, imem % 2 == 1 ? -1. : 1., NULL);
+  });
+  writeGrid(outname + "_retained.dat", -1, 0., &retained);
+  writer.Finish();
+
+  // Summary: retained variance in total and for every flavor
+  cout << "Retained variance: " << fixed << setprecision(4) << 100. * retainedvariance / totalvariance
+       << "% of the total, " << 100. * meanfraction / max<size_t>(nvarying, 1) << "% per varying knot value on average, "
+       << neig << " components" << endl;
+  map<int, pair<double, double>> flavorvariance; // flavor -> (total, retained)
+  map<int, double> flavormin;                    // smallest retained fraction
+  for (int isub = 0; isub < nsub; isub++)
+  {
+    const vector<int> &fl = grid0.getflavorsList()[isub];
+    for (size_t c = offsets[isub]; c < offsets[isub + 1]; c++)
+    {
+      const int pid = fl[(c - offsets[isub]) % fl.size()];
+      flavorvariance[pid].first += variance[c];
+      flavorvariance[pid].second += retained[c] * variance[c];
+      flavormin[pid] = flavormin.count(pid) ? min(flavormin[pid], retained[c]) : retained[c];
+    }
+  }
+  cout << setw(8) << "flavor" << setw(15) << "retained (%)" << setw(15) << "min. cell (%)" << endl;
+  for (map<int, pair<double, double>>::const_iterator it = flavorvariance.begin(); it != flavorvariance.end(); ++it)
+    cout << setw(8) << it->first << setw(15)
+         << (it->second.first > 0. ? 100. * it->second.second / it->second.first : 100.) << setw(15)
+         << 100. * flavormin[it->first] << endl;
+  cout << defaultfloat;
+  cout << "Wrote " << 2 * neig + 1 << " members into the LHAPDF set " << setdir << ", the retained fraction of the"
+       << " variance of every knot value into " << outname << "_retained.dat" << endl;
+  return 0;
+} // MCmc2hessian ->
 
-  // If absolute values are different, sort by their absolute value
-  return abs_a < abs_b;
-} // pltSort ->
+int MCvalidate(MCjob &job, int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x validate Hessian_set MC_input [error_type=he90] [ktype=1] [replicas=N]
+// Compares the MC replicas 1..N of MC_input (an LHAPDF set directory, a
+// .lhapack file, or a list of grid files, e.g. the output of "generate") to
+// the distribution that "generate" samples from the Hessian set inpdfname
+// with the same error_type and ktype as in the card. At every knot of the MC
+// grids, the deviations of the replica mean and standard deviation from
+// those of the sampled distribution are given in units of its standard
+// deviation, and for log-normal sampling (ktype = +-2, +-12) the skewness of
+// the replicas is compared to that of the log-normal distribution. Writes all
+// knots into MC_validation.txt and prints the worst knots for every subgrid
+// and flavor. The replicas are the members 1..N, by default all of them; the
+// last file written by "generate" holds the replica average, so its output
+// of Nmc files is validated with replicas=Nmc-1.
+{
+  const string mcinput = argv[3];
+  const string usage = "error_type=he68|he90, ktype=<type of the replicas>, or replicas=N";
+  const map<string, string> options =
+      MCparseOptions(argc, argv, 4, "validate", {"error_type", "replicas", "ktype"}, usage);
+  job.err_type = MCoption(options, "error_type", job.err_type);
+  if (options.count("error_type") && job.err_type != "he68" && job.err_type != "he90")
+    MCoptionError("error_type=" + job.err_type, "validate", usage);
+  int nrep = atoi(MCoption(options, "replicas", "-1").c_str());
+  if (options.count("replicas") && nrep < 2)
+    MCoptionError("replicas=" + options.at("replicas"), "validate", usage);
+  if (options.count("ktype"))
+  {
+    const string ktype = options.at("ktype");
+    if (ktype.find_first_not_of("+-0123456789") != string::npos)
+      MCoptionError("ktype=" + ktype, "validate", usage);
+    job.ktype = atoi(ktype.c_str());
+    job.nsym = job.ktype % 10;        // as in the card
+    job.nshift = abs(job.ktype / 10);
+  }
+  if (abs(job.nsym) < 1 || abs(job.nsym) > 3 || job.nsym == 3)
+  {
+    cout << "Error: validate does not know the replicas of ktype = " << job.ktype << endl;
+    exit(1);
+  }
+  const double ErrorScaling = (job.err_type == "he90") ? 1 / 1.65 : 1.0;
+  const bool logsampling = (abs(job.nsym) == 2);
+
+  // The cells are the knots of the MC grids, laid out as in member 0
+  const vector<string> mcfiles = MCgridFiles(mcinput);
+  if (nrep < 0)
+    nrep = (int)mcfiles.size() - 1;
+  if (nrep < 2 || nrep > (int)mcfiles.size() - 1)
+  {
+    cout << "Error: " << mcinput << " has " << (int)mcfiles.size() - 1 << " members, cannot validate " << nrep
+         << " replicas" << endl;
+    exit(1);
+  }
+  LHAGrid mclayout(mcfiles[0]);
+  const int nsub = mclayout.getNgrids();
+  vector<size_t> offsets(nsub + 1, 0);
+  for (int isub = 0; isub < nsub; isub++)
+    offsets[isub + 1] = offsets[isub] + mclayout.getpdfValuesList()[isub].size();
+  const size_t ncells = offsets[nsub];
+
+  // Stencils of the Hessian set on the knots of every MC subgrid
+  LHAPDF::PDFSet set(job.inpdfname);
+  const int npairs = (set.size() - 1) / 2;
+  const LHAPDF::PDFInfo info(job.inpdfname, 0);
+  const LHAGrid layout(LHAPDF::findpdfmempath(job.inpdfname, 0));
+  vector<FlavorMap> flavormaps;
+  vector<InterpolationStencils> stencils;
+  bool stencilsvalid = true;
+  for (int isub = 0; isub < nsub; isub++)
+  {
+    const vector<double> &xknots = mclayout.getxValuesList()[isub], &qknots = mclayout.getqValuesList()[isub];
+    flavormaps.push_back(PhysicalFlavorMap(mclayout.getflavorsList()[isub]));
+    stencils.push_back(MCmakeStencils(info, layout, flavormaps[isub], xknots, qknots));
+    stencilsvalid = stencilsvalid && stencils[isub].Valid();
+  }
+
+  // x*f of Hessian member imem at all cells
+  vector<string> memberfiles; // read ahead in batches (gridio.h)
+  for (int imem = 0; imem < 2 * npairs + 1 && stencilsvalid; imem++)
+    memberfiles.push_back(LHAPDF::findpdfmempath(job.inpdfname, imem));
+  GridReadAhead readahead(memberfiles, !LHAGridCache().Enabled());
+  auto readHessian = [&](int imem) {
+    vector<double> *values = new vector<double>(ncells);
+    vector<double> xfcells, xfout;
+    LHAGrid *member = stencilsvalid ? new LHAGrid(memberfiles[imem]) : NULL;
+    LHAPDF::PDF *p = stencilsvalid ? NULL : set.mkPDF(imem);
+    if (member)
+      stencils[0].CheckMember(*member); // all stencils have the layout of member 0
+    for (int isub = 0; isub < nsub; isub++)
+    {
+      const vector<double> &xknots = mclayout.getxValuesList()[isub], &qknots = mclayout.getqValuesList()[isub];
+      const size_t nx = xknots.size(), nq = qknots.size(), nfl = flavormaps[isub].NumOutputs();
+      for (size_t iq = 0; iq < nq; iq++)
+      {
+        if (member)
+          MCevaluateFlavors(stencils[isub], *member, flavormaps[isub], iq, xfcells, xfout);
+        else
+          MCevaluateFlavors(p, flavormaps[isub], xknots, qknots[iq], xfcells, xfout);
+        for (size_t ix = 0; ix < nx; ix++)
+          for (size_t ifl = 0; ifl < nfl; ifl++)
+            (*values)[offsets[isub] + (ix * nq + iq) * nfl + ifl] = xfout[ifl * nx + ix];
+      }
+    } // for (int isub = 0...
+    delete member;
+    delete p;
+    return values;
+  }; // readHessian
+
+  // lk26 Both ensembles are streamed: the members are read on the thread pool up to
+  //      2*pool.size() members ahead and accumulated in their order, block by block of
+  //      cells, so the results do not depend on the number of threads.
+  ThreadPool &pool = mcgenPool();
+  const int nahead = 2 * pool.size();
+  const size_t cellblock = 4096, ncellblocks = (ncells + cellblock - 1) / cellblock;
+
+  // Mean shift and variance of the sampled variable y (f, or log f for log-normal
+  // sampling) from the Hessian pairs: with r ~ N(0, ErrorScaling^2), generate adds
+  // a r, a = (y+ - y-)/2, plus b r^2, b = (y+ + y- - 2 y0)/2, for asymmetric errors,
+  // or (y+ - y0)|r| for r > 0 and (y- - y0)|r| for r < 0 (ktype = -3)
+  vector<double> f0, y0, yminus, yshift(ncells, 0.), yvar(ncells, 0.);
+  vector<char> positive(ncells, 1);
+  const double scale2 = ErrorScaling * ErrorScaling;
+  {
+    const int nread = 2 * npairs + 1;
+    vector<future<vector<double> *>> members(nread);
+    int nsubmitted = 0;
+    for (int imem = 0; imem < nread; imem++)
+    {
+      for (; nsubmitted < nread && nsubmitted <= imem + nahead; nsubmitted++)
+      {
+        const int k = nsubmitted;
+        readahead.Need(k);
+        members[k] = pool.submit([&readHessian, k] { return readHessian(k); });
+      }
+      vector<double> *f = members[imem].get();
+      if (logsampling)
+        for (size_t c = 0; c < ncells; c++)
+        {
+          positive[c] = positive[c] && (*f)[c] > 0.;
+          (*f)[c] = (*f)[c] > 0. ? log((*f)[c]) : 0.;
+        }
+      if (imem == 0)
+      {
+        f0 = *f;
+        y0.swap(*f);
+        if (logsampling)
+          for (size_t c = 0; c < ncells; c++)
+            f0[c] = exp(f0[c]);
+      }
+      else if (imem % 2 == 1)
+        yminus.swap(*f);
+      else
+        pool.parallelFor(ncellblocks, [&](size_t ib) {
+          for (size_t c = ib * cellblock; c < min(ncells, (ib + 1) * cellblock); c++)
+          {
+            const double dp = (*f)[c] - y0[c], dm = yminus[c] - y0[c];
+            const double a = 0.5 * (dp - dm), b = 0.5 * (dp + dm);
+            if (job.nsym == -3)
+            { // E|r| = ErrorScaling sqrt(2/pi), E r^2 = ErrorScaling^2
+              const double m1 = 0.5 * ErrorScaling * sqrt(2. / M_PI) * (dp + dm);
+              yshift[c] += m1;
+              yvar[c] += 0.5 * scale2 * (dp * dp + dm * dm) - m1 * m1;
+            }
+            else if (job.nsym < 0)
+            {
+              yshift[c] += b * scale2;
+              yvar[c] += a * a * scale2 + 2. * b * b * scale2 * scale2;
+            }
+            else
+              yvar[c] += a * a * scale2;
+          }
+        });
+      delete f;
+    } // for (int imem = 0...
+  }
+
+  // Power sums of the replica displacements f - f0
+  vector<double> s1(ncells, 0.), s2(ncells, 0.), s3(ncells, 0.);
+  {
+    GridReadAhead mcreadahead(mcfiles, !LHAGridCache().Enabled());
+    vector<future<LHAGrid *>> members(nrep + 1);
+    int nsubmitted = 1;
+    for (int irep = 1; irep <= nrep; irep++)
+    {
+      for (; nsubmitted <= nrep && nsubmitted <= irep + nahead; nsubmitted++)
+      {
+        const string file = mcfiles[nsubmitted];
+        mcreadahead.Need(nsubmitted);
+        members[nsubmitted] = pool.submit([file] { return new LHAGrid(file); });
+      }
+      LHAGrid *grid = members[irep].get();
+      mclayout.CompareLHAGrid(&mclayout, grid, irep);
+      pool.parallelFor(ncellblocks, [&](size_t ib) {
+        const size_t c0 = ib * cellblock, c1 = min(ncells, c0 + cellblock);
+        for (int isub = 0; isub < nsub; isub++)
+        {
+          const pdfstore_t *f = grid->getpdfValuesList()[isub].data();
+          for (size_t c = max(c0, offsets[isub]); c < min(c1, offsets[isub + 1]); c++)
+          {
+            const double d = f[c - offsets[isub]] - f0[c];
+            s1[c] += d;
+            s2[c] += d * d;
+            s3[c] += d * d * d;
+          }
+        }
+      });
+      delete grid;
+    } // for (int irep = 1...
+  }
+
+  // Deviations per cell, in units of the standard deviation of the sampled distribution
+  ofstream outfile("MC_validation.txt");
+  outfile << "# Validation of the " << nrep << " replicas of " << mcinput << " against the Hessian set " << job.inpdfname
+          << " (" << job.err_type << ")" << endl;
+  outfile << "# ktype = " << job.ktype << "; dmean = (mean - mean_prior)/sd_prior, dsd = sd/sd_prior - 1; statistical size about "
+          << 1. / sqrt((double)nrep)
+          << " and " << 1. / sqrt(2. * (nrep - 1)) << endl;
+  outfile << "# isub" << setw(15) << "x" << setw(15) << "Q" << setw(8) << "flavor" << setw(15) << "f0" << setw(15)
+          << "mean_prior" << setw(15) << "sd_prior" << setw(15) << "mean" << setw(15) << "sd" << setw(15) << "dmean" << setw(15) << "dsd";
+  if (logsampling)
+    outfile << setw(15) << "skew" << setw(15) << "skew_prior";
+  outfile << endl;
+
+  struct Worst
+  {
+    size_t ncells = 0;
+    double sum2mean = 0., maxmean = 0., maxsd = 0., maxskew = 0.;
+    size_t cmean = 0, csd = 0, cskew = 0;
+  };
+  map<pair<int, int>, Worst> worst; // (subgrid, flavor)
+  auto knot = [&](int isub, size_t c, double &x, double &q, int &pid) {
+    const size_t nq = mclayout.getqValuesList()[isub].size(), nfl = mclayout.getflavorsList()[isub].size();
+    const size_t i = c - offsets[isub];
+    pid = mclayout.getflavorsList()[isub][i % nfl];
+    q = mclayout.getqValuesList()[isub][(i / nfl) % nq];
+    x = mclayout.getxValuesList()[isub][i / nfl / nq];
+  };
+  size_t nskipped = 0;
+  for (int isub = 0; isub < nsub; isub++)
+    for (size_t c = offsets[isub]; c < offsets[isub + 1]; c++)
+    {
+      // shifted replicas: generate moves the replica mean of y to y0 (minus var/2 for log f)
+      double meanprior, sdprior, skewprior = 0.;
+      const double shift = job.nshift != 0 ? 0. : yshift[c];
+      if (logsampling)
+      {
+        const double v = yvar[c], e = exp(v);
+        meanprior = exp(y0[c] + (job.nshift != 0 ? -0.5 * v : shift) + 0.5 * v);
+        sdprior = meanprior * sqrt(e - 1.);
+        skewprior = (e + 2.) * sqrt(e - 1.);
+      }
+      else
+      {
+        meanprior = f0[c] + shift;
+        sdprior = sqrt(yvar[c]);
+      }
+      if (!positive[c] || !(sdprior > 1e-10 * fabs(meanprior)) || sdprior < 1e-300)
+      {
+        nskipped++;
+        continue;
+      }
+      const double m = s1[c] / nrep;
+      const double m2 = max(s2[c] / nrep - m * m, 0.), m3 = s3[c] / nrep - 3. * m * s2[c] / nrep + 2. * m * m * m;
+      const double sd = sqrt(m2 * nrep / (nrep - 1.));
+      const double dmean = (f0[c] + m - meanprior) / sdprior, dsd = sd / sdprior - 1.;
+      double x, q;
+      int pid;
+      knot(isub, c, x, q, pid);
+      outfile << setw(6) << isub << scientific << setprecision(6) << setw(15) << x << setw(15) << q << setw(8) << pid
+              << setw(15) << f0[c] << setw(15) << meanprior << setw(15) << sdprior << setw(15) << f0[c] + m << setw(15) << sd << setw(15)
+              << dmean << setw(15) << dsd;
+      Worst &w = worst[make_pair(isub, pid)];
+      if (logsampling)
+      {
+        const double skew = m2 > 0. ? m3 / (m2 * sqrt(m2)) : 0.;
+        outfile << setw(15) << skew << setw(15) << skewprior;
+        if (fabs(skew - skewprior) >= w.maxskew)
+        {
+          w.maxskew = fabs(skew - skewprior);
+          w.cskew = c;
+        }
+      }
+      outfile << endl;
+      w.ncells++;
+      w.sum2mean += dmean * dmean;
+      if (fabs(dmean) >= w.maxmean)
+      {
+        w.maxmean = fabs(dmean);
+        w.cmean = c;
+      }
+      if (fabs(dsd) >= w.maxsd)
+      {
+        w.maxsd = fabs(dsd);
+        w.csd = c;
+      }
+    } // for (size_t c = offsets[isub]...
+  outfile.close();
+
+  cout << "Validation of " << nrep << " replicas of " << mcinput << " against " << job.inpdfname << " (" << job.err_type
+       << ", ktype = " << job.ktype << "), " << ncells - nskipped << " knots, " << nskipped
+       << " knots without PDF error skipped" << endl;
+  cout << "Deviations in units of the sampled standard deviation; statistical size about " << fixed << setprecision(3)
+       << 1. / sqrt((double)nrep) << " (mean) and " << 1. / sqrt(2. * (nrep - 1)) << " (sd)" << endl;
+  cout << setw(5) << "isub" << setw(8) << "flavor" << setw(7) << "knots" << setw(10) << "rms dmean" << setw(10)
+       << "max dmean" << setw(24) << "at (x, Q)" << setw(10) << "max dsd" << setw(24) << "at (x, Q)";
+  if (logsampling)
+    cout << setw(10) << "max dskew" << setw(24) << "at (x, Q)";
+  cout << endl;
+  auto at = [&](int isub, size_t c) {
+    double x, q;
+    int pid;
+    knot(isub, c, x, q, pid);
+    ostringstream s;
+    s << scientific << setprecision(3) << "(" << x << ", " << q << ")";
+    return s.str();
+  };
+  for (map<pair<int, int>, Worst>::const_iterator it = worst.begin(); it != worst.end(); ++it)
+  {
+    const int isub = it->first.first;
+    const Worst &w = it->second;
+    cout << setw(5) << isub << setw(8) << it->first.second << setw(7) << w.ncells << setw(10)
+         << sqrt(w.sum2mean / w.ncells) << setw(10) << w.maxmean << setw(24) << at(isub, w.cmean) << setw(10) << w.maxsd
+         << setw(24) << at(isub, w.csd);
+    if (logsampling)
+      cout << setw(10) << w.maxskew << setw(24) << at(isub, w.cskew);
+    cout << endl;
+  }
+  cout << defaultfloat << "Wrote the deviations at all knots into MC_validation.txt" << endl;
+  return 0;
+} // MCvalidate ->
+
+int MCaverage(int argc, char *argv[])
+//========================================================================
+// Usage: MCaverage average outgrid ingrid1 ingrid2 ...
+// Creates an LHAPDF grid outgrid containing the average of PDFs in
+// LHAPDF grids ingrid1 ingrid2....
+{
+  if ((string)argv[1] != "average")
+  {
+    cout << "Usage MCaverage:" << endl;
+    cout << "MCaverage average out_lha_grid.dat in_lha_grid1.dat in_lha_grid2.dat ..." << endl;
+    exit(1);
+  }
+
+  string outpdfname = argv[2];
+  unsigned short int operation;
+  if (strcmp(argv[1], "add") == 0)
+    operation = 1;
+  else
+    operation = 2;
+
+  // lk23 use custom object to calculate average
+  const int Nindat = argc - 3; // number of input files
+
+  vector<string> inputpdfnames;
+  for (int ifile = 0; ifile < Nindat; ifile++)
+  // create vector of grids to be averaged by reading
+  {
+    string inputpdfname = argv[ifile + 3];
+    inputpdfnames.push_back(inputpdfname);
+  }
+
+  LHAGrid outputgrid(argv[1], inputpdfnames);
+  outputgrid.WriteLHAGrid(outpdfname);
+
+  return 0;
+} // MCaverage ->
+
+int MCadd(int argc, char *argv[])
+//========================================================================
+// Usage: MCadd add outgrid ingrid1 ingrid2 w1 w2
+// Creates an LHAPDF grid outgrid containing the sum of PDFs in
+// LHAPDF grids ingrid1 and ingrid2, multiplied by real numbers
+// w1 and w2. The PDFs in the final grid satistfy
+//
+// pdf(x, Q, ifl, out) = w1*pdf(x,Q,ifl,in1) + w2*pdf(x,Q,ifl,in2).
+{
+  string outpdfname = argv[2];
+  /* unsigned short int operation;
+  if (strcmp(argv[1],"add")==0)
+    operation = 1;
+  else
+    operation = 2;  */
+
+  const int Nindat = 2; // number of input files
+
+  // lk23 create vector of weights to pass
+  vector<double> w;
+  double w1 = boost::lexical_cast<double>(argv[5]);
+  double w2 = boost::lexical_cast<double>(argv[6]);
+  w.push_back(w1);
+  w.push_back(w2);
+
+  // lk23 create a vector of input pdf names to create output grid
+  string inputpdfname1 = argv[3];
+  string inputpdfname2 = argv[4];
+  vector<string> inputpdfnames;
+  inputpdfnames.push_back(inputpdfname1);
+  inputpdfnames.push_back(inputpdfname2);
+
+  // lk23 use custom object to calculate sum or multiplication of input grids
+  LHAGrid outputgrid(argv[1], inputpdfnames, w);
+  outputgrid.WriteLHAGrid(outpdfname);
+
+  return 0;
+} // MCadd ->
+
+int MCStdDevsGrid(MCjob &job, int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x std_devs_grid input error_type [output_prefix]
+// Computes the central values and the up and down errors of an ensemble on the
+// knots of its own grids, without LHAPDF. input is an LHAPDF set directory
+// (its .dat files in the order of their names), a .lhapack file, or a text
+// file with the names of the member grids, member 0 first. Writes the LHAPDF
+// grids output_prefix_ce.dat, _up.dat, and _dn.dat; output_prefix is the name
+// of input without its extension by default.
+{
+  string input = argv[2];
+  while (input.size() > 1 && input[input.size() - 1] == '/')
+    input.erase(input.size() - 1);
+  job.err_type = argv[3];
+  if (job.err_type != "mc" && job.err_type != "he68" && job.err_type != "he90")
+  {
+    cout << "error_type = " << job.err_type << " is not supported by std_devs_grid, use mc, he68, or he90." << endl;
+    exit(1);
+  }
+
+  vector<string> inputfiles = MCgridFiles(input);
+  string prefix = input.substr(input.rfind('/') + 1);
+  struct stat st;
+  if (stat(input.c_str(), &st) == 0 && !S_ISDIR(st.st_mode) && prefix.rfind('.') != string::npos &&
+      prefix.rfind('.') > 0)
+    prefix.erase(prefix.rfind('.'));
+  if (argc > 4)
+    prefix = argv[4];
+
+  vector<LHAGrid *> errgrids = LHAGrid::ErrorGrids(inputfiles, job.err_type);
+  const char *suffixes[] = {"_ce.dat", "_up.dat", "_dn.dat"};
+  GridFileWriter writer(3);
+  for (int ierr = 0; ierr <= 2; ierr++)
+  {
+    errgrids[ierr]->WriteLHAGrid(prefix + suffixes[ierr], writer);
+    delete errgrids[ierr];
+  }
+  writer.Finish();
+  cout << "Wrote the " << job.err_type << " errors of " << inputfiles.size() << " members of " << input << " into "
+       << prefix << "_ce.dat, " << prefix << "_up.dat, and " << prefix << "_dn.dat" << endl;
+  return 0;
+} // MCStdDevsGrid ->
+
+vector<string> MCgridFiles(const string &input)
+// lk26 Returns the member grids of an ensemble given as an LHAPDF set directory (its .dat
+//      files in the order of their names), a .lhapack file, or a text file with the names of
+//      the grids, one per line, member 0 first.
+{
+  vector<string> inputfiles;
+  struct stat st;
+  if (stat(input.c_str(), &st) != 0)
+  {
+    cout << "Unable to open: " << input << endl;
+    exit(1);
+  }
+  if (S_ISDIR(st.st_mode))
+  { // member grids of an LHAPDF set directory, plain or compressed
+    DIR *dir = opendir(input.c_str());
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+    {
+      const string name = entry->d_name;
+      if (ends_with(name, ".dat") || ends_with(name, ".dat.gz") || ends_with(name, ".dat.zst"))
+        inputfiles.push_back(input + "/" + name);
+    }
+    closedir(dir);
+    sort(inputfiles.begin(), inputfiles.end());
+  }
+  else if (ends_with(input, ".lhapack"))
+  { // members of a packed set
+    const int nmem = LHAPackReader::Open(input)->NumMembers();
+    for (int k = 0; k < nmem; k++)
+      inputfiles.push_back(input + ":" + to_string(k));
+  }
+  else
+  { // list of grid files, one name per line
+    ifstream listfile(input.c_str());
+    string line;
+    while (getline(listfile, line))
+    {
+      if (line.find('#') != string::npos)
+        line.erase(line.find('#'));
+      trim(line);
+      if (!line.empty())
+        inputfiles.push_back(line);
+    }
+  }
+  return inputfiles;
+} // MCgridFiles ->
+
+int MCpack(int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x pack LHAPDF_set [packed_set.lhapack]
+// Writes the .info file and all member grids of the LHAPDF set into one
+// packed file, by default LHAPDF_set.lhapack in the current directory.
+// All members must have the same x, Q, and flavor grids.
+{
+  const string setname = argv[2];
+  const string packfile = (argc > 3) ? argv[3] : setname + ".lhapack";
+
+  LHAPDF::PDFSet set(setname);
+  const int nmem = set.size();
+  vector<string> gridpaths(nmem);
+  for (int k = 0; k < nmem; k++)
+    gridpaths[k] = LHAPDF::findpdfmempath(setname, k);
+
+  // the .info file is kept next to the member grids
+  const string setdir = gridpaths[0].substr(0, gridpaths[0].rfind('/') + 1);
+  ifstream infofile((setdir + setname + ".info").c_str());
+  if (!infofile.is_open())
+  {
+    cout << "Unable to open file: " << setdir + setname + ".info" << endl;
+    exit(1);
+  }
+  stringstream info;
+  info << infofile.rdbuf();
+  infofile.close();
+
+  // members are parsed on the thread pool, a few at a time, and appended
+  // to the packed file in the order of the set
+  ThreadPool &pool = mcgenPool();
+  LHAGrid *grid0 = NULL;
+  LHAPackWriter *writer = NULL;
+  GridReadAhead readahead(gridpaths, !LHAGridCache().Enabled());
+  for (int k0 = 0; k0 < nmem; k0 += pool.size())
+  {
+    const int k1 = min<int>(nmem, k0 + pool.size());
+    vector<LHAGrid *> grids(k1 - k0);
+    readahead.Need(k0);
+    pool.parallelFor(grids.size(), [&](size_t i) { grids[i] = new LHAGrid(gridpaths[k0 + i]); });
+
+    for (int k = k0; k < k1; k++)
+    {
+      LHAGrid *grid = grids[k - k0];
+      if (k == 0)
+      {
+        grid0 = grid;
+        LHAPackLayout layout;
+        layout.xValuesList = grid0->getxValuesList();
+        layout.qValuesList = grid0->getqValuesList();
+        layout.flavorsList = grid0->getflavorsList();
+        writer = new LHAPackWriter(packfile, setname, info.str(), layout, nmem);
+      }
+      else
+        grid0->CompareLHAGrid(grid0, grid, k); // all members share one layout
+
+      writer->AddMember(grid->getheaders(), grid->getpdfValuesList());
+      if (grid != grid0)
+        delete grid;
+    }
+  } // for (int k0 = 0; k0 < nmem; k0 += pool.size())
+  writer->Close();
+  delete writer;
+  delete grid0;
+
+  cout << "Packed " << nmem << " members of " << setname << " into " << packfile << endl;
+  return 0;
+} // MCpack ->
+
+int MCunpack(int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x unpack packed_set.lhapack [output_directory=.]
+// Recreates the LHAPDF set directory output_directory/setname from a
+// packed file.
+{
+  const string packfile = argv[2];
+  const string outdir = (argc > 3) ? argv[3] : ".";
+  const string setname = MCunpackSet(packfile, outdir);
+  cout << "Unpacked " << packfile << " into " << outdir + "/" + setname << endl;
+  return 0;
+} // MCunpack ->
+
+string MCunpackSet(const string &packfile, const string &outdir)
+// Writes the .info file and the member grids of packfile into the directory
+// outdir/setname and returns setname. The grids are written as plain .dat
+// files, which LHAPDF can read.
+{
+  std::shared_ptr<LHAPackReader> pack = LHAPackReader::Open(packfile);
+  const string setname = pack->SetName();
+  const string setdir = outdir + "/" + setname;
+  mkdir(outdir.c_str(), 0755);
+  if (mkdir(setdir.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    cout << "Unable to create directory: " << setdir << endl;
+    exit(1);
+  }
+
+  ofstream infofile((setdir + "/" + setname + ".info").c_str());
+  infofile << pack->Info();
+  infofile.close();
+  if (infofile.fail())
+  {
+    cout << "Error: could not write " << setdir + "/" + setname + ".info" << endl;
+    exit(1);
+  }
+
+  GridFileWriter writer(2 * mcgenPool().size()); // writes the members in batches (gridio.h)
+  mcgenPool().parallelFor(pack->NumMembers(), [&](size_t k) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d.dat", (int)k);
+    LHAGrid grid(packfile + ":" + to_string(k));
+    grid.WriteLHAGrid(setdir + "/" + setname + suffix, writer);
+  });
+  writer.Finish();
+  return setname;
+} // MCunpackSet ->
+
+// lk26 Options key=value of an operation, argv[first..argc-1]. Exits through
+//      MCoptionError if an option has no '=', its key is not one of keys, or, unless
+//      allowempty, its value is empty; the values are checked by the caller.
+map<string, string> MCparseOptions(int argc, char *argv[], int first, const string &operation,
+                                   const vector<string> &keys, const string &usage, bool allowempty)
+{
+  map<string, string> options;
+  for (int i = first; i < argc; i++)
+  {
+    const string arg = argv[i];
+    const size_t eq = arg.find('=');
+    if (eq == string::npos || find(keys.begin(), keys.end(), arg.substr(0, eq)) == keys.end() ||
+        (eq + 1 == arg.size() && !allowempty))
+      MCoptionError(arg, operation, usage);
+    options[arg.substr(0, eq)] = arg.substr(eq + 1);
+  }
+  return options;
+} // MCparseOptions ->
+
+// lk26 Value of the option key, or fallback if it was not given
+string MCoption(const map<string, string> &options, const string &key, const string &fallback)
+{
+  const map<string, string>::const_iterator it = options.find(key);
+  return it == options.end() ? fallback : it->second;
+} // MCoption ->
+
+void MCoptionError(const string &arg, const string &operation, const string &usage)
+{
+  cout << "Unknown option " << arg << " for " << operation << ", use " << usage << endl;
+  exit(1);
+} // MCoptionError ->
+
+// lk26 Reads the x and Q values of the .plt grid, job.xpltname and job.qpltname;
+//      exits if either is missing or empty
+void MCreadPltGrid(const MCjob &job, vector<double> &xgrid, vector<double> &qgrid)
+{
+  double num;
+  xgrid.clear();
+  qgrid.clear();
+  ifstream infile(job.xpltname.c_str());
+  while (infile >> num)
+    xgrid.push_back(num);
+  infile.close();
+  infile.open(job.qpltname.c_str());
+  while (infile >> num)
+    qgrid.push_back(num);
+  infile.close();
+  if (xgrid.empty() || qgrid.empty())
+  {
+    cout << "Unable to read the .plt grid from " << job.xpltname << " and " << job.qpltname << endl;
+    exit(1);
+  }
+} // MCreadPltGrid ->
+
+// lk26 .info file of the LHAPDF set setname, next to its member 0
+string MCsetInfoFile(const string &setname)
+{
+  const string path = LHAPDF::findpdfmempath(setname, 0);
+  return path.substr(0, path.rfind('/') + 1) + setname + ".info";
+} // MCsetInfoFile ->
+
+// lk26 Writes the .info file outname of a set with nmem members, copied from the .info
+//      file (or header) inname with NumMembers: nmem and, unless they are empty,
+//      ErrorType: errortype and ErrorConfLevel: conflevel; missing keys are appended.
+void MCwriteSetInfo(const string &inname, const string &outname, int nmem, const string &errortype,
+                    const string &conflevel)
+{
+  ifstream infofile(inname.c_str());
+  if (!infofile.is_open())
+  {
+    cout << "Unable to open file: " << inname << endl;
+    exit(1);
+  }
+  const string keys[3] = {"NumMembers:", "ErrorType:", "ErrorConfLevel:"};
+  const string values[3] = {to_string(nmem), errortype, conflevel};
+  bool written[3] = {false, errortype.empty(), conflevel.empty()};
+  ofstream outinfo(outname.c_str());
+  string line;
+  while (getline(infofile, line))
+  {
+    int k = 0;
+    while (k < 3 && !(starts_with(trim_left_copy(line), keys[k]) && !values[k].empty()))
+      k++;
+    if (k < 3)
+    {
+      outinfo << keys[k] << " " << values[k] << endl;
+      written[k] = true;
+    }
+    else
+      outinfo << line << endl;
+  }
+  for (int k = 0; k < 3; k++)
+    if (!written[k])
+      outinfo << keys[k] << " " << values[k] << endl;
+  outinfo.close();
+  if (outinfo.fail())
+  {
+    cout << "Error: could not write " << outname << endl;
+    exit(1);
+  }
+} // MCwriteSetInfo ->
+
+// Scratch directory of a packed input set, removed at exit
+string packedInputDir;
+
+int MCremoveEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+  return remove(path); // files and, walking depth first, emptied directories
+} // MCremoveEntry ->
+
+void MCremovePackedInput()
+{
+  if (packedInputDir.empty())
+    return;
+  if (nftw(packedInputDir.c_str(), MCremoveEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+    cout << "Warning: could not remove " << packedInputDir << endl;
+} // MCremovePackedInput ->
+
+void MCopenPackedInput(MCjob &job)
+// If the input set inpdfname is a .lhapack file, its members are unpacked
+// into a scratch directory that is put first on the LHAPDF search path, and
+// inpdfname is replaced by the name of the packed set.
+{
+  if (job.inpdfname.size() < 8 || job.inpdfname.compare(job.inpdfname.size() - 8, 8, ".lhapack") != 0)
+    return;
+
+  const char *tmpdir = getenv("TMPDIR");
+  string dirtemplate = string(tmpdir != NULL ? tmpdir : "/tmp") + "/mcgen-XXXXXX";
+  vector<char> dirname(dirtemplate.begin(), dirtemplate.end());
+  dirname.push_back('\0');
+  if (mkdtemp(dirname.data()) == NULL)
+  {
+    cout << "Unable to create a scratch directory for " << job.inpdfname << endl;
+    exit(1);
+  }
+  packedInputDir = dirname.data();
+  atexit(MCremovePackedInput);
+
+  job.inpdfname = MCunpackSet(job.inpdfname, packedInputDir);
+  LHAPDF::pathsPrepend(packedInputDir);
+} // MCopenPackedInput ->
+
+// lk26 LHAPDF members kept between the jobs of "mcgen.x serve", empty otherwise
+LRUCache<LHAPDF::PDF> &MCpdfCache()
+{
+  static LRUCache<LHAPDF::PDF> *cache = new LRUCache<LHAPDF::PDF>();
+  return *cache;
+} // MCpdfCache ->
+
+shared_ptr<LHAPDF::PDF> MCmemberPDF(const LHAPDF::PDFSet &set, const string &setname, int imem)
+// Member imem of set, from MCpdfCache() if "mcgen.x serve" or "mcgen.x pipeline" keeps it there
+{
+  const string path = LHAPDF::findpdfmempath(setname, imem);
+  shared_ptr<LHAPDF::PDF> p = MCpdfCache().Find(path);
+  if (!p)
+  {
+    p.reset(set.mkPDF(imem));
+    if (MCpdfCache().Enabled()) // e.g. for the later steps of "mcgen.x pipeline"
+    {
+      const CacheStamp stamp = cacheStampOf(path);
+      MCpdfCache().Insert(path, stamp, p, stamp.size);
+    }
+  }
+  return p;
+} // MCmemberPDF ->
+
+// Jobs accepted by "mcgen.x serve"
+const char *serveJobs[] = {"generate", "convert", "std_devs", "add", "average", NULL};
+// Environment passed from the client to the job
+const char *serveEnvironment[] = {"LHAPDF_DATA_PATH", "LHAPATH", "MCGEN_NTHREADS", "TMPDIR", NULL};
+// Last line of every reply, followed by the exit status of the job
+const string serveStatusTag = "#MCGEN-STATUS ";
+// File into which a job writes the paths it had to parse
+string serveMissFile;
+
+void MCwriteServeMisses()
+// Called at the exit of a job run by the server
+{
+  ofstream missfile(serveMissFile.c_str());
+  const vector<string> grids = LHAGridCache().Misses(), pdfs = MCpdfCache().Misses();
+  // members unpacked into a scratch directory are removed with it
+  for (size_t i = 0; i < grids.size(); i++)
+    if (packedInputDir.empty() || grids[i].compare(0, packedInputDir.size(), packedInputDir) != 0)
+      missfile << "grid " << grids[i] << endl;
+  for (size_t i = 0; i < pdfs.size(); i++)
+    if (packedInputDir.empty() || pdfs[i].compare(0, packedInputDir.size(), packedInputDir) != 0)
+      missfile << "pdf " << pdfs[i] << endl;
+} // MCwriteServeMisses ->
+
+bool MCsendAll(int fd, const string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+} // MCsendAll ->
+
+int MCserve(int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x serve socket_path [cache=4096]
+// Runs the jobs sent by "mcgen.x submit" to the Unix socket socket_path,
+// one at a time in the order of arrival, and keeps the member grids and the
+// LHAPDF members they read in an LRU cache of at most cache MB (half for
+// each), so that repeated jobs on the same inputs do not parse them again.
+//
+// Every job runs in a child process with the working directory and the
+// LHAPDF and mcgen environment variables of the client. The child starts
+// with a copy of the cache and sends its output to the client while it
+// runs, followed by the line "#MCGEN-STATUS n" with its exit status. The
+// files that missed in the cache are parsed by the server after the job.
+// The server never uses the thread pool itself, so that the children can
+// start their own. "mcgen.x submit socket_path stop" stops the server.
+{
+  const string socketpath = argv[2];
+  double cachemb = 4096.;
+  for (int i = 3; i < argc; i++)
+  {
+    const string arg = argv[i];
+    if (arg.compare(0, 6, "cache=") == 0 && atof(arg.c_str() + 6) >= 0.)
+      cachemb = atof(arg.c_str() + 6);
+    else
+    {
+      cout << "Unknown option " << arg << " for serve, use cache=MB" << endl;
+      exit(1);
+    }
+  }
+  const size_t budget = (size_t)(cachemb * 0.5 * 1048576.);
+  LHAGridCache().SetBudget(budget);
+  MCpdfCache().SetBudget(budget);
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socketpath.size() >= sizeof(addr.sun_path))
+  {
+    cout << "Error: the socket path " << socketpath << " is too long" << endl;
+    exit(1);
+  }
+  strcpy(addr.sun_path, socketpath.c_str());
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketpath.c_str()); // left over from a server that was killed
+  const mode_t oldmask = umask(0077); // only the owner may connect and submit jobs
+  const bool bound = listener >= 0 && bind(listener, (sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(oldmask);
+  if (!bound || listen(listener, 16) != 0)
+  {
+    cout << "Error: cannot listen on " << socketpath << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN); // clients that disconnect
+  cout << "mcgen serve: listening on " << socketpath << ", cache " << cachemb << " MB" << endl;
+
+  for (int njobs = 0;;)
+  {
+    const int client = accept(listener, NULL, NULL);
+    if (client < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      cout << "Error: accept failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    // Request: "cwd <dir>", "env <NAME=value>" lines, "arg <value>" lines, and an empty line
+    string request, cwd;
+    vector<string> env, args;
+    char buffer[4096];
+    while (request.size() < 2 || request.compare(request.size() - 2, 2, "\n\n") != 0)
+    {
+      ssize_t n = read(client, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      request.append(buffer, n);
+    }
+    istringstream lines(request);
+    string line;
+    while (getline(lines, line) && !line.empty())
+    {
+      if (line.compare(0, 4, "cwd ") == 0)
+        cwd = line.substr(4);
+      else if (line.compare(0, 4, "env ") == 0)
+        env.push_back(line.substr(4));
+      else if (line.compare(0, 4, "arg ") == 0)
+        args.push_back(line.substr(4));
+    }
+
+    if (!args.empty() && args[0] == "stop")
+    {
+      MCsendAll(client, "mcgen serve: stopping\n" + serveStatusTag + "0\n");
+      close(client);
+      break;
+    }
+    bool known = false;
+    for (int i = 0; serveJobs[i] != NULL; i++)
+      known = known || (!args.empty() && args[0] == serveJobs[i]);
+    if (!known || cwd.empty())
+    {
+      MCsendAll(client, "mcgen serve runs generate, convert, std_devs, add, and average, not " +
+                            (args.empty() ? string("an empty request") : args[0]) + "\n" + serveStatusTag + "1\n");
+      close(client);
+      continue;
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    string misstemplate = string(tmpdir != NULL ? tmpdir : "/tmp") + "/mcgen-misses-XXXXXX";
+    vector<char> missname(misstemplate.begin(), misstemplate.end());
+    missname.push_back('\0');
+    const int missfd = mkstemp(missname.data());
+    if (missfd >= 0)
+      close(missfd);
+    serveMissFile = missname.data();
+
+    njobs++;
+    cout << "mcgen serve: job " << njobs << " in " << cwd << ":";
+    for (size_t i = 0; i < args.size() && i < 4; i++)
+      cout << " " << args[i];
+    if (args.size() > 4)
+      cout << " ... (" << args.size() - 1 << " parameters)";
+    cout << endl;
+    const time_t start = time(NULL);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    { // the job
+      close(listener);
+      dup2(client, 1);
+      dup2(client, 2);
+      close(client);
+      for (size_t i = 0; i < env.size(); i++)
+      { // only the variables of serveEnvironment, whatever the client sends
+        const size_t eq = env[i].find('=');
+        const string name = env[i].substr(0, eq);
+        int k = 0;
+        while (serveEnvironment[k] != NULL && name != serveEnvironment[k])
+          k++;
+        if (eq != string::npos && serveEnvironment[k] != NULL)
+          setenv(name.c_str(), env[i].substr(eq + 1).c_str(), 1);
+        else
+          cout << "Note: ignored the environment variable " << name << " sent by the client" << endl;
+      }
+      if (chdir(cwd.c_str()) != 0)
+      {
+        cout << "Unable to enter the directory " << cwd << endl;
+        exit(1);
+      }
+      LHAGridCache().RecordMisses();
+      MCpdfCache().RecordMisses();
+      if (missfd >= 0)
+        atexit(MCwriteServeMisses);
+      vector<char *> jobargv(1, argv[0]);
+      for (size_t i = 0; i < args.size(); i++)
+        jobargv.push_back(&args[i][0]);
+      jobargv.push_back(NULL);
+      exit(MCrun(args.size() + 1, jobargv.data()));
+    }
+
+    int status = 1;
+    if (pid < 0)
+      MCsendAll(client, string("mcgen serve: fork failed: ") + strerror(errno) + "\n");
+    else
+    {
+      int wstatus = 0;
+      while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+        ;
+      status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+    }
+    ostringstream tag;
+    tag << serveStatusTag << status << "\n";
+    MCsendAll(client, tag.str());
+    close(client);
+
+    // parse the files that missed into the cache for the next jobs
+    int nparsed = 0;
+    ifstream missfile(serveMissFile.c_str());
+    while (status == 0 && getline(missfile, line))
+    {
+      if (line.compare(0, 5, "grid ") == 0)
+      {
+        const string path = line.substr(5);
+        if (cacheStampOf(path).mtime >= 0 && !LHAGridCache().Find(path))
+        {
+          LHAGrid::CacheLHAGrid(path);
+          nparsed++;
+        }
+      }
+      else if (line.compare(0, 4, "pdf ") == 0)
+      {
+        const string path = line.substr(4);
+        const CacheStamp stamp = cacheStampOf(path);
+        if (stamp.mtime < 0 || MCpdfCache().Find(path))
+          continue;
+        try
+        {
+          shared_ptr<LHAPDF::PDF> p(new LHAPDF::GridPDF(path));
+          MCpdfCache().Insert(path, stamp, p, stamp.size);
+          nparsed++;
+        }
+        catch (...)
+        {
+          cout << "mcgen serve: could not read " << path << endl;
+        }
+      }
+    } // while (status == 0...
+    missfile.close();
+    unlink(serveMissFile.c_str());
+    cout << "mcgen serve: job " << njobs << " finished with status " << status << " after " << time(NULL) - start
+         << " s; cached " << nparsed << " new files; cache holds " << LHAGridCache().Size() << " grids and "
+         << MCpdfCache().Size() << " LHAPDF members, " << fixed << setprecision(1)
+         << (LHAGridCache().Bytes() + MCpdfCache().Bytes()) / 1048576. << " MB" << defaultfloat << endl;
+  } // for (int njobs = 0...
+
+  close(listener);
+  unlink(socketpath.c_str());
+  return 0;
+} // MCserve ->
+
+int MCsubmit(int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x submit socket_path job [parameters]
+// Sends a job to "mcgen.x serve" on socket_path, prints its output while it
+// runs, and exits with its exit status.
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[2], sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    cout << "Error: no mcgen server on " << argv[2] << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+  {
+    cout << "Error: cannot get the working directory" << endl;
+    exit(1);
+  }
+  string request = string("cwd ") + cwd + "\n";
+  for (int i = 0; serveEnvironment[i] != NULL; i++)
+    if (getenv(serveEnvironment[i]) != NULL)
+      request += string("env ") + serveEnvironment[i] + "=" + getenv(serveEnvironment[i]) + "\n";
+  for (int i = 3; i < argc; i++)
+    request += string("arg ") + argv[i] + "\n";
+  request += "\n";
+  if (!MCsendAll(fd, request))
+  {
+    cout << "Error: could not send the job to " << argv[2] << endl;
+    exit(1);
+  }
+
+  // The output is printed as it arrives, except for the last bytes that may
+  // belong to the status line
+  const size_t tail = serveStatusTag.size() + 16;
+  string pending;
+  char buffer[65536];
+  for (;;)
+  {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    pending.append(buffer, n);
+    if (pending.size() > tail)
+    {
+      cout.write(pending.data(), pending.size() - tail);
+      cout.flush();
+      pending.erase(0, pending.size() - tail);
+    }
+  }
+  close(fd);
+
+  const size_t itag = pending.rfind(serveStatusTag);
+  if (itag == string::npos)
+  {
+    cout << pending << endl << "Error: lost the connection to the mcgen server" << endl;
+    return 1;
+  }
+  cout << pending.substr(0, itag);
+  cout.flush();
+  return atoi(pending.c_str() + itag + serveStatusTag.size());
+} // MCsubmit ->
+
+// lk26 A job of "mcgen.x batch": a line "directory operation [parameters]" of the job list
+struct MCbatchJob
+{
+  int line = 0;         // line in the job list
+  string dir;           // working directory
+  vector<string> args;  // operation and parameters
+  MCjob context;        // parameters of the card, read by the batch process
+  bool cardread = false;
+  pid_t pid = -1;
+  time_t start = 0;
+};
+
+void MCbatchInputs(MCbatchJob &b, vector<string> &gridsets, vector<string> &pdfsets)
+// Input sets of the job b that are read member by member: as LHAGrid member
+// grids (gridsets) or as LHAPDF members (pdfsets)
+{
+  const string &op = b.args[0];
+  if ((op == "generate" || op == "pipeline") && b.args.size() >= 2)
+  {
+    if (!b.cardread)
+    { // read the card once, in the directory of the job
+      if (!ifstream(b.args[1].c_str()).good())
+        return; // may be written by an earlier job
+      b.context.cardname = b.args[1];
+      MCread_card(b.context);
+      b.cardread = true;
+    }
+    pdfsets.push_back(b.context.inpdfname);
+    if (op == "pipeline") // std_devs of the input set
+      gridsets.push_back(b.context.inpdfname);
+  }
+  else if ((op == "convert" || op == "std_devs" || op == "correlations" || op == "compress" ||
+            op == "mc2hessian" || op == "validate") && b.args.size() >= 2)
+    gridsets.push_back(b.args[1]);
+} // MCbatchInputs ->
+
+int MCbatch(int argc, char *argv[])
+//========================================================================
+// Usage: mcgen.x batch jobs.list [jobs=N] [cache=4096]
+// Runs the jobs listed in jobs.list, one per line in the form
+//   directory operation [parameters]
+// e.g. "Pb208 pipeline mcgen.card" or "Pb208 std_devs MCPb208 mc", where
+// operation and parameters are those of "mcgen.x operation [parameters]" and
+// directory is the working directory of the job. Empty lines and lines that
+// start with # are skipped. A line "wait" holds the jobs below it until all
+// jobs above it have finished, for jobs that read the output of earlier jobs.
+//
+// Up to N jobs run at a time (default: the number of threads), each in a
+// child process with its own job context and working directory; the threads
+// of MCGEN_NTHREADS are divided among the jobs that run at the same time. The
+// output of the job on line L goes into directory/mcgen_batch_L.log.
+// Before the jobs after a "wait" start, every input set that two or more of
+// the remaining jobs read is loaded once into the caches of "mcgen.x serve"
+// (at most cache MB, half for each), and the jobs take its members from there
+// instead of reading them again. If a job fails, the jobs after the next
+// "wait" are not started, and batch returns 1.
+{
+  if (argc < 3)
+  {
+    cout << "Usage: mcgen.x batch jobs.list [jobs=N] [cache=4096]" << endl;
+    exit(1);
+  }
+  const unsigned nthreads = mcgenNumThreads();
+  unsigned maxjobs = nthreads;
+  double cachemb = 4096.;
+  for (int i = 3; i < argc; i++)
+  {
+    const string arg = argv[i];
+    if (arg.compare(0, 5, "jobs=") == 0 && atoi(arg.c_str() + 5) > 0)
+      maxjobs = atoi(arg.c_str() + 5);
+    else if (arg.compare(0, 6, "cache=") == 0 && atof(arg.c_str() + 6) >= 0.)
+      cachemb = atof(arg.c_str() + 6);
+    else
+    {
+      cout << "Unknown option " << arg << " for batch, use jobs=N or cache=MB" << endl;
+      exit(1);
+    }
+  }
+
+  // Read the job list; stages are separated by "wait"
+  ifstream listfile(argv[2]);
+  if (!listfile.is_open())
+  {
+    cout << "Unable to open file: " << argv[2] << endl;
+    exit(1);
+  }
+  const char *batchOps[] = {"generate", "pipeline", "convert", "std_devs", "std_devs_grid", "correlations",
+                            "compress", "mc2hessian", "validate", "average", "add", "multiply", "pack", "unpack",
+                            "merge-shards", NULL};
+  vector<MCbatchJob> jobs;
+  vector<size_t> stageEnd; // the jobs of stage k are jobs[stageEnd[k-1]..stageEnd[k]-1]
+  string line;
+  for (int iline = 1; getline(listfile, line); iline++)
+  {
+    istringstream words(line);
+    vector<string> tokens;
+    string word;
+    while (words >> word)
+      tokens.push_back(word);
+    if (tokens.empty() || tokens[0][0] == '#')
+      continue;
+    if (tokens.size() == 1 && tokens[0] == "wait")
+    {
+      if (!jobs.empty() && (stageEnd.empty() || stageEnd.back() < jobs.size()))
+        stageEnd.push_back(jobs.size());
+      continue;
+    }
+    bool known = false;
+    for (int i = 0; tokens.size() >= 2 && batchOps[i] != NULL; i++)
+      known = known || tokens[1] == batchOps[i];
+    if (!known)
+    {
+      cout << argv[2] << ", line " << iline << ": expected \"directory operation [parameters]\" with a "
+           << "generate, pipeline, convert, std_devs, ... operation, or \"wait\"" << endl;
+      exit(1);
+    }
+    MCbatchJob b;
+    b.line = iline;
+    b.dir = tokens[0];
+    b.args.assign(tokens.begin() + 1, tokens.end());
+    jobs.push_back(b);
+  }
+  if (stageEnd.empty() || stageEnd.back() < jobs.size())
+    stageEnd.push_back(jobs.size());
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+  {
+    cout << "Error: unable to get the working directory" << endl;
+    exit(1);
+  }
+  const size_t budget = (size_t)(cachemb * 0.5 * 1048576.);
+  LHAGridCache().SetBudget(budget);
+  MCpdfCache().SetBudget(budget);
+  cout << "mcgen batch: " << jobs.size() << " jobs in " << stageEnd.size() << " stages, up to " << maxjobs
+       << " at a time, " << nthreads << " threads" << endl;
+
+  int nfailed = 0;
+  size_t first = 0;
+  for (size_t istage = 0; istage < stageEnd.size() && nfailed == 0; istage++)
+  {
+    const size_t last = stageEnd[istage];
+
+    // Input sets read by two or more of the remaining jobs, found from the
+    // directories of the jobs (the sets of later stages may not exist yet)
+    map<string, int> gridcount, pdfcount;          // member 0 path -> number of jobs
+    map<string, pair<string, string>> setlocation; // member 0 path -> (directory, set name)
+    for (size_t k = first; k < jobs.size(); k++)
+    {
+      if (chdir(cwd) != 0 || chdir(jobs[k].dir.c_str()) != 0)
+        continue; // the directory may be created by an earlier job
+      vector<string> gridsets, pdfsets;
+      MCbatchInputs(jobs[k], gridsets, pdfsets);
+      for (int kind = 0; kind < 2; kind++)
+      {
+        const vector<string> &sets = kind == 0 ? gridsets : pdfsets;
+        for (size_t i = 0; i < sets.size(); i++)
+        {
+          if (sets[i].size() >= 8 && sets[i].compare(sets[i].size() - 8, 8, ".lhapack") == 0)
+            continue; // unpacked by the job into its own scratch directory
+          const string path0 = LHAPDF::findpdfmempath(sets[i], 0);
+          if (path0.empty())
+            continue;
+          const string key = cacheKey(path0);
+          (kind == 0 ? gridcount : pdfcount)[key]++;
+          setlocation[key] = make_pair(jobs[k].dir, sets[i]);
+        }
+      }
+    } // for (size_t k = first...
+
+    // Load them; the member grids are parsed on threads that finish before
+    // the jobs are forked, the LHAPDF members one at a time
+    for (int kind = 0; kind < 2; kind++)
+    {
+      const map<string, int> &counts = kind == 0 ? gridcount : pdfcount;
+      for (map<string, int>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+      {
+        if (it->second < 2 || chdir(cwd) != 0 || chdir(setlocation[it->first].first.c_str()) != 0)
+          continue;
+        const string &setname = setlocation[it->first].second;
+        const time_t start = time(NULL);
+        try
+        {
+          const LHAPDF::PDFSet set(setname);
+          if (kind == 0)
+          {
+            vector<string> paths(set.size());
+            for (size_t imem = 0; imem < paths.size(); imem++)
+              paths[imem] = cacheKey(LHAPDF::findpdfmempath(setname, imem));
+            atomic<size_t> nextpath(0);
+            vector<thread> loaders;
+            for (unsigned t = 0; t < nthreads; t++)
+              loaders.push_back(thread([&]() {
+                for (size_t imem; (imem = nextpath++) < paths.size();)
+                  LHAGrid::CacheLHAGrid(paths[imem]);
+              }));
+            for (size_t t = 0; t < loaders.size(); t++)
+              loaders[t].join();
+          }
+          else
+            for (size_t imem = 0; imem < set.size(); imem++)
+              MCmemberPDF(set, setname, imem);
+          cout << "mcgen batch: loaded " << set.size() << (kind == 0 ? " member grids" : " LHAPDF members")
+               << " of " << setname << " for " << it->second << " jobs in " << time(NULL) - start << " s" << endl;
+        }
+        catch (...)
+        {
+          cout << "mcgen batch: could not load " << setname << "; the jobs read it themselves" << endl;
+        }
+      } // for (map<string, int>::const_iterator it...
+    } // for (int kind = 0...
+    if (chdir(cwd) != 0)
+    {
+      cout << "Error: unable to return to " << cwd << endl;
+      exit(1);
+    }
+
+    // Run the jobs of the stage, up to maxjobs at a time
+    const unsigned nparallel = min<size_t>(maxjobs, last - first);
+    const unsigned jobthreads = max(1u, nthreads / nparallel);
+    size_t next = first;
+    unsigned nrunning = 0;
+    while (next < last || nrunning > 0)
+    {
+      for (; next < last && nrunning < nparallel; next++, nrunning++)
+      {
+        MCbatchJob &b = jobs[next];
+        cout << "mcgen batch: job " << next + 1 << " (line " << b.line << ") in " << b.dir << ":";
+        for (size_t i = 0; i < b.args.size() && i < 4; i++)
+          cout << " " << b.args[i];
+        if (b.args.size() > 4)
+          cout << " ... (" << b.args.size() - 1 << " parameters)";
+        cout << endl;
+        b.start = time(NULL);
+        b.pid = fork();
+        if (b.pid == 0)
+        { // the job
+          if (chdir(b.dir.c_str()) != 0)
+          {
+            cout << "Unable to enter the directory " << b.dir << endl;
+            exit(1);
+          }
+          const string logname = "mcgen_batch_" + to_string(b.line) + ".log";
+          const int logfd = open(logname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+          if (logfd < 0)
+          {
+            cout << "Unable to create " << b.dir << "/" << logname << endl;
+            exit(1);
+          }
+          dup2(logfd, 1);
+          dup2(logfd, 2);
+          close(logfd);
+          setenv("MCGEN_NTHREADS", to_string(jobthreads).c_str(), 1);
+          vector<char *> jobargv(1, argv[0]);
+          for (size_t i = 0; i < b.args.size(); i++)
+            jobargv.push_back(&b.args[i][0]);
+          jobargv.push_back(NULL);
+          exit(MCrun(b.args.size() + 1, jobargv.data()));
+        }
+        if (b.pid < 0)
+        {
+          cout << "mcgen batch: fork failed: " << strerror(errno) << endl;
+          nfailed++;
+          nrunning--;
+        }
+        cout.flush();
+      } // for (; next < last...
+      if (nrunning == 0)
+        continue;
+
+      int wstatus = 0;
+      const pid_t pid = wait(&wstatus);
+      if (pid < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      nrunning--;
+      for (size_t k = first; k < next; k++)
+        if (jobs[k].pid == pid)
+        {
+          const int status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+          if (status != 0)
+            nfailed++;
+          cout << "mcgen batch: job " << k + 1 << " (line " << jobs[k].line << ") finished with status " << status
+               << " after " << time(NULL) - jobs[k].start << " s" << endl;
+        }
+    } // while (next < last...
+    first = last;
+  } // for (size_t istage = 0...
+
+  if (nfailed > 0)
+    cout << "mcgen batch: " << nfailed << " jobs failed; " << jobs.size() - first << " jobs were not started" << endl;
+  else
+    cout << "mcgen batch: all " << jobs.size() << " jobs finished" << endl;
+  return nfailed > 0 ? 1 : 0;
+} // MCbatch ->
+
+// lk23 added function to sort flavors plt format
+bool pltSort(int a, int b) 
+{
+  int abs_a = std::abs(a);
+  int abs_b = std::abs(b);
+
+  // Check if a or b is 21
+  if (abs_a == 21 || abs_b == 21) 
+    // If either is 21, it should come first
+    return abs_a == 21;
+
+  // Check if a is -2 and b is 2, in which case -2 should come before 2
+  if (abs_a == 2 && abs_b == 2)
+    return a > b;
+
+  // Check if a or b is 2 or -2
+  if (abs_a == 2 || abs_b == 2)
+    // If either is 2 or -2, it should come before 1 or -1
+    return abs_a == 2;
+
+  // Check if both numbers have the same absolute value
+  if (abs_a == abs_b) 
+    // If absolute values are the same, sort by their sign
+    return a > b;
+
+  // If absolute values are different, sort by their absolute value
+  return abs_a < abs_b;
+} // pltSort ->
+
+// lk26 added function to evaluate the output flavors of flavormap at all x in xgrid
+//      and scale q. xfout[ifl*nx + ix] is flavor ifl at xgrid[ix]. Each point needs one
+//      all-flavor LHAPDF call; the map is applied to the whole row of points at once.
+void MCevaluateFlavors(LHAPDF::PDF *p, const FlavorMap &flavormap, const vector<double> &xgrid, double q,
+                       vector<double> &xfcells, vector<double> &xfout)
+{
+  const size_t nx = xgrid.size(), nin = flavormap.NumInputs();
+  const vector<int> &extra = flavormap.ExtraPIDs();
+  vector<double> xfin;
+  xfcells.resize(nx * nin);
+  xfout.resize(flavormap.NumOutputs() * nx);
+  for (size_t ix = 0; ix < nx; ++ix)
+  {
+    p->xfxQ(xgrid[ix], q, xfin); // PDG IDs -6..6
+    copy(xfin.begin(), xfin.begin() + flavorMapNumPartons, xfcells.begin() + ix * nin);
+    for (size_t i = 0; i < extra.size(); ++i)
+      xfcells[ix * nin + flavorMapNumPartons + i] = p->xfxQ(extra[i], xgrid[ix], q);
+  }
+  flavormap.ApplyBlock(xfcells.data(), nx, xfout.data());
+} // MCevaluateFlavors() ->
+
+// lk26 added function to make the interpolation stencils of the points (xgrid, qgrid) for
+//      the inputs of flavormap from the knots of layout (member 0). The stencils reproduce
+//      the log-bicubic interpolation of LHAPDF, in the subgrid sub of layout if sub >= 0.
+//      They are not valid if the set uses another interpolator or ForcePositive, or if a
+//      point needs extrapolation; the members are then interpolated by LHAPDF.
+InterpolationStencils MCmakeStencils(const LHAPDF::PDFInfo &info, const LHAGrid &layout, const FlavorMap &flavormap,
+                                     const vector<double> &xgrid, const vector<double> &qgrid, int sub)
+{
+  string interpolator = info.has_key("Interpolator") ? info.get_entry("Interpolator") : "logcubic";
+  to_lower(interpolator);
+  const string forcepositive = info.has_key("ForcePositive") ? info.get_entry("ForcePositive") : "0";
+
+  InterpolationStencils stencils;
+  if (interpolator != "logcubic" && interpolator != "logbicubic")
+    cout << "Note: Interpolator " << interpolator << " is evaluated by LHAPDF" << endl;
+  else if (trim_copy(forcepositive) != "0")
+    cout << "Note: ForcePositive is evaluated by LHAPDF" << endl;
+  else
+  {
+    stencils = InterpolationStencils(layout, xgrid, qgrid, flavormap.InputPIDs(), sub);
+    if (!stencils.Valid())
+      cout << "Note: the PDFs are interpolated by LHAPDF, " << stencils.Reason() << endl;
+  }
+  return stencils;
+} // MCmakeStencils() ->
+
+// lk26 added function to evaluate the output flavors of flavormap at Q point iq of the
+//      stencils from the knot values of member, in the same layout as the LHAPDF version above
+void MCevaluateFlavors(const InterpolationStencils &stencils, const LHAGrid &member, const FlavorMap &flavormap,
+                       size_t iq, vector<double> &xfcells, vector<double> &xfout)
+{
+  const size_t nx = stencils.NumX();
+  xfcells.resize(nx * flavormap.NumInputs());
+  xfout.resize(flavormap.NumOutputs() * nx);
+  stencils.Evaluate(member, iq, xfcells.data());
+  flavormap.ApplyBlock(xfcells.data(), nx, xfout.data());
+} // MCevaluateFlavors() ->
+
+// lk26 added function to evaluate the members 0..nread-1 of set in parallel on the points
+//      (qgrid[iq], xgrid[ix], output flavor flsel[ifl] of flavormap), weighted by xweight[ix]:
+//      F[imem*nv + (iq*nx + ix)*nfl + ifl], nv = nq*nx*nfl. The values are rounded to pdfstore_t.
+//      set is the LHAPDF set setname. Member 0 is given by pdf0; the other members are read
+//      by LHAPDF only if the stencils are not valid.
+void MCevaluateMembers(LHAPDF::PDFSet &set, const string &setname, LHAPDF::PDF *pdf0,
+                       const InterpolationStencils &stencils, const FlavorMap &flavormap, const vector<int> &flsel,
+                       const vector<double> &xgrid, const vector<double> &qgrid, const vector<double> &xweight,
+                       int nread, vector<double> &F)
+{
+  const size_t nx = xgrid.size(), nq = qgrid.size(), nfl = flsel.size(), nv = nq * nx * nfl;
+  F.assign((size_t)nread * nv, 0.);
+  vector<PrecisionReport> reports(nread);
+  vector<string> memberfiles; // read ahead in batches (gridio.h)
+  for (int imem = 0; imem < nread && stencils.Valid(); imem++)
+    memberfiles.push_back(LHAPDF::findpdfmempath(setname, imem));
+  GridReadAhead readahead(memberfiles, !LHAGridCache().Enabled());
+  mcgenPool().parallelFor(nread, [&](size_t imem) {
+    vector<double> xfcells, xfout;
+    LHAGrid *member = NULL;
+    LHAPDF::PDF *p = NULL;
+    if (stencils.Valid())
+    {
+      readahead.Need(imem);
+      member = new LHAGrid(memberfiles[imem]);
+      stencils.CheckMember(*member);
+    }
+    else if (imem > 0)
+      p = set.mkPDF(imem);
+    double *row = &F[imem * nv];
+    for (size_t iq = 0; iq < nq; ++iq)
+    {
+      if (member)
+        MCevaluateFlavors(stencils, *member, flavormap, iq, xfcells, xfout);
+      else
+        MCevaluateFlavors(imem > 0 ? p : pdf0, flavormap, xgrid, qgrid[iq], xfcells, xfout);
+      for (size_t ix = 0; ix < nx; ++ix)
+        for (size_t ifl = 0; ifl < nfl; ++ifl)
+        {
+          const double xf = xweight[ix] * xfout[flsel[ifl] * nx + ix];
+          pdfstore_t stored = xf;
+          reports[imem].Record(xf, stored);
+          row[(iq * nx + ix) * nfl + ifl] = stored;
+        }
+    } // for (size_t iq = 0...
+    delete p;
+    delete member;
+  });
+  PrecisionReport report;
+  for (int imem = 0; imem < nread; ++imem)
+    report.Merge(reports[imem]);
+  report.Print("the input PDFs");
+} // MCevaluateMembers() ->
+
+// lk26 added function to parse a list of indices and ranges, e.g. "0-20,30", into 0..n-1.
+//      An empty list selects all n indices; what names the list in error messages.
+vector<int> MCparseIndexList(const string &list, int n, const string &what)
+{
+  vector<int> indices;
+  if (list.empty())
+  {
+    for (int i = 0; i < n; ++i)
+      indices.push_back(i);
+    return indices;
+  }
+  vector<string> items;
+  split(items, list, is_any_of(","));
+  for (size_t k = 0; k < items.size(); ++k)
+  {
+    istringstream iss(items[k]);
+    int first, last;
+    char dash;
+    string rest;
+    bool ok = (bool)(iss >> first);
+    last = first;
+    if (ok && iss >> dash)
+      ok = dash == '-' && (iss >> last) && !(iss >> rest);
+    if (!ok || first < 0 || last >= n || first > last)
+    {
+      cout << "Error: " << items[k] << " is not an index or range of indices 0.." << n - 1 << " of " << what << endl;
+      exit(1);
+    }
+    for (int i = first; i <= last; ++i)
+      indices.push_back(i);
+  }
+  return indices;
+} // MCparseIndexList() ->
+
+// lk26 Parses i/N of "generate mcgen.card shard=i/N"
+void MCparseShard(MCjob &job, const string &spec)
+{
+  int shard, nshards;
+  char rest;
+  if (sscanf(spec.c_str(), "%d/%d%c", &shard, &nshards, &rest) != 2 || nshards < 1 || shard < 1 ||
+      shard > nshards)
+  {
+    cout << "shard=" << spec << ": expected shard=i/N with 1 <= i <= N" << endl;
+    exit(1);
+  }
+  job.shard = shard;
+  job.nshards = nshards;
+} // MCparseShard() ->
+
+// lk26 Replicas [first, last) of shard i of N: the random replicas 1..nmc-1 of
+//      Hessian input (1..nmc of MC input) in N contiguous ranges
+void MCshardRange(const MCjob &job, int shard, int &first, int &last)
+{
+  const long nrep = job.err_type == "mc" ? job.nmc : job.nmc - 1;
+  if (job.nshards > nrep)
+  {
+    cout << job.nshards << " shards of " << nrep << " replicas: use at most " << nrep << " shards" << endl;
+    exit(1);
+  }
+  first = 1 + (shard - 1) * nrep / job.nshards;
+  last = 1 + shard * nrep / job.nshards;
+} // MCshardRange() ->
+
+// lk26 Files of shard i of N: outpdfname_shard_i_of_N + suffix
+string MCshardFileName(const MCjob &job, int shard, const string &suffix)
+{
+  return job.outpdfname + "_shard_" + to_string(shard) + "_of_" + to_string(job.nshards) + suffix;
+} // MCshardFileName() ->
+
+// lk26 Parameters of the card that the shards of one run must share
+string MCshardCardSignature(const MCjob &job)
+{
+  ostringstream sig;
+  sig << job.inpdfname << " " << job.outpdfname << " " << job.err_type << " nmc=" << job.nmc
+      << " nstart=" << job.nstart << " nsym=" << job.nsym << " nshift=" << job.nshift << " x=" << job.xlhaname
+      << " q=" << job.qlhaname;
+  return sig.str();
+} // MCshardCardSignature() ->
+
+// lk26 Output knots of one direction of a subgrid of the input set with the knots
+//      [lo, hi]: lo, the values of the card between lo and hi, and hi. The knots are
+//      written with 7 digits, so values within 1e-5 (relative) of a kept knot are
+//      dropped; the grid is not extended beyond the input, where LHAPDF extrapolates.
+vector<double> MCknotsInRange(const vector<double> &values, double lo, double hi)
+{
+  vector<double> knots(1, lo);
+  for (size_t i = 0; i < values.size(); i++)
+    if (values[i] > lo && values[i] < hi && values[i] - knots.back() > 1e-5 * values[i] &&
+        hi - values[i] > 1e-5 * hi)
+      knots.push_back(values[i]);
+  knots.push_back(hi);
+  return knots;
+} // MCknotsInRange() ->
+
+// lk26 Values of the x or Q grid file fname of the card, sorted. Returns false if the
+//      file does not exist.
+bool MCreadKnots(const string &fname, const string &what, vector<double> &values)
+{
+  ifstream infile(fname.c_str());
+  if (!infile.is_open())
+    return false;
+  double v;
+  while (infile >> v)
+  {
+    if (!(v > 0))
+    {
+      cout << "Error: the " << what << " values in " << fname << " must be positive, found " << v << endl;
+      exit(1);
+    }
+    values.push_back(v);
+  }
+  if (!infile.eof() || values.empty())
+  {
+    cout << "Error: cannot read the " << what << " values in " << fname << endl;
+    exit(1);
+  }
+  sort(values.begin(), values.end());
+  return true;
+} // MCreadKnots() ->
+
+// lk26 Knots of the replicas written by generate: every subgrid of the input set (split
+//      at the flavor thresholds) takes its first and last knots and the x and Q values of
+//      the files xlhaname and qlhaname of the card between them, so a threshold stays the
+//      last Q knot of one subgrid and the first of the next. A direction keeps the knots of
+//      the input if its file is "input" or does not exist. Returns true if the knots
+//      differ from those of the input.
+bool MCoutputKnots(const MCjob &job, const LHAGrid &input, vector<vector<double>> &xgrid,
+                   vector<vector<double>> &qgrid)
+{
+  xgrid = input.getxValuesList();
+  qgrid = input.getqValuesList();
+  const string names[2] = {job.xlhaname, job.qlhaname}, what[2] = {"x", "Q"};
+  vector<vector<double>> *knots[2] = {&xgrid, &qgrid};
+  for (int k = 0; k < 2; k++)
+  {
+    vector<double> values;
+    if (names[k] == "input")
+      continue;
+    if (!MCreadKnots(names[k], what[k], values))
+    {
+      cout << "Note: " << names[k] << " does not exist, the replicas have the " << what[k]
+           << " knots of the input set" << endl;
+      continue;
+    }
+    for (size_t isub = 0; isub < knots[k]->size(); isub++)
+    {
+      vector<double> &sub = (*knots[k])[isub];
+      if (sub.size() >= 2)
+        sub = MCknotsInRange(values, sub.front(), sub.back());
+    }
+  } // for (int k = 0...
+  return xgrid != input.getxValuesList() || qgrid != input.getqValuesList();
+} // MCoutputKnots() ->
+
+// Name of the .dat file of replica imc: prefix_0000 + ext
+string MCreplicaFileName(const string &prefix, int imc, const string &ext)
+{
+  if (imc < 10)
+    return prefix + "_000" + boost::lexical_cast<string>(imc) + ext;
+  else if (imc < 100)
+    return prefix + "_00" + boost::lexical_cast<string>(imc) + ext;
+  else if (imc < 1000)
+    return prefix + "_0" + boost::lexical_cast<string>(imc) + ext;
+  return prefix + "_" + boost::lexical_cast<string>(imc) + ext;
+} // MCreplicaFileName() ->
+
+double MCroundAsWritten(double value, int digits)
+// The value read back from the scientific format with digits decimals
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*e", digits, value);
+  return strtod(buf, NULL);
+} // MCroundAsWritten() ->
 
 // lk25 added function to parse optional flags in LHAPDF .info file if they are defined in the .info file
 //      and return a string of the variable name as a placeholder if they are not.
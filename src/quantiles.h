@@ -0,0 +1,179 @@
+#ifndef QUANTILES_H
+#define QUANTILES_H
+
+/*
+ * Description: Streaming estimates of quantiles of the PDF values in many
+ *              (x, Q, flavor) cells, used by "mcgen.x std_devs LHAPDF_set pct"
+ *              for the percentile bands of MC replicas.
+ *
+ *              Every cell keeps a merging t-digest (T. Dunning and O. Ertl,
+ *              arXiv:1902.04023): a sorted list of centroids (mean, weight),
+ *              where the weight of a centroid is limited by the scale function
+ *                k(q) = compression/(2 pi) asin(2q - 1)
+ *              to span at most 1 in k. Centroids near q = 0 and q = 1 hold
+ *              only a few values, so the tails of the distribution are
+ *              resolved best. A digest has at most compression + 2 centroids,
+ *              so the memory per cell does not depend on the number of
+ *              replicas. The smallest and the largest value are kept exactly.
+ *
+ *              The values of all cells arrive together, one per member. They
+ *              are buffered for digestBuffer members and merged into the
+ *              centroids cell by cell (MergeCells() can run in parallel on
+ *              disjoint cells). The estimates depend on the order of the
+ *              members only, not on the number of threads.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// default compression of the digests (about compression centroids per cell)
+const double digestCompression = 200.;
+// number of members buffered before they are merged into the digests
+const std::size_t digestBuffer = 32;
+
+class QuantileDigests
+{
+private:
+  double compression;
+  std::size_t ncells;
+  std::size_t capacity;           // maximal number of centroids per cell
+  std::vector<double> mean;       // [c*capacity + i]
+  std::vector<double> weight;     // [c*capacity + i]
+  std::vector<std::size_t> ncentroids;
+  std::vector<double> vmin, vmax; // smallest and largest value of each cell
+  std::vector<double> buffer;     // [b*ncells + c], buffered values
+  std::size_t nbuffered = 0;
+  std::size_t count = 0;          // values per cell merged so far
+
+  double K(double q) const
+  {
+    return compression / (2. * M_PI) * asin(2. * std::min(std::max(q, 0.), 1.) - 1.);
+  }
+
+public:
+  QuantileDigests(std::size_t n, double delta = digestCompression)
+      : compression(delta), ncells(n), capacity((std::size_t)ceil(delta) + 2), mean(n * capacity),
+        weight(n * capacity), ncentroids(n, 0), vmin(n, 0.), vmax(n, 0.), buffer(n * digestBuffer)
+  {
+  }
+
+  // Stores value[c] of the next member for all cells. Returns true when the
+  // buffer is full and MergeCells() must be called for all cells.
+  template <class T>
+  bool Add(const T *value)
+  {
+    double *b = &buffer[nbuffered * ncells];
+    for (std::size_t c = 0; c < ncells; c++)
+      b[c] = value[c];
+    nbuffered++;
+    return nbuffered == digestBuffer;
+  } // Add()
+
+  // Merges the buffered values of the cells c0..c1-1 into their digests
+  void MergeCells(std::size_t c0, std::size_t c1)
+  {
+    if (nbuffered == 0)
+      return;
+    std::vector<double> pts(nbuffered), m, w;
+    for (std::size_t c = c0; c < c1; c++)
+    {
+      for (std::size_t b = 0; b < nbuffered; b++)
+        pts[b] = buffer[b * ncells + c];
+      std::sort(pts.begin(), pts.end());
+      vmin[c] = count == 0 ? pts.front() : std::min(vmin[c], pts.front());
+      vmax[c] = count == 0 ? pts.back() : std::max(vmax[c], pts.back());
+
+      // merge the sorted centroids and the sorted new values
+      double *cm = &mean[c * capacity], *cw = &weight[c * capacity];
+      const std::size_t nc = ncentroids[c];
+      m.clear();
+      w.clear();
+      std::size_t i = 0, j = 0;
+      while (i < nc || j < nbuffered)
+        if (j == nbuffered || (i < nc && cm[i] <= pts[j]))
+        {
+          m.push_back(cm[i]);
+          w.push_back(cw[i++]);
+        }
+        else
+        {
+          m.push_back(pts[j++]);
+          w.push_back(1.);
+        }
+
+      // compress: join neighbors while a centroid spans at most 1 in k(q)
+      const double total = (double)(count + nbuffered);
+      std::size_t n = 0;
+      double wleft = 0.; // weight left of the current centroid
+      double kleft = K(0.);
+      cm[0] = m[0];
+      cw[0] = w[0];
+      for (std::size_t k = 1; k < m.size(); k++)
+      {
+        const double wnew = cw[n] + w[k];
+        if (K((wleft + wnew) / total) - kleft <= 1. || n + 1 == capacity)
+        {
+          cm[n] += (m[k] - cm[n]) * w[k] / wnew;
+          cw[n] = wnew;
+        }
+        else
+        {
+          wleft += cw[n];
+          kleft = K(wleft / total);
+          n++;
+          cm[n] = m[k];
+          cw[n] = w[k];
+        }
+      } // for (std::size_t k = 1...
+      ncentroids[c] = n + 1;
+    } // for (std::size_t c = c0...
+  } // MergeCells()
+
+  // Ends the merging of the buffered values, after MergeCells() for all cells
+  void Merged()
+  {
+    count += nbuffered;
+    nbuffered = 0;
+  }
+
+  // number of buffered values per cell
+  std::size_t Buffered() const
+  {
+    return nbuffered;
+  }
+
+  // Estimate of the quantile p of cell c: the centroids are interpolated
+  // between their centers, and the extreme centroids towards the exact
+  // smallest and largest values
+  double Quantile(std::size_t c, double p) const
+  {
+    const double *cm = &mean[c * capacity], *cw = &weight[c * capacity];
+    const std::size_t nc = ncentroids[c];
+    if (nc == 0)
+      return 0.;
+    if (nc == 1)
+      return cm[0];
+    const double target = p * count;
+    if (target <= cw[0] / 2)
+      return cw[0] == 1. ? cm[0] : vmin[c] + (cm[0] - vmin[c]) * target / (cw[0] / 2);
+    if (target >= count - cw[nc - 1] / 2)
+      return cw[nc - 1] == 1. ? cm[nc - 1] : vmax[c] - (vmax[c] - cm[nc - 1]) * (count - target) / (cw[nc - 1] / 2);
+
+    double wleft = 0.; // weight left of centroid i
+    for (std::size_t i = 0; i + 1 < nc; i++)
+    {
+      const double center = wleft + cw[i] / 2, next = wleft + cw[i] + cw[i + 1] / 2;
+      if (target <= next)
+        return cm[i] + (cm[i + 1] - cm[i]) * (target - center) / (next - center);
+      wleft += cw[i];
+    }
+    return cm[nc - 1];
+  } // Quantile()
+}; // class QuantileDigests
+
+#endif // QUANTILES_H
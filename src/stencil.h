@@ -0,0 +1,363 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+/*
+ * Description: Interpolation stencils for evaluating all members of a PDF
+ *              ensemble on one output grid of (x, Q) points, used by
+ *              "mcgen.x convert" and "mcgen.x std_devs", and by
+ *              "mcgen.x generate" to regrid the members onto the knots of the
+ *              card.
+ *
+ *              The log-bicubic interpolation of LHAPDF (LogBicubicInterpolator,
+ *              with finite-difference derivatives in log x and log Q^2) is
+ *              linear in the knot values, and it factorizes into a stencil in
+ *              x and a stencil in Q:
+ *                xf(x, Q) = sum_a sum_b wx[a] wq[b] f(k0x + a, k0q + b),
+ *              with at most 4 knots in each direction. The knot search, the
+ *              choice of the subgrid, and the weights depend only on the knots,
+ *              which are the same for all members. They are computed once per
+ *              output point, and every member is then evaluated from its raw
+ *              knot values (an LHAGrid) by a short sum, without creating LHAPDF
+ *              objects for the members.
+ *
+ *              With sub >= 0, all points are interpolated in the subgrid sub
+ *              only. "mcgen.x generate" regrids every subgrid of the input on
+ *              its own, so the values at a flavor threshold, which is the last
+ *              Q knot of one subgrid and the first of the next, are taken from
+ *              the side of the threshold where they are written.
+ *
+ *              Subgrids with 2 or 3 Q knots are interpolated linearly in log x
+ *              and log Q^2, as in LHAPDF. Points outside of the grid (where
+ *              LHAPDF extrapolates) and subgrids with fewer than 4 x knots are
+ *              not supported: Valid() is false, and Reason() tells why.
+ *              The results agree with LHAPDF up to rounding (~1e-15 relative).
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "subgrid.h"
+
+// Knots k0..k0+n-1 of one direction and their weights, n = 2 or 4
+struct AxisStencil
+{
+  std::size_t k0;
+  std::size_t n;
+  double w[4];
+};
+
+// Index of the knot below t, as in LHAPDF: the last interval includes the
+// last knot
+inline std::size_t stencilKnotBelow(const std::vector<double> &knots, double t)
+{
+  std::size_t i = std::upper_bound(knots.begin(), knots.end(), t) - knots.begin();
+  if (i == knots.size())
+    i -= 1;
+  return i - 1;
+} // stencilKnotBelow()
+
+// Stores the weights w[0..3] of the knots i-1..i+2 into the window of 4 knots
+// inside the grid of nknots knots
+inline AxisStencil stencilWindow(std::size_t i, std::size_t nknots, const double w[4])
+{
+  AxisStencil s;
+  s.n = 4;
+  s.k0 = std::min(i > 0 ? i - 1 : 0, nknots - 4);
+  for (std::size_t a = 0; a < 4; a++)
+  {
+    const std::size_t o = s.k0 + a + 1 - i; // position of knot k0+a in w
+    s.w[a] = o < 4 ? w[o] : 0.;
+  }
+  return s;
+} // stencilWindow()
+
+// Linear interpolation in log t between knots i and i+1
+inline AxisStencil stencilLinear(const std::vector<double> &logknots, std::size_t i, double logt)
+{
+  AxisStencil s;
+  s.k0 = i;
+  s.n = 2;
+  const double u = (logt - logknots[i]) / (logknots[i + 1] - logknots[i]);
+  s.w[0] = 1. - u;
+  s.w[1] = u;
+  s.w[2] = s.w[3] = 0.;
+  return s;
+} // stencilLinear()
+
+// Hermite basis functions of the cubic interpolation at t in [0, 1]
+inline void stencilHermite(double t, double h[4])
+{
+  const double t2 = t * t, t3 = t2 * t;
+  h[0] = 2 * t3 - 3 * t2 + 1; // value at the lower knot
+  h[1] = t3 - 2 * t2 + t;     // derivative at the lower knot
+  h[2] = -2 * t3 + 3 * t2;    // value at the upper knot
+  h[3] = t3 - t2;             // derivative at the upper knot
+} // stencilHermite()
+
+// Cubic interpolation in log x between knots i and i+1. The derivative at a
+// knot is the average of the two adjacent slopes, or the one slope at the
+// first and the last knot.
+inline AxisStencil stencilCubicX(const std::vector<double> &logknots, std::size_t i, double logx)
+{
+  const std::size_t n = logknots.size();
+  const double d1 = logknots[i + 1] - logknots[i];
+  double h[4], w[4] = {0., 0., 0., 0.};
+  stencilHermite((logx - logknots[i]) / d1, h);
+  w[1] += h[0];
+  w[2] += h[2];
+
+  for (std::size_t e = 0; e < 2; e++) // derivatives at knots i and i+1
+  {
+    const std::size_t k = i + e;
+    const double c = (e == 0 ? h[1] : h[3]) * d1;
+    if (k != 0 && k != n - 1)
+    {
+      const double dl = logknots[k] - logknots[k - 1], dr = logknots[k + 1] - logknots[k];
+      w[e] += -c / (2 * dl);
+      w[e + 1] += c / (2 * dl) - c / (2 * dr);
+      w[e + 2] += c / (2 * dr);
+    }
+    else if (k == 0)
+    {
+      const double dr = logknots[k + 1] - logknots[k];
+      w[e + 1] -= c / dr;
+      w[e + 2] += c / dr;
+    }
+    else
+    {
+      const double dl = logknots[k] - logknots[k - 1];
+      w[e] -= c / dl;
+      w[e + 1] += c / dl;
+    }
+  } // for (std::size_t e = 0...
+  return stencilWindow(i, n, w);
+} // stencilCubicX()
+
+// Cubic interpolation in log Q^2 between knots i and i+1 of the values
+// interpolated in x. The derivatives are differences of those values, one-sided
+// next to the ends of the subgrid.
+inline AxisStencil stencilCubicQ(const std::vector<double> &logknots, std::size_t i, double logq2)
+{
+  const std::size_t imax = logknots.size() - 1;
+  const double d1 = logknots[i + 1] - logknots[i];
+  double h[4];
+  stencilHermite((logq2 - logknots[i]) / d1, h);
+
+  // the values at knots i-1, i, i+1, i+2 as weight vectors
+  const double vll[4] = {1., 0., 0., 0.}, vl[4] = {0., 1., 0., 0.};
+  const double vh[4] = {0., 0., 1., 0.}, vhh[4] = {0., 0., 0., 1.};
+  double vdl[4], vdh[4], w[4];
+  for (std::size_t o = 0; o < 4; o++)
+  {
+    const double slope = (vh[o] - vl[o]) / d1;
+    if (i == 0)
+    {
+      const double d2 = logknots[i + 2] - logknots[i + 1];
+      vdl[o] = slope;
+      vdh[o] = (slope + (vhh[o] - vh[o]) / d2) / 2.0;
+    }
+    else if (i + 1 == imax)
+    {
+      const double d0 = logknots[i] - logknots[i - 1];
+      vdh[o] = slope;
+      vdl[o] = (slope + (vl[o] - vll[o]) / d0) / 2.0;
+    }
+    else
+    {
+      const double d0 = logknots[i] - logknots[i - 1], d2 = logknots[i + 2] - logknots[i + 1];
+      vdl[o] = (slope + (vl[o] - vll[o]) / d0) / 2.0;
+      vdh[o] = (slope + (vhh[o] - vh[o]) / d2) / 2.0;
+    }
+    w[o] = h[0] * vl[o] + h[1] * vdl[o] * d1 + h[2] * vh[o] + h[3] * vdh[o] * d1;
+  } // for (std::size_t o = 0...
+  return stencilWindow(i, imax + 1, w);
+} // stencilCubicQ()
+
+class InterpolationStencils
+{
+private:
+  bool valid = false;
+  std::string reason;
+  std::size_t nx = 0, npid = 0;
+  std::vector<int> qsub;                      // subgrid of each Q point
+  std::vector<AxisStencil> qst;               // stencil of each Q point
+  std::vector<std::vector<AxisStencil>> xst;  // [isub][ix], stencil of each x point
+  std::vector<std::vector<int>> cols;         // [isub][j], column of pids[j], -1 if absent
+  std::vector<std::vector<double>> xknots, qknots; // layout of the grid
+  std::vector<std::vector<int>> flavors;
+
+  void Invalid(const std::string &why)
+  {
+    valid = false;
+    reason = why;
+  }
+
+public:
+  InterpolationStencils() {}
+
+  // Stencils for the points (x[ix], q[iq]) of the grid with the knots of
+  // layout, for the partons pids (21 or 0 for the gluon), in the subgrid sub
+  // if sub >= 0
+  InterpolationStencils(const LHAGrid &layout, const std::vector<double> &x, const std::vector<double> &q,
+                        const std::vector<int> &pids, int sub = -1)
+      : nx(x.size()), npid(pids.size()), xknots(layout.getxValuesList()), qknots(layout.getqValuesList()),
+        flavors(layout.getflavorsList())
+  {
+    const int Ngrids = layout.getNgrids();
+    if (Ngrids == 0)
+    {
+      Invalid("the grid has no subgrids");
+      return;
+    }
+    if (sub >= Ngrids)
+    {
+      Invalid("the grid has fewer subgrids than requested");
+      return;
+    }
+
+    // subgrid and stencil in Q, as in LHAPDF: the subgrid with the largest
+    // first Q^2 knot below Q^2
+    const int sub0 = sub >= 0 ? sub : 0, sub1 = sub >= 0 ? sub : Ngrids - 1;
+    const double q2min = qknots[sub0].front() * qknots[sub0].front();
+    const double q2max = qknots[sub1].back() * qknots[sub1].back();
+    for (std::size_t iq = 0; iq < q.size(); iq++)
+    {
+      const double q2 = q[iq] * q[iq];
+      if (q2 < q2min || q2 > q2max)
+      {
+        std::ostringstream why;
+        why << "Q = " << q[iq] << " is outside of the grid";
+        Invalid(why.str());
+        return;
+      }
+      int isub = sub0;
+      for (int k = sub0 + 1; k <= sub1; k++)
+        if (qknots[k].front() * qknots[k].front() <= q2)
+          isub = k;
+
+      const std::size_t nq = qknots[isub].size();
+      if (nq < 2)
+      {
+        Invalid("a subgrid has fewer than 2 Q knots");
+        return;
+      }
+      std::vector<double> q2knots(nq), logq2knots(nq);
+      for (std::size_t k = 0; k < nq; k++)
+      {
+        q2knots[k] = qknots[isub][k] * qknots[isub][k];
+        logq2knots[k] = log(q2knots[k]);
+      }
+      const std::size_t i = stencilKnotBelow(q2knots, q2);
+      qsub.push_back(isub);
+      qst.push_back(nq < 4 ? stencilLinear(logq2knots, i, log(q2)) : stencilCubicQ(logq2knots, i, log(q2)));
+    } // for (std::size_t iq = 0...
+
+    // stencils in x and the columns of the partons in every subgrid
+    xst.resize(Ngrids);
+    cols.resize(Ngrids);
+    for (int isub = sub0; isub <= sub1; isub++)
+    {
+      const std::vector<double> &xk = xknots[isub];
+      if (xk.size() < 4)
+      {
+        Invalid("a subgrid has fewer than 4 x knots");
+        return;
+      }
+      std::vector<double> logxknots(xk.size());
+      for (std::size_t k = 0; k < xk.size(); k++)
+        logxknots[k] = log(xk[k]);
+      for (std::size_t ix = 0; ix < x.size(); ix++)
+      {
+        if (x[ix] < xk.front() || x[ix] > xk.back())
+        {
+          std::ostringstream why;
+          why << "x = " << x[ix] << " is outside of the grid";
+          Invalid(why.str());
+          return;
+        }
+        const std::size_t i = stencilKnotBelow(xk, x[ix]);
+        xst[isub].push_back(qknots[isub].size() < 4 ? stencilLinear(logxknots, i, log(x[ix]))
+                                                    : stencilCubicX(logxknots, i, log(x[ix])));
+      }
+
+      for (std::size_t j = 0; j < pids.size(); j++)
+      {
+        const int pid = pids[j] == 0 ? 21 : pids[j];
+        int c = -1;
+        for (std::size_t ifl = 0; ifl < flavors[isub].size(); ifl++)
+          if (flavors[isub][ifl] == pid || (flavors[isub][ifl] == 0 && pid == 21))
+            c = ifl;
+        cols[isub].push_back(c);
+      }
+    } // for (int isub = 0...
+    valid = true;
+  } // InterpolationStencils()
+
+  bool Valid() const
+  {
+    return valid;
+  }
+
+  const std::string &Reason() const
+  {
+    return reason;
+  }
+
+  // number of x points
+  std::size_t NumX() const
+  {
+    return nx;
+  }
+
+  // Exits unless member has the knots and flavors of the layout; called once
+  // for every member that is read, before it is passed to Evaluate()
+  void CheckMember(const LHAGrid &member) const
+  {
+    if (member.getxValuesList() != xknots || member.getqValuesList() != qknots ||
+        member.getflavorsList() != flavors)
+    {
+      std::cout << "Error: a member has a different x, Q, or flavor grid than member 0." << std::endl;
+      exit(1);
+    }
+  } // CheckMember()
+
+  // Interpolates the partons of member at all x for the Q point iq:
+  // out[ix*npid + j] is parton pids[j] at (x[ix], q[iq]).
+  // The member must have passed CheckMember().
+  void Evaluate(const LHAGrid &member, std::size_t iq, double *out) const
+  {
+    const int isub = qsub[iq];
+    const AxisStencil &sq = qst[iq];
+    const pdfstore_t *f = member.getpdfValuesList()[isub].data();
+    const std::size_t nq = qknots[isub].size(), nfl = flavors[isub].size();
+    const std::vector<int> &col = cols[isub];
+
+    for (std::size_t ix = 0; ix < nx; ix++)
+    {
+      const AxisStencil &sx = xst[isub][ix];
+      double *o = out + ix * npid;
+      for (std::size_t j = 0; j < npid; j++)
+        o[j] = 0.;
+      for (std::size_t a = 0; a < sx.n; a++)
+        for (std::size_t b = 0; b < sq.n; b++)
+        {
+          const double w = sx.w[a] * sq.w[b];
+          const pdfstore_t *row = f + ((sx.k0 + a) * nq + sq.k0 + b) * nfl;
+          for (std::size_t j = 0; j < npid; j++)
+            if (col[j] >= 0)
+              o[j] += w * row[col[j]];
+        }
+    } // for (std::size_t ix = 0...
+  } // Evaluate()
+}; // class InterpolationStencils
+
+#endif // STENCIL_H
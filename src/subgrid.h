@@ -13,6 +13,15 @@
  *              when the output LHAGrid object is created. The output LHAGrid
  *              object is then written to a file which is defined inside mcgen.cc.
  *
+ *              The getters return references, and subgrid(isub) returns a view
+ *              of the PDF values of one subgrid, so callers read the grid
+ *              without copying it. scaleInPlace(), axpy(), and applyPow() modify
+ *              the values in place and can be chained.
+ *
+ *              LHAGrid(filename) copies the grid from LHAGridCache() if
+ *              "mcgen.x serve" keeps it there, instead of parsing the file.
+ *              "mcgen.x pipeline" puts the replicas it writes there.
+ *
  * Author: Lucas Kotz, Pavel Nadolsky
  * Date: July 18, 2023
  */
@@ -27,6 +36,12 @@
 #include <map>
 #include <iomanip>
 
+#include "gridkernels.h"
+#include "threadpool.h"
+#include "gridio.h"
+#include "gridpack.h"
+#include "gridcache.h"
+
 std::ostream &precisionScientific(std::ostream &os)
 {
   os << std::setw(15) << std::uppercase << std::scientific << std::setprecision(6);
@@ -45,19 +60,112 @@ std::ostream &pdfSpacing(std::ostream &os)
   return os;
 }
 
+// A block of consecutive PDF values of one subgrid, the unit of work
+// for the parallel grid operations
+const std::size_t LHAGridBlockSize = 4096;
+struct LHAGridBlock
+{
+  int isub;
+  std::size_t offset;
+  std::size_t size;
+};
+
+// A strided sequence of PDF values, e.g. one flavor of a subgrid for all
+// (x, Q) points
+template <class T>
+struct LHAStridedSpan
+{
+  T *data;
+  std::size_t n;
+  std::size_t stride;
+
+  std::size_t size() const
+  {
+    return n;
+  }
+
+  T &operator[](std::size_t i) const
+  {
+    return data[i * stride];
+  }
+}; // struct LHAStridedSpan
+
+// View of the PDF values of one subgrid without copying them:
+// f(x[ix], Q[iq], flavors[ifl]) = data[(ix*nq + iq)*rowStride + ifl*flavorStride]
+// T is const pdfstore_t for read-only views.
+template <class T>
+struct LHASubgridView
+{
+  T *data;
+  const std::vector<double> *x;
+  const std::vector<double> *q;
+  const std::vector<int> *flavors;
+  std::size_t rowStride;
+  std::size_t flavorStride;
+
+  std::size_t nx() const
+  {
+    return x->size();
+  }
+
+  std::size_t nq() const
+  {
+    return q->size();
+  }
+
+  std::size_t nfl() const
+  {
+    return flavors->size();
+  }
+
+  // number of PDF values
+  std::size_t size() const
+  {
+    return nx() * nq() * nfl();
+  }
+
+  T &operator()(std::size_t ix, std::size_t iq, std::size_t ifl) const
+  {
+    return data[(ix * nq() + iq) * rowStride + ifl * flavorStride];
+  }
+
+  // values of all flavors at (x[ix], Q[iq])
+  LHAStridedSpan<T> row(std::size_t ix, std::size_t iq) const
+  {
+    LHAStridedSpan<T> span = {data + (ix * nq() + iq) * rowStride, nfl(), flavorStride};
+    return span;
+  }
+
+  // values of flavor ifl at all (x, Q) points, Q running fastest
+  LHAStridedSpan<T> flavor(std::size_t ifl) const
+  {
+    LHAStridedSpan<T> span = {data + ifl * flavorStride, nx() * nq(), rowStride};
+    return span;
+  }
+}; // struct LHASubgridView
+
+class LHAGrid;
+
+// Parsed grids kept between the jobs of "mcgen.x serve", empty otherwise
+inline LRUCache<LHAGrid> &LHAGridCache()
+{
+  static LRUCache<LHAGrid> *cache = new LRUCache<LHAGrid>();
+  return *cache;
+} // LHAGridCache()
+
 class LHAGrid
 {
 private:
   std::vector<double> xValues;
   std::vector<double> qValues;
   std::vector<int> flavors;
-  std::vector<double> pdfValues;
+  std::vector<pdfstore_t> pdfValues;
 
   std::vector<std::string> headers;
   std::vector<std::vector<double>> xValuesList;
   std::vector<std::vector<double>> qValuesList;
   std::vector<std::vector<int>> flavorsList;
-  std::vector<std::vector<double>> pdfValuesList;
+  std::vector<std::vector<pdfstore_t>> pdfValuesList;
 
   int Ngrids = 0;
 
@@ -67,11 +175,52 @@ private:
 
   const double small=1.0e-10;
 
+  // empty grid, filled by CacheLHAGrid()
+  LHAGrid() {}
+
 public:
   // contructor
   LHAGrid(std::string filename)
   {
-    this->ReadLHAGrid(filename);
+    std::shared_ptr<LHAGrid> cached = LHAGridCache().Find(filename);
+    if (cached)
+      this->CopyLHAGrid(*cached);
+    else
+      this->ReadLHAGrid(filename);
+  }
+
+  // Parses filename into LHAGridCache(), unless it is there already
+  static void CacheLHAGrid(const std::string &filename)
+  {
+    const CacheStamp stamp = cacheStampOf(filename);
+    if (stamp.mtime < 0 || LHAGridCache().Find(filename))
+      return;
+    std::shared_ptr<LHAGrid> grid(new LHAGrid());
+    grid->ReadLHAGrid(filename);
+    LHAGridCache().Insert(filename, stamp, grid, grid->Bytes());
+  }
+
+  // Grid with the given header lines and knots and all PDF values 0. The
+  // values are filled through subgrid(isub).
+  LHAGrid(const std::vector<std::string> &headerlines, const std::vector<std::vector<double>> &xlist,
+          const std::vector<std::vector<double>> &qlist, const std::vector<std::vector<int>> &flavorlist)
+      : headers(headerlines), xValuesList(xlist), qValuesList(qlist), flavorsList(flavorlist)
+  {
+    Ngrids = xlist.size();
+    pdfValuesList.resize(Ngrids);
+    for (int isub = 0; isub < Ngrids; isub++)
+      pdfValuesList[isub].assign(xlist[isub].size() * qlist[isub].size() * flavorlist[isub].size(), 0.);
+  }
+
+  // memory held by the grid values and knots
+  std::size_t Bytes() const
+  {
+    std::size_t bytes = 0;
+    for (int isub = 0; isub < Ngrids; isub++)
+      bytes += pdfValuesList[isub].size() * sizeof(pdfstore_t) +
+               (xValuesList[isub].size() + qValuesList[isub].size()) * sizeof(double) +
+               flavorsList[isub].size() * sizeof(int);
+    return bytes;
   }
 
   LHAGrid(std::string op, std::vector<std::string> inputfiles, std::vector<double> w = std::vector<double>()) : operation(op), files(inputfiles) 
@@ -79,212 +228,214 @@ public:
     if (w.empty()) 
       w = std::vector<double>(inputfiles.size(), 1.0); // Fill with ones if w is not provided
 
+    if (op != "add" && op != "multiply" && op != "average")
+      return;
 
-    if (op == "add")
+    int Nfiles = inputfiles.size();
+    if (Nfiles < 2)
+    {
+      std::cout << "Error: need at least two files as input." << std::endl;
+      exit(1);
+    } // if (Nfiles < 2)
+
+    // The input files are parsed on the shared thread pool while the files
+    // before them are being reduced. At most nahead files are held in memory.
+    // The reduction is split into blocks of values of each subgrid, and every
+    // value is accumulated in the order of the input files, so the result does
+    // not depend on the number of threads.
+    ThreadPool &pool = mcgenPool();
+    const int nahead = 2 * pool.size();
+    std::vector<std::future<LHAGrid *>> parsedGrids(Nfiles);
+    int Nsubmitted = 0;
+    GridReadAhead readahead(inputfiles, !LHAGridCache().Enabled()); // batches of files (gridio.h)
+
+    LHAGrid *A1 = NULL;
+    std::vector<LHAGridBlock> blocks;
+    std::vector<std::vector<double>> sums; // accumulated in double for any pdfstore_t
+    for (int ifile = 0; ifile < Nfiles; ifile++)
     {
-      // create a vector of LHAGrids from the input files read
-      std::vector<LHAGrid *> LHAgrids;
-      int Nfiles = inputfiles.size();
-      for (int i = 0; i < Nfiles; i++)
+      for (; Nsubmitted < Nfiles && Nsubmitted <= ifile + nahead; Nsubmitted++)
       {
-        LHAgrids.push_back(new LHAGrid(inputfiles[i]));
+        std::string inputfile = inputfiles[Nsubmitted];
+        readahead.Need(Nsubmitted);
+        parsedGrids[Nsubmitted] = pool.submit([inputfile] { return new LHAGrid(inputfile); });
       }
-      this->CompareLHAGrids(LHAgrids);  // check if the grids are compatible
-      // If input grids have the same number of grids, then assign the output 
-      // grid the appropirate number of subgrids.
-      LHAGrid *A1 = LHAgrids[0];
-      int Ngrids1 = A1->Ngrids;
-      Ngrids = Ngrids1;
-
-      // allocate size to the 2-dimensional PDF values vector
-      pdfValuesList.resize(Ngrids);
-      for (int i = 0; i < Ngrids; i++)
+      LHAGrid *Ai = parsedGrids[ifile].get();
+
+      if (ifile == 0)
       {
-        int ival1 = A1->pdfValuesList[i].size();
-        int ival = ival1;
-        pdfValuesList[i].resize(ival);
+        // The output grid gets the subgrids of the first grid. Start the sum
+        // from 0, or the product from 1.
+        A1 = Ai;
+        Ngrids = A1->Ngrids;
+        pdfValuesList.resize(Ngrids);
+        sums.resize(Ngrids);
+        for (int isub = 0; isub < Ngrids; isub++)
+        {
+          pdfValuesList[isub].resize(A1->pdfValuesList[isub].size());
+          sums[isub].assign(A1->pdfValuesList[isub].size(), op == "multiply" ? 1. : 0.);
+        }
+        blocks = this->SplitIntoBlocks();
       }
+      else
+        this->CompareLHAGrid(A1, Ai, ifile); // check if the grids are compatible
+
+      const double wi = (op == "average") ? 1. : w[ifile];
+      pool.parallelFor(blocks.size(), [&](std::size_t ib) {
+        const LHAGridBlock &b = blocks[ib];
+        double *out = sums[b.isub].data() + b.offset;
+        const pdfstore_t *in = Ai->pdfValuesList[b.isub].data() + b.offset;
+        if (op == "multiply")
+          // Perform the multiplication of the PDF values raised to their appropriate
+          // powers. kernelPowMul clamps values with magnitude below small for
+          // negative and non-integer powers.
+          kernelPowMul(out, in, wi, b.size, small);
+        else
+          // Perform the addition of the PDF values weighted by their appropriate weights
+          kernelAxpy(out, in, wi, b.size);
+      });
+
+      if (Ai != A1)
+        delete Ai;
+    } // for (int ifile = 0; ifile < Nfiles; ifile++)
 
-      // Perform the addition of the PDF values weighted by their appropriate weights
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < pdfValuesList[isub].size(); i++)
-          for (int ifile = 0; ifile < Nfiles; ifile++)
-            pdfValuesList[isub][i] += w[ifile] * LHAgrids[ifile]->pdfValuesList[isub][i];
-
-      // copy the headers, xValues, qValues, flavor IDs from the first grid to the output grid
-      std::vector<std::string> headers1 = A1->headers;
-      headers = headers1;
-
-      xValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> xValuesList1 = A1->xValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < xValuesList[isub].size(); i++)
-        {
-          xValuesList[isub].resize(xValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      xValuesList = xValuesList1;
-
-      qValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> qValuesList1 = A1->qValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < qValuesList[isub].size(); i++)
-        {
-          qValuesList[isub].resize(qValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      qValuesList = qValuesList1;
-
-      flavorsList.resize(Ngrids);
-      std::vector<std::vector<int>> flavorsList1 = A1->flavorsList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < flavorsList[isub].size(); i++)
-        {
-          flavorsList[isub].resize(flavorsList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      flavorsList = flavorsList1;
-    } // if (op == "add")
+    if (op == "average")
+      // divide by the number of files
+      pool.parallelFor(blocks.size(), [&](std::size_t ib) {
+        const LHAGridBlock &b = blocks[ib];
+        kernelScale(sums[b.isub].data() + b.offset, 1. / Nfiles, b.size);
+      });
+
+    PrecisionReport report;
+    for (int isub = 0; isub < Ngrids; isub++)
+      kernelStore(sums[isub], pdfValuesList[isub], report);
+    report.Print("the " + op + " result");
+
+    // take over the headers, xValues, qValues, flavor IDs of the first grid
+    headers.swap(A1->headers);
+    xValuesList.swap(A1->xValuesList);
+    qValuesList.swap(A1->qValuesList);
+    flavorsList.swap(A1->flavorsList);
+    delete A1;
+  } // LHAGrid(std::string op, std::vector<std::string> inputfiles, std::vector<double> w = std::vector<double>()) : operation(op), files(inputfiles) 
 
-    if (op == "multiply")
+  // Central values and errors of the ensemble of grids in inputfiles (member 0
+  // first) on their own knots, with the formulas of "mcgen.x std_devs":
+  // symmetric errors about member 0 for errtype "mc", normalized by N-2 for
+  // N members after member 0, or asymmetric Hessian errors of the pairs
+  // (2n-1, 2n) for "he68" and "he90" (scaled to 68% c.l.). An unpaired last
+  // member is not used. Returns the grids {central, up, down}, allocated with
+  // new. The members are parsed on the thread pool as in the constructor
+  // above, and at most three of them are kept at a time.
+  static std::vector<LHAGrid *> ErrorGrids(const std::vector<std::string> &inputfiles, const std::string &errtype)
+  {
+    const int Nfiles = inputfiles.size();
+    const int npairs = (Nfiles - 1) / 2;
+    if (npairs < 1)
     {
-      // create a vector of LHAGrids from the input files read
-      std::vector<LHAGrid *> LHAgrids;
-      int Nfiles = inputfiles.size();
-      for (int i = 0; i < Nfiles; i++)
-      {
-        LHAgrids.push_back(new LHAGrid(inputfiles[i]));
-      }
-      this->CompareLHAGrids(LHAgrids); // check if the grids are compatible
-      // If input grids have the same number of grids, then assign the output 
-      // grid the appropirate number of subgrids.
-      LHAGrid *A1 = LHAgrids[0];
-      int Ngrids1 = A1->Ngrids;
-      Ngrids = Ngrids1;
-
-      // allocate size to the 2-dimensional PDF values vector
-      pdfValuesList.resize(Ngrids);
-      for (int i = 0; i < Ngrids; i++)
+      std::cout << "Error: need a central member and at least two error members as input." << std::endl;
+      exit(1);
+    }
+    const int Nread = 2 * npairs + 1;
+    const bool symmetric = (errtype == "mc");
+
+    ThreadPool &pool = mcgenPool();
+    const int nahead = 2 * pool.size();
+    std::vector<std::future<LHAGrid *>> parsedGrids(Nread);
+    int Nsubmitted = 0;
+    GridReadAhead readahead(inputfiles, !LHAGridCache().Enabled()); // batches of files (gridio.h)
+
+    LHAGrid *A0 = NULL, *Aminus = NULL;
+    std::vector<LHAGridBlock> blocks;
+    std::vector<std::vector<double>> sumup, sumdn;
+    for (int ifile = 0; ifile < Nread; ifile++)
+    {
+      for (; Nsubmitted < Nread && Nsubmitted <= ifile + nahead; Nsubmitted++)
       {
-        int ival1 = A1->pdfValuesList[i].size();
-        int ival = ival1;
-        pdfValuesList[i].assign(ival, 1); // fills entire 2-dimension vector with 1
+        std::string inputfile = inputfiles[Nsubmitted];
+        readahead.Need(Nsubmitted);
+        parsedGrids[Nsubmitted] = pool.submit([inputfile] { return new LHAGrid(inputfile); });
       }
+      LHAGrid *Ai = parsedGrids[ifile].get();
 
-      // Perform the multiplication of the PDF values weighted by their appropriate weights
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < pdfValuesList[isub].size(); i++)
-          for (int ifile = 0; ifile < Nfiles; ifile++)
-          {
-            double pdfValuetmp = LHAgrids[ifile]->pdfValuesList[isub][i];
-            if (fabs(pdfValuetmp) < small) // checks if the magnitude of pdfValuetmp is too small
-              pdfValuetmp = copysign(small, pdfValuetmp); // if so, then set it to small
-            pdfValuesList[isub][i] *= pow(LHAgrids[ifile]->pdfValuesList[isub][i], w[ifile]);
-          }
-
-      // copy the headers, xValues, qValues, flavor IDs from the first grid to the output grid
-      std::vector<std::string> headers1 = A1->headers;
-      headers = headers1;
-
-      xValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> xValuesList1 = A1->xValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < xValuesList[isub].size(); i++)
-        {
-          xValuesList[isub].resize(xValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      xValuesList = xValuesList1;
-
-      qValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> qValuesList1 = A1->qValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < qValuesList[isub].size(); i++)
-        {
-          qValuesList[isub].resize(qValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      qValuesList = qValuesList1;
-
-      flavorsList.resize(Ngrids);
-      std::vector<std::vector<int>> flavorsList1 = A1->flavorsList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < flavorsList[isub].size(); i++)
-        {
-          flavorsList[isub].resize(flavorsList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      flavorsList = flavorsList1;
-    } // if (op == "multiply")
-
-    if (op == "average")
-    {
-      // create a vector of LHAGrids from the input files read
-      std::vector<LHAGrid *> LHAgrids;
-      int Nfiles = inputfiles.size();
-      for (int i = 0; i < Nfiles; i++)
+      if (ifile == 0)
       {
-        LHAgrids.push_back(new LHAGrid(inputfiles[i]));
+        A0 = Ai;
+        sumup.resize(A0->Ngrids);
+        sumdn.resize(A0->Ngrids);
+        for (int isub = 0; isub < A0->Ngrids; isub++)
+        {
+          sumup[isub].assign(A0->pdfValuesList[isub].size(), 0.);
+          sumdn[isub].assign(A0->pdfValuesList[isub].size(), 0.);
+        }
+        blocks = A0->SplitIntoBlocks();
+        continue;
       }
-      this->CompareLHAGrids(LHAgrids); // check if the grids are compatible
-      // If input grids have the same number of grids, then assign the output 
-      // grid the appropirate number of subgrids.
-      LHAGrid *A1 = LHAgrids[0];
-      int Ngrids1 = A1->Ngrids;
-      Ngrids = Ngrids1;
-
-      // allocate size to the 2-dimensional PDF values vector
-      pdfValuesList.resize(Ngrids);
-      for (int i = 0; i < Ngrids; i++)
+      A0->CompareLHAGrid(A0, Ai, ifile);
+      if (ifile % 2 == 1)
       {
-        int ival1 = A1->pdfValuesList[i].size();
-        int ival = ival1;
-        pdfValuesList[i].resize(ival);
+        Aminus = Ai; // f_{2n-1}, paired with the next member
+        continue;
       }
 
-      // Perform the addition of all corresponding PDF values 
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < pdfValuesList[isub].size(); i++)
-          for (int ifile = 0; ifile < Nfiles; ifile++)
-            pdfValuesList[isub][i] += LHAgrids[ifile]->pdfValuesList[isub][i];
-      
-      // divide by the number of files
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < pdfValuesList[isub].size(); i++)
-          pdfValuesList[isub][i] /= Nfiles;
-
-      // copy the headers, xValues, qValues, flavor IDs from the first grid to the output grid
-      std::vector<std::string> headers1 = A1->headers;
-      headers = headers1;
-
-      xValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> xValuesList1 = A1->xValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < xValuesList[isub].size(); i++)
-        {
-          xValuesList[isub].resize(xValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      xValuesList = xValuesList1;
-
-      qValuesList.resize(Ngrids);
-      std::vector<std::vector<double>> qValuesList1 = A1->qValuesList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < qValuesList[isub].size(); i++)
-        {
-          qValuesList[isub].resize(qValuesList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      qValuesList = qValuesList1;
-
-      flavorsList.resize(Ngrids);
-      std::vector<std::vector<int>> flavorsList1 = A1->flavorsList;
-      for (int isub = 0; isub < Ngrids; isub++)
-        for (int i = 0; i < flavorsList[isub].size(); i++)
-        {
-          flavorsList[isub].resize(flavorsList1[isub].size());
-        } // for (int isub = 0; isub < Ngrids; isub++)
-      flavorsList = flavorsList1;
-    } // if (op == "average")
+      pool.parallelFor(blocks.size(), [&](std::size_t ib) {
+        const LHAGridBlock &b = blocks[ib];
+        kernelPairErrors(sumup[b.isub].data() + b.offset, sumdn[b.isub].data() + b.offset,
+                         A0->pdfValuesList[b.isub].data() + b.offset, Ai->pdfValuesList[b.isub].data() + b.offset,
+                         Aminus->pdfValuesList[b.isub].data() + b.offset, b.size, symmetric);
+      });
+      delete Aminus;
+      delete Ai;
+    } // for (int ifile = 0; ifile < Nread; ifile++)
+
+    double w = symmetric ? 1. / sqrt((double)std::max(Nfiles - 3, 1)) : 1.;
+    if (errtype == "he90")
+      w /= 1.65;
+    std::vector<LHAGrid *> result(1, A0);
+    PrecisionReport report;
+    for (std::vector<std::vector<double>> *sums : {&sumup, &sumdn})
+    {
+      pool.parallelFor(blocks.size(), [&](std::size_t ib) {
+        const LHAGridBlock &b = blocks[ib];
+        kernelSqrtScale((*sums)[b.isub].data() + b.offset, w, b.size);
+      });
+      LHAGrid *err = new LHAGrid(*A0);
+      err->setheader("PdfType:", "PdfType: error");
+      for (int isub = 0; isub < A0->Ngrids; isub++)
+        kernelStore((*sums)[isub], err->pdfValuesList[isub], report);
+      result.push_back(err);
+    }
+    report.Print("the errors");
+    return result;
+  } // static std::vector<LHAGrid *> ErrorGrids(const std::vector<std::string> &inputfiles, const std::string &errtype)
 
-  } // LHAGrid(std::string op, std::vector<std::string> inputfiles, std::vector<double> w = std::vector<double>()) : operation(op), files(inputfiles) 
+  // Function to copy the grid read from a file by another LHAGrid
+  void CopyLHAGrid(const LHAGrid &other)
+  {
+    headers = other.headers;
+    xValues = other.xValues;
+    qValues = other.qValues;
+    flavors = other.flavors;
+    pdfValues = other.pdfValues;
+    xValuesList = other.xValuesList;
+    qValuesList = other.qValuesList;
+    flavorsList = other.flavorsList;
+    pdfValuesList = other.pdfValuesList;
+    Ngrids = other.Ngrids;
+  } // void CopyLHAGrid(const LHAGrid &other)
 
   // Function to read the input grid file
   void ReadLHAGrid(std::string filename)
   {
-    std::ifstream inputFile(filename);
+    std::string packfile;
+    int member;
+    if (gridPackMember(filename, packfile, member))
+    {
+      this->ReadLHAGridPacked(packfile, member);
+      return;
+    }
+
+    igridstream inputFile(filename); // plain, .gz or .zst
 
     if (!inputFile.is_open())
     {
@@ -294,15 +445,13 @@ public:
 
     std::string line;
 
-    for (int i = 0; i < 2; i++)
-    // read the header of the file and store it in the vector headers
+    while (getline(inputFile, line) && line.compare(0, 3, "---") != 0)
+    // read the header of the file and store it in the vector headers,
+    // up to the first delimiter "---"
     {
-      getline(inputFile, line);
       headers.push_back(line);
     }
 
-    getline(inputFile, line); // reads first delimiter "---" after headers.
-
     while (getline(inputFile, line))
     // while loop will read each subgrid of the file until the end of the file is reached.
     {
@@ -391,31 +540,148 @@ public:
     inputFile.close();
   } // void ReadLHAGrid(std::string filename)
 
+  // Function to read member k of a packed ensemble (.lhapack file)
+  void ReadLHAGridPacked(std::string packfile, int k)
+  {
+    std::shared_ptr<LHAPackReader> pack = LHAPackReader::Open(packfile);
+    const LHAPackLayout &layout = pack->Layout();
+    const char *values;
+    pack->Member(k, headers, values);
+
+    Ngrids = layout.Ngrids();
+    xValuesList = layout.xValuesList;
+    qValuesList = layout.qValuesList;
+    flavorsList = layout.flavorsList;
+    pdfValuesList.resize(Ngrids);
+    for (int isub = 0; isub < Ngrids; isub++)
+    {
+      const std::size_t n = layout.NumValues(isub);
+      pdfValuesList[isub].resize(n);
+      for (std::size_t i = 0; i < n; i++)
+      {
+        double value; // the mapped values need not be aligned
+        memcpy(&value, values + 8 * i, sizeof(value));
+        pdfValuesList[isub][i] = value;
+      }
+      values += 8 * n;
+    }
+  } // void ReadLHAGridPacked(std::string packfile, int k)
+
+  // Getter functions return references to the stored values; they stay
+  // valid until the grid is modified or destroyed.
+
+  // Getter function to access the header lines
+  const std::vector<std::string> &getheaders() const {
+    return headers;
+  }
+
+  // Getter function to access the header line starting with key (e.g. "Format:"),
+  // empty if there is none
+  std::string getheader(const std::string &key) const {
+    for (const std::string &line : headers)
+      if (line.compare(0, key.size(), key) == 0)
+        return line;
+    return "";
+  }
+
+  // Replaces the header line starting with key by line, or appends line if
+  // there is none
+  void setheader(const std::string &key, const std::string &line) {
+    for (std::string &h : headers)
+      if (h.compare(0, key.size(), key) == 0)
+      {
+        h = line;
+        return;
+      }
+    headers.push_back(line);
+  }
+
   // Getter function to access Ngrids
   int getNgrids() const {
     return Ngrids;
   }
 
   // Getter function to access xValueList
-  std::vector<std::vector<double>> getxValuesList() const {
+  const std::vector<std::vector<double>> &getxValuesList() const {
     return xValuesList;
   }
 
   // Getter function to access qValueList
-  std::vector<std::vector<double>> getqValuesList() const {
+  const std::vector<std::vector<double>> &getqValuesList() const {
     return qValuesList;
   }
 
   // Getter function to access flavorsList
-  std::vector<std::vector<int>> getflavorsList() const {
+  const std::vector<std::vector<int>> &getflavorsList() const {
     return flavorsList;
   }
 
   // Getter function to access pdfValuesList
-  std::vector<std::vector<double>> getpdfValuesList() const {
+  const std::vector<std::vector<pdfstore_t>> &getpdfValuesList() const {
     return pdfValuesList;
   }
 
+  // Views of the PDF values of subgrid isub
+  LHASubgridView<pdfstore_t> subgrid(int isub)
+  {
+    LHASubgridView<pdfstore_t> view = {pdfValuesList[isub].data(), &xValuesList[isub], &qValuesList[isub],
+                                       &flavorsList[isub], flavorsList[isub].size(), 1};
+    return view;
+  }
+
+  LHASubgridView<const pdfstore_t> subgrid(int isub) const
+  {
+    LHASubgridView<const pdfstore_t> view = {pdfValuesList[isub].data(), &xValuesList[isub], &qValuesList[isub],
+                                             &flavorsList[isub], flavorsList[isub].size(), 1};
+    return view;
+  }
+
+  // In-place operations on all PDF values. They run on the shared thread
+  // pool and return the grid, so they can be chained, e.g.
+  // grid.applyPow(2.).axpy(-1., other).scaleInPlace(0.5)
+
+  // f -> w*f
+  LHAGrid &scaleInPlace(double w)
+  {
+    std::vector<LHAGridBlock> blocks = this->SplitIntoBlocks();
+    mcgenPool().parallelFor(blocks.size(), [&](std::size_t ib) {
+      const LHAGridBlock &b = blocks[ib];
+      kernelScale(pdfValuesList[b.isub].data() + b.offset, w, b.size);
+    });
+    return *this;
+  } // scaleInPlace()
+
+  // f -> f + w*g, where g is a grid with the same subgrids
+  LHAGrid &axpy(double w, const LHAGrid &other)
+  {
+    this->CompareLHAGrid(this, &other, 1);
+    std::vector<LHAGridBlock> blocks = this->SplitIntoBlocks();
+    mcgenPool().parallelFor(blocks.size(), [&](std::size_t ib) {
+      const LHAGridBlock &b = blocks[ib];
+      kernelAxpy(pdfValuesList[b.isub].data() + b.offset, other.pdfValuesList[b.isub].data() + b.offset, w, b.size);
+    });
+    return *this;
+  } // axpy()
+
+  // f -> f^w, with the same treatment of |f| < small as in "multiply"
+  LHAGrid &applyPow(double w)
+  {
+    std::vector<LHAGridBlock> blocks = this->SplitIntoBlocks();
+    mcgenPool().parallelFor(blocks.size(), [&](std::size_t ib) {
+      const LHAGridBlock &b = blocks[ib];
+      pdfstore_t *f = pdfValuesList[b.isub].data() + b.offset;
+      double acc[kernelChunk];
+      for (std::size_t i0 = 0; i0 < b.size; i0 += kernelChunk)
+      {
+        const std::size_t m = std::min(kernelChunk, b.size - i0);
+        std::fill(acc, acc + m, 1.);
+        kernelPowMul(acc, f + i0, w, m, small);
+        std::copy(acc, acc + m, f + i0);
+      }
+    });
+    return *this;
+  } // applyPow()
+
   void CompareLHAGrids(std::vector<LHAGrid *> &LHAGridsFromFiles)
   // Function used to compare the subgrids of two or more LHAgrids.
   // The function will compare the number of subgridsm the headers of each LHAgrid,
@@ -429,65 +695,116 @@ public:
       exit(1);
     } // if (Nfiles < 2)
 
-    int Ngridscomp = LHAGridsFromFiles[0]->Ngrids;
-    for (int i = 1; i < Nfiles; i++)
-    {
-      if (LHAGridsFromFiles[i]->Ngrids != Ngridscomp)
-      {
-        std::cout << "Error: number of subgrids in files do not match." << std::endl;
-        exit(1);
-      }
-    } // for (int i = 1; i < Nfiles; i++)
-
     // use the values from the first input file to compare subsequent files to.
-    std::vector<std::string> headerscomp = LHAGridsFromFiles[0]->headers;
-    std::vector<std::vector<double>> xValuesListcomp = LHAGridsFromFiles[0]->xValuesList;
-    std::vector<std::vector<double>> qValuesListcomp = LHAGridsFromFiles[0]->qValuesList;
-    std::vector<std::vector<int>> flavorsListcomp = LHAGridsFromFiles[0]->flavorsList;
-    std::vector<std::vector<double>> pdfValuesListcomp = LHAGridsFromFiles[0]->pdfValuesList;
-
     for (int i = 1; i < Nfiles; i++)
+      this->CompareLHAGrid(LHAGridsFromFiles[0], LHAGridsFromFiles[i], i);
+  } // void CompareLHAGrids(std::vector<LHAGrid>)
+
+  void CompareLHAGrid(const LHAGrid *A1, const LHAGrid *Ai, int i)
+  // Compares the grid Ai of input file i (counting from 0) to the grid A1 of the first
+  // input file. The program will exit if they do not match.
+  {
+    if (Ai->Ngrids != A1->Ngrids)
     {
-      // lk24 now compares 2nd element of the headers, which is the format.
-      if (LHAGridsFromFiles[i]->headers[1] != headerscomp[1])
-      {
-        std::cout << "Error: headers for file " << i + 1 << " does not match with first input file." << std::endl;
-        exit(1);
-      }
-      if (LHAGridsFromFiles[i]->xValuesList != xValuesListcomp)
-      {
-        std::cout << "Error: x values for file " << i + 1 << " does not match with first input file." << std::endl;
-        exit(1);
-      }
-      if (LHAGridsFromFiles[i]->qValuesList != qValuesListcomp)
+      std::cout << "Error: number of subgrids in files do not match." << std::endl;
+      exit(1);
+    }
+    // lk24 now compares the "Format:" line of the headers.
+    if (Ai->getheader("Format:") != A1->getheader("Format:"))
+    {
+      std::cout << "Error: headers for file " << i + 1 << " does not match with first input file." << std::endl;
+      exit(1);
+    }
+    if (Ai->xValuesList != A1->xValuesList)
+    {
+      std::cout << "Error: x values for file " << i + 1 << " does not match with first input file." << std::endl;
+      exit(1);
+    }
+    if (Ai->qValuesList != A1->qValuesList)
+    {
+      std::cout << "Error: q values for file " << i + 1 << " does not match with first input file." << std::endl;
+      exit(1);
+    }
+    if (Ai->flavorsList != A1->flavorsList)
+    {
+      std::cout << "Error: flavor indices for file " << i + 1 << " does not match with first input file." << std::endl;
+      exit(1);
+    }
+    for (int j = 0; j < A1->Ngrids; j++)
+      if (Ai->pdfValuesList[j].size() != A1->pdfValuesList[j].size())
       {
-        std::cout << "Error: q values for file " << i + 1 << " does not match with first input file." << std::endl;
+        std::cout << "Error: number of pdf values for file " << i + 1 << " does not match with first input file." << std::endl;
         exit(1);
       }
-      if (LHAGridsFromFiles[i]->flavorsList != flavorsListcomp)
+  } // void CompareLHAGrid(const LHAGrid *A1, const LHAGrid *Ai, int i)
+
+  std::vector<LHAGridBlock> SplitIntoBlocks() const
+  // Splits the PDF values of all subgrids into blocks of at most LHAGridBlockSize
+  // values, the units of work of the parallel grid operations.
+  {
+    std::vector<LHAGridBlock> blocks;
+    for (int isub = 0; isub < Ngrids; isub++)
+      for (std::size_t offset = 0; offset < pdfValuesList[isub].size(); offset += LHAGridBlockSize)
       {
-        std::cout << "Error: flavor indices for file " << i + 1 << " does not match with first input file." << std::endl;
-        exit(1);
+        LHAGridBlock b;
+        b.isub = isub;
+        b.offset = offset;
+        b.size = std::min(LHAGridBlockSize, pdfValuesList[isub].size() - offset);
+        blocks.push_back(b);
       }
-      for (int j = 0; j < Ngridscomp; j++)
-        if (LHAGridsFromFiles[i]->pdfValuesList[j].size() != pdfValuesListcomp[j].size())
-        {
-          std::cout << "Error: number of pdf values for file " << i + 1 << " does not match with first input file." << std::endl;
-          exit(1);
-        }
-    } // for (int i = 1; i < Nfiles; i++)
-  } // void CompareLHAGrids(std::vector<LHAGrid>)
+    return blocks;
+  } // std::vector<LHAGridBlock> SplitIntoBlocks()
 
   //void ConvertPLTGrid(std::string infile, std::string outfile)
 
+  std::string FormatPDFRows(int i, int j0, int j1) const
+  // Returns rows j0 <= j < j1 of the PDF values of subgrid i as they are
+  // written into the LHAPDF grid file.
+  {
+    std::ostringstream rows;
+    int N = flavorsList[i].size();
+
+    for (int j = j0; j < j1; j++)
+    {
+      if (j == 0)
+        rows << " ";
+      for (int k = 0; k < N; k++)
+      {
+        if (k == 0)
+          rows << " " << pdfPrecision << pdfValuesList[i][j * N + k];
+        else
+          rows << pdfSpacing << pdfValuesList[i][j * N + k];
+      }
+      rows << std::endl;
+    }
+    return rows.str();
+  } // std::string FormatPDFRows(int i, int j0, int j1)
+
   void WriteLHAGrid(std::string outfile)
   {
-    std::ofstream file(outfile);
+    ogridstream file(outfile); // plain, .gz or .zst
+    this->WriteLHAGrid(file);
+    file.close();
+  } // void WriteLHAGrid(std::string outfile)
+
+  // Formats the grid in memory and queues it on writer, which writes it with
+  // the other files of the batch
+  void WriteLHAGrid(std::string outfile, GridFileWriter &writer)
+  {
+    std::ostringstream file;
+    this->WriteLHAGrid(file);
+    std::string *text = writer.Buffer();
+    *text = file.str();
+    writer.Write(outfile, text);
+  } // void WriteLHAGrid(std::string outfile, GridFileWriter &writer)
+
+  void WriteLHAGrid(std::ostream &file)
+  {
     file << precisionScientific;
 
-    for (int i = 0; i < 2; i++)
+    for (const std::string &line : headers)
     {
-      file << headers[i] << std::endl;
+      file << std::setw(0) << line << std::endl; // short headers are not padded
     }
     file << "---" << std::endl;
 
@@ -512,31 +829,24 @@ public:
       file << std::endl;
 
       int M = pdfValuesList[i].size() / flavorsList[i].size();
-      int N = flavorsList[i].size();
 
-      for (int j = 0; j < M; j++)
-      {
-        if (j == 0)
-          file << " ";
-        for (int k = 0; k < N; k++)
-        {
-          if (k == 0)
-            file << " " << pdfPrecision << pdfValuesList[i][j * N + k];
-          else
-            file << pdfSpacing << pdfValuesList[i][j * N + k];
-          if (k != N - 1)
-            file /*<< " "*/;
-        }
-        file << std::endl;
-      }
+      // format blocks of rows on the thread pool, then write them in order
+      const int Mblock = 256;
+      std::vector<std::string> rowBlocks((M + Mblock - 1) / Mblock);
+      mcgenPool().parallelFor(rowBlocks.size(), [&](std::size_t ib) {
+        rowBlocks[ib] = this->FormatPDFRows(i, ib * Mblock, std::min<int>(M, (ib + 1) * Mblock));
+      });
+      for (std::size_t ib = 0; ib < rowBlocks.size(); ib++)
+        file << rowBlocks[ib];
+      if (M > 0)
+        file << pdfPrecision; // keep the stream format of the rows for the next subgrid
       if (i != Ngrids - 1)
         file << "---" << std::endl;
       else
         file << "---";
 
     } // for (int i = 0; i < Ngrids; i++)
-    file.close();
-  } // void WriteLHAGrid(std::string outfile)
+  } // void WriteLHAGrid(std::ostream &file)
 
   // destructor
   ~LHAGrid()
@@ -0,0 +1,244 @@
+#ifndef SVD_H
+#define SVD_H
+
+/*
+ * Description: Leading singular values and right singular vectors of a dense
+ *              nrows x ncols matrix A with nrows << ncols, used by
+ *              "mcgen.x mc2hessian" for the principal components of the
+ *              centered replica matrix.
+ *
+ *              randomizedSVD() follows N. Halko, P.G. Martinsson, J.A. Tropp,
+ *              SIAM Rev. 53 (2011) 217: a Gaussian test matrix with
+ *              l = k + oversampling columns is multiplied by A, the range is
+ *              refined by power iterations (A A^T)^q with re-orthonormalization,
+ *              and the small l x ncols matrix B = Q^T A is decomposed through
+ *              the eigenvectors of B B^T (cyclic Jacobi). The products with A
+ *              run on the thread pool in blocks of rows or columns; every
+ *              entry is summed in a fixed order, so the results do not depend
+ *              on the number of threads.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "threadpool.h"
+
+// columns of A per task in the products A^T Y
+const std::size_t svdColumnBlock = 2048;
+
+// Y[i*l + j] = sum_c A[i*ncols + c] * W[j*ncols + c], Y is nrows x l
+inline void svdMultiplyAWt(const std::vector<double> &A, std::size_t nrows, std::size_t ncols,
+                           const std::vector<double> &W, std::size_t l, std::vector<double> &Y)
+{
+  Y.assign(nrows * l, 0.);
+  mcgenPool().parallelFor(nrows, [&](std::size_t i) {
+    const double *a = &A[i * ncols];
+    for (std::size_t j = 0; j < l; j++)
+    {
+      const double *w = &W[j * ncols];
+      double acc = 0.;
+      for (std::size_t c = 0; c < ncols; c++)
+        acc += a[c] * w[c];
+      Y[i * l + j] = acc;
+    }
+  });
+} // svdMultiplyAWt()
+
+// W[j*ncols + c] = sum_i Y[i*l + j] * A[i*ncols + c], W is l x ncols (= (A^T Y)^T)
+inline void svdMultiplyAtY(const std::vector<double> &A, std::size_t nrows, std::size_t ncols,
+                           const std::vector<double> &Y, std::size_t l, std::vector<double> &W)
+{
+  W.assign(l * ncols, 0.);
+  const std::size_t nblocks = (ncols + svdColumnBlock - 1) / svdColumnBlock;
+  mcgenPool().parallelFor(nblocks, [&](std::size_t ib) {
+    const std::size_t c0 = ib * svdColumnBlock, c1 = std::min(ncols, c0 + svdColumnBlock);
+    for (std::size_t i = 0; i < nrows; i++)
+    {
+      const double *a = &A[i * ncols];
+      for (std::size_t j = 0; j < l; j++)
+      {
+        const double y = Y[i * l + j];
+        double *w = &W[j * ncols];
+        for (std::size_t c = c0; c < c1; c++)
+          w[c] += y * a[c];
+      }
+    }
+  });
+} // svdMultiplyAtY()
+
+// Orthonormalizes the m vectors of length n stored with stride (vector j,
+// element i at V[i*rowstride + j*colstride]) by modified Gram-Schmidt, applied
+// twice. Vectors that become linearly dependent are set to 0.
+inline void svdOrthonormalize(std::vector<double> &V, std::size_t n, std::size_t m, std::size_t rowstride,
+                              std::size_t colstride)
+{
+  for (int pass = 0; pass < 2; pass++)
+    for (std::size_t j = 0; j < m; j++)
+    {
+      for (std::size_t k = 0; k < j; k++)
+      {
+        double dot = 0.;
+        for (std::size_t i = 0; i < n; i++)
+          dot += V[i * rowstride + k * colstride] * V[i * rowstride + j * colstride];
+        for (std::size_t i = 0; i < n; i++)
+          V[i * rowstride + j * colstride] -= dot * V[i * rowstride + k * colstride];
+      }
+      double norm = 0.;
+      for (std::size_t i = 0; i < n; i++)
+        norm += V[i * rowstride + j * colstride] * V[i * rowstride + j * colstride];
+      norm = sqrt(norm);
+      for (std::size_t i = 0; i < n; i++)
+        V[i * rowstride + j * colstride] = norm > 1e-300 ? V[i * rowstride + j * colstride] / norm : 0.;
+    } // for (std::size_t j = 0...
+} // svdOrthonormalize()
+
+// Eigenvalues (descending) and eigenvectors of the symmetric n x n matrix C
+// by cyclic Jacobi rotations. Eigenvector k is column k of E.
+inline void svdJacobiEigen(std::vector<double> C, std::size_t n, std::vector<double> &lambda, std::vector<double> &E)
+{
+  E.assign(n * n, 0.);
+  for (std::size_t i = 0; i < n; i++)
+    E[i * n + i] = 1.;
+  for (int sweep = 0; sweep < 100; sweep++)
+  {
+    double off = 0., diag = 0.;
+    for (std::size_t p = 0; p < n; p++)
+    {
+      diag += C[p * n + p] * C[p * n + p];
+      for (std::size_t q = p + 1; q < n; q++)
+        off += C[p * n + q] * C[p * n + q];
+    }
+    if (off <= 1e-30 * diag)
+      break;
+    for (std::size_t p = 0; p < n; p++)
+      for (std::size_t q = p + 1; q < n; q++)
+      {
+        const double cpq = C[p * n + q];
+        if (cpq == 0.)
+          continue;
+        const double theta = (C[q * n + q] - C[p * n + p]) / (2. * cpq);
+        const double t = (theta >= 0. ? 1. : -1.) / (fabs(theta) + sqrt(theta * theta + 1.));
+        const double c = 1. / sqrt(t * t + 1.), s = t * c;
+        for (std::size_t k = 0; k < n; k++)
+        { // columns p and q
+          const double ckp = C[k * n + p], ckq = C[k * n + q];
+          C[k * n + p] = c * ckp - s * ckq;
+          C[k * n + q] = s * ckp + c * ckq;
+        }
+        for (std::size_t k = 0; k < n; k++)
+        { // rows p and q
+          const double cpk = C[p * n + k], cqk = C[q * n + k];
+          C[p * n + k] = c * cpk - s * cqk;
+          C[q * n + k] = s * cpk + c * cqk;
+        }
+        for (std::size_t k = 0; k < n; k++)
+        {
+          const double ekp = E[k * n + p], ekq = E[k * n + q];
+          E[k * n + p] = c * ekp - s * ekq;
+          E[k * n + q] = s * ekp + c * ekq;
+        }
+      } // for (std::size_t q = p + 1...
+  } // for (int sweep = 0...
+
+  std::vector<std::size_t> order(n);
+  for (std::size_t i = 0; i < n; i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::size_t a, std::size_t b) { return C[a * n + a] > C[b * n + b]; });
+  lambda.resize(n);
+  std::vector<double> sorted(n * n);
+  for (std::size_t k = 0; k < n; k++)
+  {
+    lambda[k] = C[order[k] * n + order[k]];
+    for (std::size_t i = 0; i < n; i++)
+      sorted[i * n + k] = E[i * n + order[k]];
+  }
+  E.swap(sorted);
+} // svdJacobiEigen()
+
+// The k leading singular values s[0..k-1] of the nrows x ncols matrix A and
+// the right singular vectors, V[j*ncols + c] for vector j
+inline void randomizedSVD(const std::vector<double> &A, std::size_t nrows, std::size_t ncols, std::size_t k,
+                          std::size_t oversampling, int power, uint64_t seed, std::vector<double> &s,
+                          std::vector<double> &V)
+{
+  const std::size_t l = std::min(k + oversampling, nrows);
+  k = std::min(k, l);
+
+  // Gaussian test matrix, l x ncols
+  std::vector<double> W(l * ncols);
+  std::mt19937_64 rng(seed);
+  for (std::size_t i = 0; i < W.size(); i += 2)
+  { // Box-Muller
+    const double u1 = ((rng() >> 11) + 1.) * (1. / 9007199254740993.);
+    const double u2 = (rng() >> 11) * (1. / 9007199254740992.);
+    const double r = sqrt(-2. * log(u1));
+    W[i] = r * cos(2. * M_PI * u2);
+    if (i + 1 < W.size())
+      W[i + 1] = r * sin(2. * M_PI * u2);
+  }
+
+  // range of A: Q = orth(A (A^T A)^q W^T), nrows x l
+  std::vector<double> Y;
+  svdMultiplyAWt(A, nrows, ncols, W, l, Y);
+  svdOrthonormalize(Y, nrows, l, l, 1);
+  for (int q = 0; q < power; q++)
+  {
+    svdMultiplyAtY(A, nrows, ncols, Y, l, W);
+    svdOrthonormalize(W, ncols, l, 1, ncols);
+    svdMultiplyAWt(A, nrows, ncols, W, l, Y);
+    svdOrthonormalize(Y, nrows, l, l, 1);
+  }
+
+  // B = Q^T A, l x ncols; B B^T = E diag(lambda) E^T
+  std::vector<double> &B = W;
+  svdMultiplyAtY(A, nrows, ncols, Y, l, B);
+  std::vector<double> C(l * l);
+  std::vector<std::pair<std::size_t, std::size_t>> entries;
+  for (std::size_t a = 0; a < l; a++)
+    for (std::size_t b = a; b < l; b++)
+      entries.push_back(std::make_pair(a, b));
+  mcgenPool().parallelFor(entries.size(), [&](std::size_t ie) {
+    const std::size_t a = entries[ie].first, b = entries[ie].second;
+    double acc = 0.;
+    for (std::size_t c = 0; c < ncols; c++)
+      acc += B[a * ncols + c] * B[b * ncols + c];
+    C[a * l + b] = C[b * l + a] = acc;
+  });
+  std::vector<double> lambda, E;
+  svdJacobiEigen(C, l, lambda, E);
+
+  // singular values and right singular vectors V_j = (E_j^T B)/s_j
+  s.resize(k);
+  V.assign(k * ncols, 0.);
+  for (std::size_t j = 0; j < k; j++)
+    s[j] = sqrt(std::max(lambda[j], 0.));
+  const std::size_t nblocks = (ncols + svdColumnBlock - 1) / svdColumnBlock;
+  mcgenPool().parallelFor(nblocks, [&](std::size_t ib) {
+    const std::size_t c0 = ib * svdColumnBlock, c1 = std::min(ncols, c0 + svdColumnBlock);
+    for (std::size_t j = 0; j < k; j++)
+    {
+      if (s[j] <= 0.)
+        continue;
+      double *v = &V[j * ncols];
+      for (std::size_t a = 0; a < l; a++)
+      {
+        const double e = E[a * l + j] / s[j];
+        const double *b = &B[a * ncols];
+        for (std::size_t c = c0; c < c1; c++)
+          v[c] += e * b[c];
+      }
+    }
+  });
+} // randomizedSVD()
+
+#endif // SVD_H
@@ -0,0 +1,181 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/*
+ * Description: A small thread pool shared by all operations of mcgen.x.
+ *              Tasks are either submitted individually (submit(), returns a
+ *              std::future) or as an index range (parallelFor()). The tasks of
+ *              a parallelFor are put at the front of the queue and the calling
+ *              thread works on them too, so a reduction is not held up by
+ *              longer tasks, such as parsing input files, that were queued
+ *              before it.
+ *
+ *              The number of threads of the shared pool mcgenPool() is taken
+ *              from the environment variable MCGEN_NTHREADS, or from the
+ *              number of hardware threads if it is not set. Code using the pool
+ *              must not let the result depend on the order in which tasks
+ *              finish, so that the output is the same for any MCGEN_NTHREADS.
+ *
+ * Author: Lucas Kotz, Pavel Nadolsky
+ * Date: October 19, 2026
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex queueMutex;
+  std::condition_variable queueCondition;
+  bool stopping = false;
+
+  void WorkerLoop()
+  {
+    while (true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty())
+          return;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  } // void WorkerLoop()
+
+  void Enqueue(std::function<void()> task, bool urgent)
+  {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      if (urgent)
+        tasks.push_front(std::move(task));
+      else
+        tasks.push_back(std::move(task));
+    }
+    queueCondition.notify_one();
+  } // void Enqueue()
+
+public:
+  // nthreads = 0 creates no workers; all tasks then run on the calling thread
+  explicit ThreadPool(unsigned nthreads)
+  {
+    for (unsigned i = 0; i < nthreads; i++)
+      workers.emplace_back([this] { WorkerLoop(); });
+  }
+
+  // number of threads working on a parallelFor, including the caller
+  unsigned size() const
+  {
+    return workers.size() + 1;
+  }
+
+  // Run f() on a worker thread and return a future with its result.
+  template <class F>
+  auto submit(F f) -> std::future<decltype(f())>
+  {
+    typedef decltype(f()) R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    std::future<R> result = task->get_future();
+    if (workers.empty())
+      (*task)();
+    else
+      Enqueue([task] { (*task)(); }, false);
+    return result;
+  } // submit()
+
+  // Call body(i) for i = 0..n-1 and return when all calls have finished.
+  // The calls may run in any order and on any thread.
+  void parallelFor(std::size_t n, const std::function<void(std::size_t)> &body)
+  {
+    if (n == 0)
+      return;
+    if (workers.empty() || n == 1)
+    {
+      for (std::size_t i = 0; i < n; i++)
+        body(i);
+      return;
+    }
+
+    struct ForState
+    {
+      std::atomic<std::size_t> next{0};
+      std::size_t done = 0;
+      std::mutex doneMutex;
+      std::condition_variable doneCondition;
+    };
+    auto state = std::make_shared<ForState>();
+    const std::function<void(std::size_t)> *pbody = &body;
+
+    // each helper takes indices until none are left; body is only touched
+    // while an index is taken, i.e. before this function returns
+    auto work = [state, pbody, n]() {
+      std::size_t ndone = 0;
+      for (std::size_t i = state->next++; i < n; i = state->next++)
+      {
+        (*pbody)(i);
+        ndone++;
+      }
+      if (ndone > 0)
+      {
+        std::lock_guard<std::mutex> lock(state->doneMutex);
+        state->done += ndone;
+        if (state->done == n)
+          state->doneCondition.notify_all();
+      }
+    };
+
+    std::size_t nhelpers = std::min<std::size_t>(workers.size(), n - 1);
+    for (std::size_t i = 0; i < nhelpers; i++)
+      Enqueue(work, true);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->doneMutex);
+    state->doneCondition.wait(lock, [&] { return state->done == n; });
+  } // parallelFor()
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stopping = true;
+    }
+    queueCondition.notify_all();
+    for (std::size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  } // ~ThreadPool()
+}; // class ThreadPool
+
+// Number of threads requested through MCGEN_NTHREADS (at least 1)
+inline unsigned mcgenNumThreads()
+{
+  const char *env = getenv("MCGEN_NTHREADS");
+  if (env != NULL && atoi(env) > 0)
+    return atoi(env);
+  unsigned nhw = std::thread::hardware_concurrency();
+  return nhw > 0 ? nhw : 1;
+} // mcgenNumThreads()
+
+// The pool shared by all operations. It is never destroyed, so that a call
+// to exit() from inside a task does not wait for the task itself to finish.
+inline ThreadPool &mcgenPool()
+{
+  static ThreadPool *pool = new ThreadPool(mcgenNumThreads() - 1);
+  return *pool;
+} // mcgenPool()
+
+#endif // THREADPOOL_H